@@ -0,0 +1,309 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Synthetic CEL workload for cel_amqp.c
+ *
+ * Loads the module against the stand-ins in stubs.c, replays interleaved
+ * two party calls through its CEL callback and reports the cost per event,
+ * from the first event handed to the module to the last one published.
+ * The bench, lto and pgo targets of the Makefile run it.
+ */
+
+#include "asterisk.h"
+
+#include <getopt.h>
+
+#include "asterisk/amqp.h"
+#include "asterisk/cel.h"
+#include "asterisk/channel.h"
+#include "asterisk/cli.h"
+#include "asterisk/config_options.h"
+#include "asterisk/module.h"
+#include "asterisk/utils.h"
+
+/*! \brief Connection of the destination whose publishes are awaited */
+#define BENCH_CONNECTION "bench"
+
+/*! \brief Calls in progress at once */
+#define BENCH_CALLS 64
+
+/*! \brief Longest wait for the publisher to catch up, in seconds */
+#define BENCH_TIMEOUT 60
+
+#define BENCH_BRIDGE_EXTRA "{\"bridge_id\":\"4f7f3a8e-2c1b-4d2e-9a61-0c5d3e8b7a10\"," \
+	"\"bridge_technology\":\"simple_bridge\"}"
+
+/*! \brief One event of a call */
+struct bench_step {
+	enum ast_cel_event_type type;
+	/*! \brief 0 for the caller's channel, 1 for the callee's */
+	int leg;
+	const char *application;
+	const char *application_data;
+	const char *extra;
+};
+
+/*! \brief A basic call, as chan_pjsip and app_dial report it */
+static const struct bench_step call_steps[] = {
+	{ AST_CEL_CHANNEL_START, 0, "", "", "" },
+	{ AST_CEL_APP_START, 0, "Dial", "PJSIP/bob,30", "" },
+	{ AST_CEL_CHANNEL_START, 1, "", "", "" },
+	{ AST_CEL_ANSWER, 1, "AppDial", "(Outgoing Line)", "" },
+	{ AST_CEL_ANSWER, 0, "Dial", "PJSIP/bob,30", "" },
+	{ AST_CEL_BRIDGE_ENTER, 0, "Dial", "PJSIP/bob,30", BENCH_BRIDGE_EXTRA },
+	{ AST_CEL_BRIDGE_ENTER, 1, "AppDial", "(Outgoing Line)", BENCH_BRIDGE_EXTRA },
+	{ AST_CEL_BRIDGE_EXIT, 1, "AppDial", "(Outgoing Line)", BENCH_BRIDGE_EXTRA },
+	{ AST_CEL_BRIDGE_EXIT, 0, "Dial", "PJSIP/bob,30", BENCH_BRIDGE_EXTRA },
+	{ AST_CEL_HANGUP, 1, "AppDial", "(Outgoing Line)",
+		"{\"hangupcause\":16,\"hangupsource\":\"PJSIP/bob\",\"dialstatus\":\"\"}" },
+	{ AST_CEL_CHANNEL_END, 1, "AppDial", "(Outgoing Line)", "" },
+	{ AST_CEL_APP_END, 0, "Dial", "PJSIP/bob,30", "" },
+	{ AST_CEL_HANGUP, 0, "", "",
+		"{\"hangupcause\":16,\"hangupsource\":\"PJSIP/bob\",\"dialstatus\":\"ANSWER\"}" },
+	{ AST_CEL_CHANNEL_END, 0, "", "", "" },
+	{ AST_CEL_LINKEDID_END, 0, "", "", "" },
+};
+
+/*! \brief Tenants the calls are spread over, by account code and context */
+static const struct {
+	const char *account_code;
+	const char *context;
+} tenants[] = {
+	{ "", "from-internal" },
+	{ "acme", "acme-internal" },
+	{ "globex", "globex-internal" },
+};
+
+struct bench_call {
+	unsigned int step;
+	unsigned int tenant;
+	char unique_id[2][32];
+	char channel_name[2][48];
+	char caller_id_num[2][16];
+};
+
+static struct bench_call calls[BENCH_CALLS];
+
+/*! \brief Calls started so far */
+static unsigned int calls_started;
+
+static void call_start(struct bench_call *call)
+{
+	static time_t epoch;
+	unsigned int id = calls_started++;
+
+	if (!epoch) {
+		epoch = time(NULL);
+	}
+
+	call->step = 0;
+	call->tenant = id % ARRAY_LEN(tenants);
+	snprintf(call->unique_id[0], sizeof(call->unique_id[0]), "%ld.%u",
+		(long) epoch, id * 2);
+	snprintf(call->unique_id[1], sizeof(call->unique_id[1]), "%ld.%u",
+		(long) epoch, id * 2 + 1);
+	snprintf(call->channel_name[0], sizeof(call->channel_name[0]),
+		"PJSIP/alice-%08x", id * 2);
+	snprintf(call->channel_name[1], sizeof(call->channel_name[1]),
+		"PJSIP/bob-%08x", id * 2 + 1);
+	snprintf(call->caller_id_num[0], sizeof(call->caller_id_num[0]),
+		"1%03u", id % 1000);
+	snprintf(call->caller_id_num[1], sizeof(call->caller_id_num[1]),
+		"2%03u", (id * 7) % 1000);
+}
+
+/*! \brief Hand the module the next event of a call */
+static void call_event(struct bench_call *call)
+{
+	const struct bench_step *step = &call_steps[call->step];
+	int leg = step->leg;
+	struct ast_cel_event_record record = {
+		.version = AST_CEL_EVENT_RECORD_VERSION,
+		.event_type = step->type,
+		.event_time = ast_tvnow(),
+		.caller_id_name = leg ? "Bob" : "Alice",
+		.caller_id_num = call->caller_id_num[leg],
+		.caller_id_ani = call->caller_id_num[leg],
+		.caller_id_dnid = leg ? "" : call->caller_id_num[1],
+		.extension = leg ? "s" : call->caller_id_num[1],
+		.context = tenants[call->tenant].context,
+		.channel_name = call->channel_name[leg],
+		.application_name = step->application,
+		.application_data = step->application_data,
+		.account_code = tenants[call->tenant].account_code,
+		.peer_account = tenants[call->tenant].account_code,
+		.unique_id = call->unique_id[leg],
+		.linked_id = call->unique_id[0],
+		.amaflag = AST_AMA_DOCUMENTATION,
+		.extra = step->extra,
+	};
+
+	bench_cel_event(&record);
+
+	if (++call->step == ARRAY_LEN(call_steps)) {
+		call_start(call);
+	}
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct bench_result {
+	/*! \brief time spent in the CEL callback, per event */
+	double logged_ns;
+	/*! \brief time until the last event was published, per event */
+	double published_ns;
+	/*! \brief average size of a published event */
+	double bytes;
+};
+
+/*!
+ * \brief Replay events and wait until they are published.
+ *
+ * \retval 0 on success
+ * \retval -1 if the module fell behind by more than BENCH_TIMEOUT
+ */
+static int bench_run(unsigned int events, struct bench_result *result)
+{
+	unsigned long published;
+	unsigned long bytes;
+	unsigned long start_bytes;
+	unsigned long start = bench_amqp_published(BENCH_CONNECTION, &start_bytes);
+	int64_t begin;
+	int64_t logged;
+	int64_t end;
+	unsigned int i;
+
+	begin = now_ns();
+	for (i = 0; i < events; ++i) {
+		call_event(&calls[i % BENCH_CALLS]);
+	}
+	logged = now_ns();
+
+	while ((published = bench_amqp_published(BENCH_CONNECTION, &bytes) - start) < events) {
+		if (now_ns() - logged > (int64_t) BENCH_TIMEOUT * 1000000000) {
+			fprintf(stderr, "Only %lu of %u events published after %d s; "
+				"is the " BENCH_CONNECTION " destination dropping events?\n",
+				published, events, BENCH_TIMEOUT);
+			return -1;
+		}
+		usleep(50);
+	}
+	end = now_ns();
+
+	result->logged_ns = (double) (logged - begin) / events;
+	result->published_ns = (double) (end - begin) / events;
+	result->bytes = (double) (bytes - start_bytes) / events;
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-c config] [-n events] [-r runs] [-q] [-s]\n"
+		"  -c  cel_amqp.conf to load; default bench/cel_amqp_bench.conf\n"
+		"  -n  events per run; default 200000\n"
+		"  -r  runs; the fastest is reported; default 5\n"
+		"  -q  only print the fastest time per published event, in ns\n"
+		"  -s  print 'cel amqp show status' at the end\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct ast_module_info *module;
+	const char *config = "bench/cel_amqp_bench.conf";
+	struct bench_result best = { .published_ns = -1, };
+	struct bench_result result;
+	unsigned int events = 200000;
+	unsigned int runs = 5;
+	unsigned int run;
+	int quiet = 0;
+	int status = 0;
+	int res = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:n:r:qsh")) != -1) {
+		switch (opt) {
+		case 'c':
+			config = optarg;
+			break;
+		case 'n':
+			events = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 's':
+			status = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!events || !runs) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	module = bench_module();
+	bench_config_file(config);
+	if (!module || module->load() != AST_MODULE_LOAD_SUCCESS) {
+		fprintf(stderr, "Failed to load %s with %s\n",
+			module ? module->name : "the module", config);
+		return 1;
+	}
+
+	for (run = 0; run < ARRAY_LEN(calls); ++run) {
+		call_start(&calls[run]);
+	}
+
+	for (run = 1; run <= runs; ++run) {
+		if (bench_run(events, &result)) {
+			res = 1;
+			break;
+		}
+		if (!quiet) {
+			printf("run %u: %u events, %.0f ns/event logged, %.0f ns/event "
+				"published, %.0f bytes/event\n", run, events,
+				result.logged_ns, result.published_ns, result.bytes);
+		}
+		if (best.published_ns < 0 || result.published_ns < best.published_ns) {
+			best = result;
+		}
+	}
+
+	if (!res) {
+		if (quiet) {
+			printf("%.1f\n", best.published_ns);
+		} else {
+			printf("best: %.0f ns/event logged, %.0f ns/event published\n",
+				best.logged_ns, best.published_ns);
+		}
+	}
+
+	if (status) {
+		fflush(stdout);
+		bench_cli_command(STDOUT_FILENO, "cel amqp show status");
+	}
+
+	module->unload();
+
+	return res;
+}
@@ -0,0 +1,36 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Stand-in for asterisk.h, for building cel_amqp.c into the benchmark.
+ *
+ * The headers under bench/include declare just the parts of the Asterisk
+ * API the module uses, with the same names and semantics; bench/stubs.c
+ * implements them. Inline helpers follow Asterisk's own where it has them,
+ * so the module compiles to much the same code as against the real headers.
+ */
+
+#ifndef _ASTERISK_H
+#define _ASTERISK_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#endif /* _ASTERISK_H */
@@ -0,0 +1,39 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for res_amqp, for the benchmark.
+ *
+ * Connections never fail and publishing only counts the messages, so
+ * the benchmark measures the module and not the broker.
+ */
+
+#ifndef _ASTERISK_AMQP_H
+#define _ASTERISK_AMQP_H
+
+#include <amqp.h>
+
+struct ast_amqp_connection;
+
+/*! \return a reference to the named connection, created on first use */
+struct ast_amqp_connection *ast_amqp_get_connection(const char *name);
+
+int ast_amqp_basic_publish(struct ast_amqp_connection *cxn,
+	amqp_bytes_t exchange, amqp_bytes_t routing_key, amqp_boolean_t mandatory,
+	amqp_boolean_t immediate, const amqp_basic_properties_t *properties,
+	amqp_bytes_t body);
+
+/*!
+ * \brief Messages published so far on the named connection.
+ *
+ * \param name Connection name
+ * \param bytes Set to the bytes published, if not NULL
+ */
+unsigned long bench_amqp_published(const char *name, unsigned long *bytes);
+
+#endif /* _ASTERISK_AMQP_H */
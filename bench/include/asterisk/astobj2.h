@@ -0,0 +1,214 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for astobj2, for the benchmark.
+ *
+ * Reference counted objects with a recursive mutex, global object holders
+ * and hash containers, without the reference debugging.
+ */
+
+#ifndef _ASTERISK_ASTOBJ2_H
+#define _ASTERISK_ASTOBJ2_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "asterisk/strings.h"
+
+typedef void (*ao2_destructor_fn)(void *vdoomed);
+
+enum ao2_alloc_opts {
+	AO2_ALLOC_OPT_LOCK_MUTEX = (0 << 0),
+	AO2_ALLOC_OPT_LOCK_RWLOCK = (1 << 0),
+	AO2_ALLOC_OPT_LOCK_NOLOCK = (2 << 0),
+	AO2_ALLOC_OPT_LOCK_OBJ = AO2_ALLOC_OPT_LOCK_MUTEX | AO2_ALLOC_OPT_LOCK_RWLOCK,
+	AO2_ALLOC_OPT_LOCK_MASK = AO2_ALLOC_OPT_LOCK_MUTEX | AO2_ALLOC_OPT_LOCK_RWLOCK | AO2_ALLOC_OPT_LOCK_NOLOCK,
+	AO2_ALLOC_OPT_NO_REF_DEBUG = (1 << 2),
+};
+
+void *ao2_alloc_options(size_t data_size, ao2_destructor_fn destructor_fn,
+	unsigned int options);
+
+#define ao2_alloc(data_size, destructor_fn) \
+	ao2_alloc_options(data_size, destructor_fn, AO2_ALLOC_OPT_LOCK_MUTEX)
+
+/*! \return the reference count before the change */
+int ao2_ref(void *o, int delta);
+
+/*! \brief Release a reference, if obj is not NULL */
+void ao2_cleanup(void *obj);
+
+#define ao2_bump(obj) \
+	({ \
+		typeof(obj) __obj_ ## __LINE__ = (obj); \
+		if (__obj_ ## __LINE__) { \
+			ao2_ref(__obj_ ## __LINE__, +1); \
+		} \
+		(__obj_ ## __LINE__); \
+	})
+
+#define ao2_replace(dst, src) \
+	({ \
+		typeof(dst) *__dst_ ## __LINE__ = &dst; \
+		typeof(src) __src_ ## __LINE__ = src; \
+		int __changed_ ## __LINE__ = 0; \
+		if (__src_ ## __LINE__ != *__dst_ ## __LINE__) { \
+			if (__src_ ## __LINE__) { \
+				ao2_ref(__src_ ## __LINE__, +1); \
+			} \
+			if (*__dst_ ## __LINE__) { \
+				ao2_ref(*__dst_ ## __LINE__, -1); \
+			} \
+			*__dst_ ## __LINE__ = __src_ ## __LINE__; \
+			__changed_ ## __LINE__ = 1; \
+		} \
+		__changed_ ## __LINE__; \
+	})
+
+int ao2_lock(void *a);
+int ao2_unlock(void *a);
+
+#define ao2_wrlock(a) ao2_lock(a)
+#define ao2_rdlock(a) ao2_lock(a)
+
+/*! \brief Holder of a global object, replaced atomically on reload */
+struct ao2_global_obj {
+	pthread_rwlock_t lock;
+	void *obj;
+};
+
+#define AO2_GLOBAL_OBJ_STATIC(name) \
+	struct ao2_global_obj name = { .lock = PTHREAD_RWLOCK_INITIALIZER, }
+
+void *__ao2_global_obj_ref(struct ao2_global_obj *holder);
+void *__ao2_global_obj_replace(struct ao2_global_obj *holder, void *obj);
+int __ao2_global_obj_replace_unref(struct ao2_global_obj *holder, void *obj);
+
+#define ao2_global_obj_ref(holder) __ao2_global_obj_ref(&holder)
+#define ao2_global_obj_replace(holder, obj) __ao2_global_obj_replace(&holder, obj)
+#define ao2_global_obj_replace_unref(holder, obj) __ao2_global_obj_replace_unref(&holder, obj)
+#define ao2_global_obj_release(holder) __ao2_global_obj_replace_unref(&holder, NULL)
+
+enum search_flags {
+	OBJ_UNLINK = (1 << 0),
+	OBJ_NODATA = (1 << 1),
+	OBJ_MULTIPLE = (1 << 2),
+	OBJ_NOLOCK = (1 << 4),
+	OBJ_SEARCH_MASK = (0x07 << 5),
+	OBJ_SEARCH_NONE = (0 << 5),
+	OBJ_SEARCH_OBJECT = (1 << 5),
+	OBJ_SEARCH_KEY = (2 << 5),
+	OBJ_SEARCH_PARTIAL_KEY = (4 << 5),
+};
+
+#define OBJ_POINTER OBJ_SEARCH_OBJECT
+#define OBJ_KEY OBJ_SEARCH_KEY
+#define OBJ_PARTIAL_KEY OBJ_SEARCH_PARTIAL_KEY
+
+enum _cb_results {
+	CMP_MATCH = 0x1,
+	CMP_STOP = 0x2,
+};
+
+typedef int (ao2_callback_fn)(void *obj, void *arg, int flags);
+typedef int (ao2_hash_fn)(const void *obj, int flags);
+typedef int (ao2_sort_fn)(const void *obj_left, const void *obj_right, int flags);
+
+struct ao2_container;
+
+/*!
+ * \brief Allocate a hash container.
+ *
+ * \note Ordering, duplicate handling and sorting are not supported; the
+ * container options and sort function are ignored.
+ */
+struct ao2_container *ao2_container_alloc_hash(unsigned int ao2_options,
+	unsigned int container_options, unsigned int n_buckets, ao2_hash_fn *hash_fn,
+	ao2_sort_fn *sort_fn, ao2_callback_fn *cmp_fn);
+
+int ao2_container_count(struct ao2_container *c);
+
+int ao2_link_flags(struct ao2_container *c, void *obj, int flags);
+#define ao2_link(container, obj) ao2_link_flags(container, obj, 0)
+
+void *ao2_unlink_flags(struct ao2_container *c, void *obj, int flags);
+#define ao2_unlink(container, obj) ao2_unlink_flags(container, obj, 0)
+
+void *ao2_callback(struct ao2_container *c, enum search_flags flags,
+	ao2_callback_fn *cb_fn, void *arg);
+
+void *ao2_find(struct ao2_container *c, const void *arg, enum search_flags flags);
+
+/*!
+ * \brief Iterator over a container.
+ *
+ * Iterates over the objects linked when it was initialized.
+ */
+struct ao2_iterator {
+	void **objs;
+	int count;
+	int next;
+	int flags;
+};
+
+enum ao2_iterator_flags {
+	AO2_ITERATOR_DONTLOCK = (1 << 0),
+	AO2_ITERATOR_MALLOCD = (1 << 1),
+	AO2_ITERATOR_UNLINK = (1 << 2),
+};
+
+struct ao2_iterator ao2_iterator_init(struct ao2_container *c, int flags);
+void *ao2_iterator_next(struct ao2_iterator *iter);
+void ao2_iterator_destroy(struct ao2_iterator *iter);
+
+#define AO2_STRING_FIELD_HASH_FN(stype, field) \
+static int stype ## _hash_fn(const void *obj, const int flags) \
+{ \
+	const struct stype *object = obj; \
+	const char *key; \
+	switch (flags & OBJ_SEARCH_MASK) { \
+	case OBJ_SEARCH_KEY: \
+		key = obj; \
+		break; \
+	case OBJ_SEARCH_OBJECT: \
+		key = object->field; \
+		break; \
+	default: \
+		return 0; \
+	} \
+	return ast_str_hash(key); \
+}
+
+#define AO2_STRING_FIELD_CMP_FN(stype, field) \
+static int stype ## _cmp_fn(void *obj, void *arg, int flags) \
+{ \
+	const struct stype *object_left = obj, *object_right = arg; \
+	const char *right_key = arg; \
+	int cmp; \
+	switch (flags & OBJ_SEARCH_MASK) { \
+	case OBJ_SEARCH_OBJECT: \
+		right_key = object_right->field; \
+		/* Fall through */ \
+	case OBJ_SEARCH_KEY: \
+		cmp = strcmp(object_left->field, right_key); \
+		break; \
+	case OBJ_SEARCH_PARTIAL_KEY: \
+		cmp = strncmp(object_left->field, right_key, strlen(right_key)); \
+		break; \
+	default: \
+		cmp = 0; \
+		break; \
+	} \
+	if (cmp) { \
+		return 0; \
+	} \
+	return CMP_MATCH; \
+}
+
+#endif /* _ASTERISK_ASTOBJ2_H */
@@ -0,0 +1,105 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk CEL API, for the benchmark.
+ *
+ * The benchmark hands the backend a pointer to a filled in
+ * ast_cel_event_record as the event; ast_cel_fill_record() copies it.
+ */
+
+#ifndef _ASTERISK_CEL_H
+#define _ASTERISK_CEL_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+enum ast_cel_event_type {
+	AST_CEL_INVALID_VALUE = -1,
+	AST_CEL_ALL = 0,
+	/*! \brief channel birth */
+	AST_CEL_CHANNEL_START = 1,
+	/*! \brief channel end */
+	AST_CEL_CHANNEL_END = 2,
+	/*! \brief hangup terminates connection */
+	AST_CEL_HANGUP = 3,
+	/*! \brief A ringing phone is answered */
+	AST_CEL_ANSWER = 4,
+	/*! \brief an app starts */
+	AST_CEL_APP_START = 5,
+	/*! \brief an app ends */
+	AST_CEL_APP_END = 6,
+	/*! \brief channel enters a bridge */
+	AST_CEL_BRIDGE_ENTER = 7,
+	/*! \brief channel exits a bridge */
+	AST_CEL_BRIDGE_EXIT = 8,
+	/*! \brief a channel is parked */
+	AST_CEL_PARK_START = 9,
+	/*! \brief channel out of the park */
+	AST_CEL_PARK_END = 10,
+	/*! \brief a transfer occurs */
+	AST_CEL_BLINDTRANSFER = 11,
+	/*! \brief a transfer occurs */
+	AST_CEL_ATTENDEDTRANSFER = 12,
+	/*! \brief a user-defined event, the event name field should be set  */
+	AST_CEL_USER_DEFINED = 13,
+	/*! \brief the last channel with the given linkedid is retired  */
+	AST_CEL_LINKEDID_END = 14,
+	/*! \brief a directed pickup was performed on this channel */
+	AST_CEL_PICKUP = 15,
+	/*! \brief this call was forwarded somewhere else  */
+	AST_CEL_FORWARD = 16,
+	/*! \brief A local channel optimization occurred */
+	AST_CEL_LOCAL_OPTIMIZE = 17,
+	/*! \brief A local channel optimization has begun */
+	AST_CEL_LOCAL_OPTIMIZE_BEGIN = 18,
+};
+
+struct ast_event;
+
+struct ast_cel_event_record {
+	uint32_t version;
+#define AST_CEL_EVENT_RECORD_VERSION 2
+	enum ast_cel_event_type event_type;
+	struct timeval event_time;
+	const char *event_name;
+	const char *user_defined_name;
+	const char *caller_id_name;
+	const char *caller_id_num;
+	const char *caller_id_ani;
+	const char *caller_id_rdnis;
+	const char *caller_id_dnid;
+	const char *extension;
+	const char *context;
+	const char *channel_name;
+	const char *application_name;
+	const char *application_data;
+	const char *account_code;
+	const char *peer_account;
+	const char *unique_id;
+	const char *linked_id;
+	unsigned int amaflag;
+	const char *user_field;
+	const char *peer;
+	const char *extra;
+};
+
+typedef void (*ast_cel_backend_cb)(struct ast_event *event);
+
+int ast_cel_backend_register(const char *name, ast_cel_backend_cb backend_callback);
+int ast_cel_backend_unregister(const char *name);
+
+int ast_cel_fill_record(const struct ast_event *event, struct ast_cel_event_record *r);
+
+const char *ast_cel_get_type_name(enum ast_cel_event_type type);
+enum ast_cel_event_type ast_cel_str_to_event_type(const char *name);
+
+/*! \brief Hand an event to the registered backends */
+void bench_cel_event(const struct ast_cel_event_record *record);
+
+#endif /* _ASTERISK_CEL_H */
@@ -0,0 +1,28 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk channel API, for the benchmark.
+ */
+
+#ifndef _ASTERISK_CHANNEL_H
+#define _ASTERISK_CHANNEL_H
+
+#include "asterisk/astobj2.h"
+#include "asterisk/utils.h"
+
+enum ama_flags {
+	AST_AMA_NONE = 0,
+	AST_AMA_OMIT,
+	AST_AMA_BILLING,
+	AST_AMA_DOCUMENTATION,
+};
+
+const char *ast_channel_amaflags2string(enum ama_flags flags);
+
+#endif /* _ASTERISK_CHANNEL_H */
@@ -0,0 +1,69 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk CLI, for the benchmark.
+ */
+
+#ifndef _ASTERISK_CLI_H
+#define _ASTERISK_CLI_H
+
+#define CLI_SUCCESS (char *)RESULT_SUCCESS
+#define CLI_SHOWUSAGE (char *)RESULT_SHOWUSAGE
+#define CLI_FAILURE (char *)RESULT_FAILURE
+
+#define RESULT_SUCCESS 0
+#define RESULT_SHOWUSAGE 1
+#define RESULT_FAILURE 2
+
+#define AST_MAX_CMD_LEN 16
+
+enum {
+	CLI_INIT = -2,
+	CLI_GENERATE = -3,
+	CLI_HANDLER = -4,
+};
+
+struct ast_cli_args {
+	const int fd;
+	const int argc;
+	const char * const *argv;
+	const char *line;
+	const char *word;
+	const int pos;
+	int n;
+};
+
+struct ast_cli_entry {
+	const char * const cmda[AST_MAX_CMD_LEN];
+	const char * const summary;
+	const char * usage;
+	int inuse;
+	struct module *module;
+	char *_full_cmd;
+	int cmdlen;
+	int args;
+	char *command;
+	char *(*handler)(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
+};
+
+#define AST_CLI_DEFINE(fn, txt , ... ) { .handler = fn, .summary = txt, ## __VA_ARGS__ }
+
+void ast_cli(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+int ast_cli_register_multiple(struct ast_cli_entry *e, int len);
+int ast_cli_unregister_multiple(struct ast_cli_entry *e, int len);
+
+/*!
+ * \brief Run a registered command, writing its output to fd.
+ *
+ * \retval -1 if no command matches
+ */
+int bench_cli_command(int fd, const char *command);
+
+#endif /* _ASTERISK_CLI_H */
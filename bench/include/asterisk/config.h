@@ -0,0 +1,39 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for Asterisk configuration variables, for the benchmark.
+ */
+
+#ifndef _ASTERISK_CONFIG_H
+#define _ASTERISK_CONFIG_H
+
+/*! \brief Structure for variables, used for configurations and for channel variables */
+struct ast_variable {
+	/*! Variable name.  Stuffed into stuff[] at struct end. */
+	const char *name;
+	/*! Variable value.  Stuffed into stuff[] at struct end. */
+	const char *value;
+	/*! Next node in the list. */
+	struct ast_variable *next;
+	/*! Filename where variable found.  Stuffed into stuff[] at struct end. */
+	const char *file;
+	int lineno;
+	/*! Contents of file, name, and value in that order stuffed here. */
+	char stuff[0];
+};
+
+struct ast_variable *ast_variable_new(const char *name, const char *value,
+	const char *filename);
+
+void ast_variables_destroy(struct ast_variable *var);
+
+struct ast_variable *ast_variable_list_append(struct ast_variable **head,
+	struct ast_variable *new_var);
+
+#endif /* _ASTERISK_CONFIG_H */
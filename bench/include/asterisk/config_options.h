@@ -0,0 +1,186 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk configuration framework, for the benchmark.
+ *
+ * Handles what cel_amqp.c registers: global and item types matched by
+ * category regex and type field, exact and regex option names, and the
+ * option types listed below. The file to load is set with
+ * bench_config_file(); reloads always reprocess it.
+ */
+
+#ifndef _ASTERISK_CONFIG_OPTIONS_H
+#define _ASTERISK_CONFIG_OPTIONS_H
+
+#include <stddef.h>
+
+#include "asterisk/astobj2.h"
+#include "asterisk/config.h"
+
+struct aco_type_internal;
+struct aco_info_internal;
+struct aco_option;
+
+enum aco_type_t {
+	ACO_GLOBAL,
+	ACO_ITEM,
+	ACO_IGNORE,
+};
+
+enum aco_matchtype {
+	ACO_EXACT = 1,
+	ACO_REGEX,
+	ACO_PREFIX,
+};
+
+enum aco_category_op {
+	ACO_BLACKLIST = 0,
+	ACO_WHITELIST,
+	ACO_BLACKLIST_EXACT,
+	ACO_WHITELIST_EXACT,
+	ACO_BLACKLIST_ARRAY,
+	ACO_WHITELIST_ARRAY,
+};
+
+typedef void *(*aco_type_item_alloc)(const char *category);
+typedef void *(*aco_type_item_find)(struct ao2_container *newcontainer, const char *category);
+typedef int (*aco_type_item_pre_process)(void *newitem);
+typedef int (*aco_type_prelink)(void *newitem);
+
+struct aco_type {
+	/* common stuff */
+	enum aco_type_t type;
+	const char *name;
+	const char *category;
+	const char *matchfield;
+	const char *matchvalue;
+	void *internal_match;
+	enum aco_category_op category_match;
+	size_t item_offset;
+
+	/* non-global callbacks */
+	aco_type_item_alloc item_alloc;
+	aco_type_item_find item_find;
+	aco_type_item_pre_process item_pre_process;
+	aco_type_prelink item_prelink;
+	struct aco_type_internal *internal;
+};
+
+struct aco_file {
+	const char *filename;
+	const char *alias;
+	const char **preload;
+	const char *skip_category;
+	struct aco_type *types[];
+};
+
+typedef int (*aco_pre_apply_config)(void);
+typedef void (*aco_post_apply_config)(void);
+typedef void *(*aco_snapshot_alloc)(void);
+
+struct aco_info {
+	const char *module;
+	aco_pre_apply_config pre_apply_config;
+	aco_post_apply_config post_apply_config;
+	aco_snapshot_alloc snapshot_alloc;
+	struct ao2_global_obj *global_obj;
+	struct aco_info_internal *internal;
+	struct aco_file *files[];
+};
+
+#define ACO_TYPES(...) { __VA_ARGS__, NULL, }
+#define ACO_FILES(...) { __VA_ARGS__, NULL, }
+
+#define CONFIG_INFO_STANDARD(name, arr, alloc, ...) \
+static struct aco_info name = { \
+	.module = AST_MODULE, \
+	.global_obj = &arr, \
+	.snapshot_alloc = alloc, \
+	__VA_ARGS__ \
+};
+
+enum aco_process_status {
+	ACO_PROCESS_OK,
+	ACO_PROCESS_UNCHANGED,
+	ACO_PROCESS_ERROR,
+};
+
+enum aco_option_type {
+	OPT_ACL_T,
+	OPT_BOOL_T,
+	OPT_BOOLFLAG_T,
+	OPT_CHAR_ARRAY_T,
+	OPT_CODEC_T,
+	OPT_CUSTOM_T,
+	OPT_DOUBLE_T,
+	OPT_INT_T,
+	OPT_NOOP_T,
+	OPT_SOCKADDR_T,
+	OPT_STRINGFIELD_T,
+	OPT_UINT_T,
+	OPT_YESNO_T,
+	OPT_TIMELEN_T,
+};
+
+enum aco_option_flags {
+	PARSE_DEFAULT = 0,
+	PARSE_IN_RANGE = (1 << 6),
+	PARSE_OUT_RANGE = (1 << 7),
+};
+
+typedef int (*aco_option_handler)(const struct aco_option *opt,
+	struct ast_variable *var, void *obj);
+
+int aco_info_init(struct aco_info *info);
+void aco_info_destroy(struct aco_info *info);
+
+enum aco_process_status aco_process_config(struct aco_info *info, int reload);
+
+/*! \brief The configuration being applied, for pre_apply_config */
+void *aco_pending_config(struct aco_info *info);
+
+int aco_set_defaults(struct aco_type *type, const char *category, void *obj);
+
+/*!
+ * \note Supported option types are OPT_BOOL_T (argument: field offset,
+ * and flags true when "yes" sets it), OPT_DOUBLE_T, OPT_INT_T and
+ * OPT_UINT_T (field offset), OPT_STRINGFIELD_T (STRFLDSET), OPT_NOOP_T and
+ * OPT_CUSTOM_T.
+ */
+int __aco_option_register(struct aco_info *info, const char *name,
+	enum aco_matchtype match_type, struct aco_type **types,
+	const char *default_val, enum aco_option_type type,
+	aco_option_handler handler, unsigned int flags, unsigned int no_doc,
+	size_t argc, ...);
+
+#define VA_NARGS(...) VA_NARGS1(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define VA_NARGS1(_1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+#define aco_option_register(info, name, matchtype, types, default_val, opt_type, flags, ...) \
+	__aco_option_register(info, name, matchtype, types, default_val, opt_type, NULL, flags, 0, VA_NARGS(__VA_ARGS__), __VA_ARGS__);
+
+#define aco_option_register_custom(info, name, matchtype, types, default_val, handler, flags) \
+	__aco_option_register(info, name, matchtype, types, default_val, OPT_CUSTOM_T, handler, flags, 0, 0);
+
+/*! \brief Offsets of the fields an option sets, in order */
+#define FLDSET(type, ...) FLDSET_(VA_NARGS(__VA_ARGS__), type, __VA_ARGS__)
+#define FLDSET_(N, type, ...) PASTE(FLDSET_, N)(type, __VA_ARGS__)
+#define FLDSET_1(type, a) offsetof(type, a)
+#define FLDSET_2(type, a, b) offsetof(type, a), offsetof(type, b)
+#define FLDSET_3(type, a, b, c) offsetof(type, a), offsetof(type, b), offsetof(type, c)
+#define PASTE(arg1, arg2) PASTE1(arg1, arg2)
+#define PASTE1(arg1, arg2) arg1##arg2
+
+/*! \brief Offsets of a string field, its pool and its manager */
+#define STRFLDSET(type, ...) FLDSET(type, __VA_ARGS__, __field_mgr_pool, __field_mgr)
+
+/*! \brief Set the file aco_process_config() loads */
+void bench_config_file(const char *filename);
+
+#endif /* _ASTERISK_CONFIG_OPTIONS_H */
@@ -0,0 +1,60 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk JSON API, for the benchmark.
+ *
+ * Implemented on Jansson, as in Asterisk.
+ */
+
+#ifndef _ASTERISK_JSON_H
+#define _ASTERISK_JSON_H
+
+#include <sys/time.h>
+
+struct ast_json;
+
+typedef long long ast_json_int_t;
+
+struct ast_json_error;
+
+enum ast_json_encoding_format {
+	/*! Compact format, low human readability */
+	AST_JSON_COMPACT,
+	/*! Formatted for human readability */
+	AST_JSON_PRETTY,
+	/*! Keys sorted alphabetically */
+	AST_JSON_SORTED,
+};
+
+void ast_json_free(void *p);
+
+struct ast_json *ast_json_ref(struct ast_json *value);
+void ast_json_unref(struct ast_json *value);
+
+struct ast_json *ast_json_null(void);
+struct ast_json *ast_json_string_create(const char *value);
+struct ast_json *ast_json_integer_create(ast_json_int_t value);
+
+int ast_json_object_set(struct ast_json *object, const char *key,
+	struct ast_json *value);
+int ast_json_object_del(struct ast_json *object, const char *key);
+
+struct ast_json *ast_json_pack(char const *format, ...);
+
+struct ast_json *ast_json_load_string(const char *input,
+	struct ast_json_error *error);
+
+char *ast_json_dump_string_format(struct ast_json *root,
+	enum ast_json_encoding_format format);
+
+#define ast_json_dump_string(root) ast_json_dump_string_format(root, AST_JSON_COMPACT)
+
+struct ast_json *ast_json_timeval(const struct timeval tv, const char *zone);
+
+#endif /* _ASTERISK_JSON_H */
@@ -0,0 +1,167 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk linked list macros, for the benchmark.
+ */
+
+#ifndef _ASTERISK_LINKEDLISTS_H
+#define _ASTERISK_LINKEDLISTS_H
+
+#include "asterisk/lock.h"
+
+#define AST_LIST_LOCK(head) ast_mutex_lock(&(head)->lock)
+#define AST_LIST_UNLOCK(head) ast_mutex_unlock(&(head)->lock)
+
+#define AST_LIST_HEAD(name, type) \
+struct name { \
+	struct type *first; \
+	struct type *last; \
+	ast_mutex_t lock; \
+}
+
+#define AST_LIST_HEAD_NOLOCK(name, type) \
+struct name { \
+	struct type *first; \
+	struct type *last; \
+}
+
+#define AST_LIST_HEAD_INIT_VALUE { \
+	.first = NULL, \
+	.last = NULL, \
+	.lock = AST_MUTEX_INIT_VALUE, \
+	}
+
+#define AST_LIST_HEAD_NOLOCK_INIT_VALUE { \
+	.first = NULL, \
+	.last = NULL, \
+	}
+
+#define AST_LIST_HEAD_STATIC(name, type) \
+struct name { \
+	struct type *first; \
+	struct type *last; \
+	ast_mutex_t lock; \
+} name = AST_LIST_HEAD_INIT_VALUE
+
+#define AST_LIST_ENTRY(type) \
+struct { \
+	struct type *next; \
+}
+
+#define AST_LIST_FIRST(head) ((head)->first)
+#define AST_LIST_LAST(head) ((head)->last)
+#define AST_LIST_NEXT(elm, field) ((elm)->field.next)
+#define AST_LIST_EMPTY(head) (AST_LIST_FIRST(head) == NULL)
+
+#define AST_LIST_TRAVERSE(head, var, field) \
+	for ((var) = (head)->first; (var); (var) = (var)->field.next)
+
+#define AST_LIST_HEAD_INIT_NOLOCK(head) { \
+	(head)->first = NULL; \
+	(head)->last = NULL; \
+}
+
+#define AST_LIST_INSERT_HEAD(head, elm, field) do { \
+	(elm)->field.next = (head)->first; \
+	(head)->first = (elm); \
+	if (!(head)->last) { \
+		(head)->last = (elm); \
+	} \
+} while (0)
+
+#define AST_LIST_INSERT_TAIL(head, elm, field) do { \
+	if (!(head)->first) { \
+		(head)->first = (elm); \
+		(head)->last = (elm); \
+	} else { \
+		(head)->last->field.next = (elm); \
+		(head)->last = (elm); \
+	} \
+} while (0)
+
+#define AST_LIST_APPEND_LIST(head, list, field) do { \
+	if (!(list)->first) { \
+		break; \
+	} \
+	if (!(head)->first) { \
+		(head)->first = (list)->first; \
+		(head)->last = (list)->last; \
+	} else { \
+		(head)->last->field.next = (list)->first; \
+		(head)->last = (list)->last; \
+	} \
+	(list)->first = NULL; \
+	(list)->last = NULL; \
+} while (0)
+
+#define AST_LIST_TRAVERSE_SAFE_BEGIN(head, var, field) { \
+	typeof((head)) __list_head = head; \
+	typeof(__list_head->first) __list_next; \
+	typeof(__list_head->first) __list_prev = NULL; \
+	typeof(__list_head->first) __list_current; \
+	for ((var) = __list_head->first, \
+		__list_current = (var), \
+		__list_next = (var) ? (var)->field.next : NULL; \
+		(var); \
+		__list_prev = __list_current, \
+		(var) = __list_next, \
+		__list_current = (var), \
+		__list_next = (var) ? (var)->field.next : NULL, \
+		(void) __list_prev)
+
+#define AST_LIST_REMOVE_CURRENT(field) do { \
+	__list_current->field.next = NULL; \
+	__list_current = __list_prev; \
+	if (__list_prev) { \
+		__list_prev->field.next = __list_next; \
+	} else { \
+		__list_head->first = __list_next; \
+	} \
+	if (!__list_next) { \
+		__list_head->last = __list_prev; \
+	} \
+} while (0)
+
+#define AST_LIST_TRAVERSE_SAFE_END }
+
+#define AST_LIST_REMOVE_HEAD(head, field) ({ \
+	typeof((head)->first) __cur = (head)->first; \
+	if (__cur) { \
+		(head)->first = __cur->field.next; \
+		__cur->field.next = NULL; \
+		if ((head)->last == __cur) { \
+			(head)->last = NULL; \
+		} \
+	} \
+	__cur; \
+})
+
+#define AST_LIST_REMOVE(head, elm, field) ({ \
+	typeof(elm) __elm = (elm); \
+	typeof(elm) __prev = NULL; \
+	typeof(elm) __cur = (head)->first; \
+	while (__cur && __cur != __elm) { \
+		__prev = __cur; \
+		__cur = __cur->field.next; \
+	} \
+	if (__cur) { \
+		if (__prev) { \
+			__prev->field.next = __cur->field.next; \
+		} else { \
+			(head)->first = __cur->field.next; \
+		} \
+		if ((head)->last == __cur) { \
+			(head)->last = __prev; \
+		} \
+		__cur->field.next = NULL; \
+	} \
+	__cur; \
+})
+
+#endif /* _ASTERISK_LINKEDLISTS_H */
@@ -0,0 +1,42 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk time zone functions, for the benchmark.
+ */
+
+#ifndef _ASTERISK_LOCALTIME_H
+#define _ASTERISK_LOCALTIME_H
+
+#include <sys/time.h>
+#include <time.h>
+
+struct ast_tm {
+	int tm_sec;
+	int tm_min;
+	int tm_hour;
+	int tm_mday;
+	int tm_mon;
+	int tm_year;
+	int tm_wday;
+	int tm_yday;
+	int tm_isdst;
+	long tm_gmtoff;
+	char *tm_zone;
+	/*! \brief microseconds, for %q */
+	int tm_usec;
+};
+
+struct ast_tm *ast_localtime(const struct timeval *timep, struct ast_tm *p_tm,
+	const char *zone);
+
+/*! \brief strftime(3), plus %q for the milliseconds */
+int ast_strftime(char *buf, size_t len, const char *format,
+	const struct ast_tm *tm);
+
+#endif /* _ASTERISK_LOCALTIME_H */
@@ -0,0 +1,67 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for Asterisk locking, for the benchmark.
+ *
+ * Like Asterisk's, mutexes are recursive.
+ */
+
+#ifndef _ASTERISK_LOCK_H
+#define _ASTERISK_LOCK_H
+
+#include <pthread.h>
+
+typedef pthread_mutex_t ast_mutex_t;
+typedef pthread_cond_t ast_cond_t;
+
+#define AST_MUTEX_INIT_VALUE PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#define AST_MUTEX_DEFINE_STATIC(mutex) \
+	static ast_mutex_t mutex = AST_MUTEX_INIT_VALUE
+
+static inline int ast_mutex_init(ast_mutex_t *mutex)
+{
+	pthread_mutexattr_t attr;
+	int res;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	res = pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	return res;
+}
+
+#define ast_mutex_destroy(m) pthread_mutex_destroy(m)
+#define ast_mutex_lock(m) pthread_mutex_lock(m)
+#define ast_mutex_unlock(m) pthread_mutex_unlock(m)
+#define ast_mutex_trylock(m) pthread_mutex_trylock(m)
+
+#define ast_cond_init(cond, attr) pthread_cond_init(cond, attr)
+#define ast_cond_destroy(cond) pthread_cond_destroy(cond)
+#define ast_cond_signal(cond) pthread_cond_signal(cond)
+#define ast_cond_broadcast(cond) pthread_cond_broadcast(cond)
+#define ast_cond_wait(cond, mutex) pthread_cond_wait(cond, mutex)
+#define ast_cond_timedwait(cond, mutex, time) pthread_cond_timedwait(cond, mutex, time)
+
+#define ast_atomic_fetch_add(ptr, val, memorder) __atomic_fetch_add((ptr), (val), (memorder))
+#define ast_atomic_add_fetch(ptr, val, memorder) __atomic_add_fetch((ptr), (val), (memorder))
+#define ast_atomic_fetch_sub(ptr, val, memorder) __atomic_fetch_sub((ptr), (val), (memorder))
+#define ast_atomic_sub_fetch(ptr, val, memorder) __atomic_sub_fetch((ptr), (val), (memorder))
+
+static inline int ast_atomic_fetchadd_int(volatile int *p, int v)
+{
+	return __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+
+static inline int ast_atomic_dec_and_test(volatile int *p)
+{
+	return __atomic_sub_fetch(p, 1, __ATOMIC_RELAXED) == 0;
+}
+
+#endif /* _ASTERISK_LOCK_H */
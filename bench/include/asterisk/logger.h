@@ -0,0 +1,46 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk logger, for the benchmark.
+ */
+
+#ifndef _ASTERISK_LOGGER_H
+#define _ASTERISK_LOGGER_H
+
+#define __LOG_DEBUG    0
+#define __LOG_NOTICE   2
+#define __LOG_WARNING  3
+#define __LOG_ERROR    4
+#define __LOG_VERBOSE  5
+
+#define _A_ __FILE__, __LINE__, __PRETTY_FUNCTION__
+
+#define LOG_DEBUG   __LOG_DEBUG, _A_
+#define LOG_NOTICE  __LOG_NOTICE, _A_
+#define LOG_WARNING __LOG_WARNING, _A_
+#define LOG_ERROR   __LOG_ERROR, _A_
+#define LOG_VERBOSE __LOG_VERBOSE, _A_
+
+/*! \brief Log a message; the benchmark prints warnings and errors only. */
+void ast_log(int level, const char *file, int line, const char *function,
+	const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+
+#define ast_debug(level, ...) do { \
+	if (0) { \
+		ast_log(LOG_DEBUG, __VA_ARGS__); \
+	} \
+} while (0)
+
+#define ast_verb(level, ...) do { \
+	if (0) { \
+		ast_log(LOG_VERBOSE, __VA_ARGS__); \
+	} \
+} while (0)
+
+#endif /* _ASTERISK_LOGGER_H */
@@ -0,0 +1,111 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk module API, for the benchmark.
+ *
+ * As in Asterisk, AST_MODULE_INFO() registers the module from a
+ * constructor; bench_module() returns it.
+ */
+
+#ifndef _ASTERISK_MODULE_H
+#define _ASTERISK_MODULE_H
+
+enum ast_module_load_result {
+	AST_MODULE_LOAD_SUCCESS = 0,
+	AST_MODULE_LOAD_DECLINE = 1,
+	AST_MODULE_LOAD_SKIP = 2,
+	AST_MODULE_LOAD_PRIORITY = 3,
+	AST_MODULE_LOAD_FAILURE = -1,
+};
+
+enum ast_module_flags {
+	AST_MODFLAG_DEFAULT = 0,
+	AST_MODFLAG_GLOBAL_SYMBOLS = (1 << 0),
+	AST_MODFLAG_LOAD_ORDER = (1 << 1),
+};
+
+enum ast_module_support_level {
+	AST_MODULE_SUPPORT_UNKNOWN,
+	AST_MODULE_SUPPORT_CORE,
+	AST_MODULE_SUPPORT_EXTENDED,
+	AST_MODULE_SUPPORT_DEPRECATED,
+};
+
+enum ast_module_load_priority {
+	AST_MODPRI_REALTIME_DEPEND = 10,
+	AST_MODPRI_REALTIME_DEPEND2 = 20,
+	AST_MODPRI_REALTIME_DRIVER = 30,
+	AST_MODPRI_CORE = 40,
+	AST_MODPRI_TIMING = 40,
+	AST_MODPRI_CHANNEL_DEPEND = 50,
+	AST_MODPRI_BRIDGE_DRIVER = 60,
+	AST_MODPRI_CHANNEL_DRIVER = 60,
+	AST_MODPRI_APP_DEPEND = 70,
+	AST_MODPRI_DEVSTATE_PROVIDER = 80,
+	AST_MODPRI_DEVSTATE_PLUGIN = 90,
+	AST_MODPRI_CDR_DRIVER = 100,
+	AST_MODPRI_DEFAULT = 128,
+	AST_MODPRI_DEVSTATE_CONSUMER = 150,
+};
+
+#define ASTERISK_GPL_KEY \
+"This paragraph is copyright (c) 2006 by Digium, Inc. \
+In order for your module to load, it must return this \
+key via a function called \"key\".  Any code which \
+includes this paragraph must be licensed under the GNU \
+General Public License version 2 or later (at your \
+option).  In addition to Digium's general reservations \
+of rights, Digium expressly reserves the right to \
+allow other parties to license this paragraph under \
+different terms. Any use of Digium, Inc. trademarks or \
+logos (including \"Asterisk\" or \"Digium\") without \
+express written permission of Digium, Inc. is prohibited.\n"
+
+struct ast_module;
+
+struct ast_module_info {
+	const char *name;
+	int (*load)(void);
+	int (*reload)(void);
+	int (*unload)(void);
+	const char *description;
+	const char *key;
+	unsigned int flags;
+	unsigned char load_pri;
+	const char *requires;
+	const char *optional_modules;
+	const char *enhances;
+	enum ast_module_support_level support_level;
+};
+
+void ast_module_register(const struct ast_module_info *info);
+
+struct ast_module *AST_MODULE_SELF_SYM(void);
+
+/*! \brief The module registered by AST_MODULE_INFO() */
+const struct ast_module_info *bench_module(void);
+
+#define AST_MODULE_INFO(keystr, flags_to_set, desc, fields...) \
+	static struct ast_module_info __mod_info = { \
+		.name = AST_MODULE, \
+		.flags = flags_to_set, \
+		.description = desc, \
+		.key = keystr, \
+		fields \
+	}; \
+	static void __attribute__((constructor)) __reg_module(void) \
+	{ \
+		ast_module_register(&__mod_info); \
+	} \
+	struct ast_module *AST_MODULE_SELF_SYM(void) \
+	{ \
+		return NULL; \
+	}
+
+#endif /* _ASTERISK_MODULE_H */
@@ -0,0 +1,57 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for Asterisk string fields, for the benchmark.
+ *
+ * As in Asterisk, the fields of a structure lie between its pool pointer
+ * and its manager. Each value set is allocated on its own and kept on the
+ * pool list until the fields are freed.
+ */
+
+#ifndef _ASTERISK_STRINGFIELDS_H
+#define _ASTERISK_STRINGFIELDS_H
+
+#include <stddef.h>
+
+typedef const char * ast_string_field;
+
+struct ast_string_field_pool;
+
+struct ast_string_field_mgr {
+	/*! \brief number of values set since initialization */
+	size_t sets;
+};
+
+#define AST_STRING_FIELD(name) const ast_string_field name
+
+#define AST_DECLARE_STRING_FIELDS(field_list) \
+	struct ast_string_field_pool *__field_mgr_pool; \
+	field_list \
+	struct ast_string_field_mgr __field_mgr
+
+int __ast_string_field_init(struct ast_string_field_mgr *mgr,
+	struct ast_string_field_pool **pool_head, int needed);
+
+void __ast_string_field_ptr_set(struct ast_string_field_mgr *mgr,
+	struct ast_string_field_pool **pool_head, ast_string_field *ptr,
+	const char *data);
+
+#define ast_string_field_init(x, size) \
+	__ast_string_field_init(&(x)->__field_mgr, &(x)->__field_mgr_pool, size)
+
+#define ast_string_field_free_memory(x) \
+	__ast_string_field_init(&(x)->__field_mgr, &(x)->__field_mgr_pool, 0)
+
+#define ast_string_field_ptr_set(x, ptr, data) \
+	__ast_string_field_ptr_set(&(x)->__field_mgr, &(x)->__field_mgr_pool, ptr, data)
+
+#define ast_string_field_set(x, field, data) \
+	ast_string_field_ptr_set(x, (ast_string_field *) &(x)->field, data)
+
+#endif /* _ASTERISK_STRINGFIELDS_H */
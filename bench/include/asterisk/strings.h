@@ -0,0 +1,116 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk string helpers, for the benchmark.
+ */
+
+#ifndef _ASTERISK_STRINGS_H
+#define _ASTERISK_STRINGS_H
+
+#include <ctype.h>
+#include <string.h>
+
+static inline int ast_strlen_zero(const char *s)
+{
+	return (!s || (*s == '\0'));
+}
+
+#define S_OR(a, b) ({typeof(&((a)[0])) __x = (a); ast_strlen_zero(__x) ? (b) : __x;})
+
+static inline char *ast_skip_blanks(const char *str)
+{
+	if (str) {
+		while (*str && ((unsigned char) *str) < 33) {
+			str++;
+		}
+	}
+
+	return (char *) str;
+}
+
+static inline char *ast_trim_blanks(char *str)
+{
+	char *work = str;
+
+	if (work) {
+		work += strlen(work) - 1;
+		/* It's tempting to only want to erase after we exit this loop,
+		   but since ast_trim_blanks *could* receive a constant string
+		   (which we presumably wouldn't have to touch), we shouldn't
+		   actually set anything unless we must, and it's easier just
+		   to set each position to \0 than to keep track of a variable
+		   for it */
+		while ((work >= str) && ((unsigned char) *work) < 33) {
+			*(work--) = '\0';
+		}
+	}
+	return str;
+}
+
+static inline char *ast_strip(char *s)
+{
+	if ((s = ast_skip_blanks(s))) {
+		ast_trim_blanks(s);
+	}
+	return s;
+}
+
+static inline void ast_copy_string(char *dst, const char *src, size_t size)
+{
+	volatile size_t sz = size;
+	volatile char *sp = (char *) src;
+
+	while (*sp && sz) {
+		*dst++ = *sp++;
+		sz--;
+	}
+	if (__builtin_expect(!sz, 0)) {
+		dst--;
+	}
+	*dst = '\0';
+}
+
+static inline int ast_begins_with(const char *str, const char *prefix)
+{
+	if (ast_strlen_zero(str) || ast_strlen_zero(prefix)) {
+		return 0;
+	}
+
+	while (*str == *prefix && *prefix != '\0') {
+		++str;
+		++prefix;
+	}
+
+	return *prefix == '\0';
+}
+
+/*! \brief Compute a hash value on a string (djb2, as Asterisk does). */
+static inline int ast_str_hash(const char *str)
+{
+	int hash = 5381;
+
+	while (*str) {
+		hash = hash * 33 ^ (unsigned char) *str++;
+	}
+
+	return abs(hash);
+}
+
+static inline int ast_str_case_hash(const char *str)
+{
+	int hash = 5381;
+
+	while (*str) {
+		hash = hash * 33 ^ (unsigned char) tolower(*str++);
+	}
+
+	return abs(hash);
+}
+
+#endif /* _ASTERISK_STRINGS_H */
@@ -0,0 +1,48 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for Asterisk thread storage, for the benchmark.
+ */
+
+#ifndef _ASTERISK_THREADSTORAGE_H
+#define _ASTERISK_THREADSTORAGE_H
+
+#include <pthread.h>
+
+struct ast_threadstorage {
+	pthread_once_t once;
+	pthread_key_t key;
+	void (*key_init)(void);
+	int (*custom_init)(void *);
+};
+
+void ast_free_ptr(void *ptr);
+
+#define AST_THREADSTORAGE(name) \
+	AST_THREADSTORAGE_CUSTOM(name, NULL, ast_free_ptr)
+
+#define AST_THREADSTORAGE_CUSTOM(name, c_init, c_cleanup) \
+static void __init_##name(void); \
+static struct ast_threadstorage name = { \
+	.once = PTHREAD_ONCE_INIT, \
+	.key_init = __init_##name, \
+	.custom_init = c_init, \
+}; \
+static void __init_##name(void) \
+{ \
+	pthread_key_create(&(name).key, c_cleanup); \
+}
+
+/*!
+ * \brief Retrieve the calling thread's storage, allocated zeroed on the
+ * first call.
+ */
+void *ast_threadstorage_get(struct ast_threadstorage *ts, size_t init_size);
+
+#endif /* _ASTERISK_THREADSTORAGE_H */
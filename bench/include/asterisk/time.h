@@ -0,0 +1,101 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk time helpers, for the benchmark.
+ */
+
+#ifndef _ASTERISK_TIME_H
+#define _ASTERISK_TIME_H
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+static inline int64_t ast_tvdiff_sec(struct timeval end, struct timeval start)
+{
+	int64_t result = end.tv_sec - start.tv_sec;
+	if (result > 0 && end.tv_usec < start.tv_usec) {
+		result--;
+	} else if (result < 0 && end.tv_usec > start.tv_usec) {
+		result++;
+	}
+
+	return result;
+}
+
+static inline int64_t ast_tvdiff_us(struct timeval end, struct timeval start)
+{
+	return (end.tv_sec - start.tv_sec) * (int64_t) 1000000 +
+		end.tv_usec - start.tv_usec;
+}
+
+static inline int64_t ast_tvdiff_ms(struct timeval end, struct timeval start)
+{
+	/* the offset by 1,000,000 below is intentional...
+	   it avoids differences in the way that division
+	   is handled for positive and negative numbers, by ensuring
+	   that the divisor is always positive
+	*/
+	int64_t sec_dif = (int64_t)(end.tv_sec - start.tv_sec) * 1000;
+	int64_t usec_dif = (1000000 + end.tv_usec - start.tv_usec) / 1000 - 1000;
+	return sec_dif + usec_dif;
+}
+
+static inline int ast_tvzero(const struct timeval t)
+{
+	return (t.tv_sec == 0 && t.tv_usec == 0);
+}
+
+static inline int ast_tvcmp(struct timeval _a, struct timeval _b)
+{
+	if (_a.tv_sec < _b.tv_sec) {
+		return -1;
+	}
+	if (_a.tv_sec > _b.tv_sec) {
+		return 1;
+	}
+	/* now seconds are equal */
+	if (_a.tv_usec < _b.tv_usec) {
+		return -1;
+	}
+	if (_a.tv_usec > _b.tv_usec) {
+		return 1;
+	}
+	return 0;
+}
+
+static inline int ast_tveq(struct timeval _a, struct timeval _b)
+{
+	return (_a.tv_sec == _b.tv_sec && _a.tv_usec == _b.tv_usec);
+}
+
+static inline struct timeval ast_tvnow(void)
+{
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t;
+}
+
+struct timeval ast_tvadd(struct timeval a, struct timeval b);
+struct timeval ast_tvsub(struct timeval a, struct timeval b);
+
+static inline struct timeval ast_tv(time_t sec, suseconds_t usec)
+{
+	struct timeval t;
+	t.tv_sec = sec;
+	t.tv_usec = usec;
+	return t;
+}
+
+static inline struct timeval ast_samp2tv(unsigned int _nsamp, unsigned int _rate)
+{
+	return ast_tv(_nsamp / _rate, (_nsamp % _rate) * (1000000 / (float) _rate));
+}
+
+#endif /* _ASTERISK_TIME_H */
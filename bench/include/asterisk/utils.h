@@ -0,0 +1,72 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Stand-in for the Asterisk utility functions, for the benchmark.
+ */
+
+#ifndef _ASTERISK_UTILS_H
+#define _ASTERISK_UTILS_H
+
+#include <alloca.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asterisk/lock.h"
+#include "asterisk/logger.h"
+#include "asterisk/strings.h"
+#include "asterisk/time.h"
+
+#define ast_malloc(len) malloc(len)
+#define ast_calloc(num, len) calloc(num, len)
+#define ast_realloc(p, len) realloc(p, len)
+#define ast_strdup(str) strdup(str)
+#define ast_strndup(str, len) strndup(str, len)
+#define ast_asprintf(ret, fmt, ...) asprintf(ret, fmt, __VA_ARGS__)
+#define ast_free(p) free(p)
+
+void ast_free_ptr(void *ptr);
+
+#define ast_strdupa(s) \
+	(__extension__ \
+	({ \
+		const char *__old = (s); \
+		size_t __len = strlen(__old) + 1; \
+		char *__new = __builtin_alloca(__len); \
+		memcpy(__new, __old, __len); \
+		__new; \
+	}))
+
+#define ARRAY_LEN(a) (size_t) (sizeof(a) / sizeof(0[a]))
+
+#define MIN(a, b) ({ typeof(a) __a = (a); typeof(b) __b = (b); ((__a > __b) ? __b : __a);})
+#define MAX(a, b) ({ typeof(a) __a = (a); typeof(b) __b = (b); ((__a < __b) ? __b : __a);})
+
+#define SWAP(a, b) do { typeof(a) __tmp = (b); (b) = (a); (a) = __tmp; } while (0)
+
+#define RAII_VAR(vartype, varname, initval, dtor) \
+	/* Prototype needed due to http://gcc.gnu.org/bugzilla/show_bug.cgi?id=36774 */ \
+	auto void _dtor_ ## varname (vartype * v); \
+	void _dtor_ ## varname (vartype * v) { dtor(*v); } \
+	vartype varname __attribute__((cleanup(_dtor_ ## varname))) = (initval)
+
+#define ast_assert(a) do { (void) sizeof(a); } while (0)
+
+#define AST_PTHREADT_NULL (pthread_t) -1
+#define AST_PTHREADT_STOP (pthread_t) -2
+
+int ast_pthread_create_background(pthread_t *thread, pthread_attr_t *attr,
+	void *(*start_routine)(void *), void *data);
+
+long int ast_random(void);
+
+int ast_true(const char *val);
+int ast_false(const char *val);
+
+#endif /* _ASTERISK_UTILS_H */
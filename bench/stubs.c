@@ -0,0 +1,1596 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Stand-ins for the Asterisk API used by cel_amqp.c
+ *
+ * Just enough of astobj2, the configuration framework, JSON, CEL, the CLI
+ * and res_amqp to load the module outside of Asterisk and feed it events.
+ * JSON goes through Jansson as in Asterisk, since serializing is a large
+ * part of the cost per event; publishing only counts messages.
+ */
+
+#include "asterisk.h"
+
+#include <regex.h>
+
+#include <jansson.h>
+
+#include "asterisk/amqp.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/cel.h"
+#include "asterisk/channel.h"
+#include "asterisk/cli.h"
+#include "asterisk/config.h"
+#include "asterisk/config_options.h"
+#include "asterisk/json.h"
+#include "asterisk/localtime.h"
+#include "asterisk/logger.h"
+#include "asterisk/module.h"
+#include "asterisk/stringfields.h"
+#include "asterisk/threadstorage.h"
+#include "asterisk/utils.h"
+
+/* Logging and utilities */
+
+void ast_log(int level, const char *file, int line, const char *function,
+	const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level < __LOG_WARNING || level == __LOG_VERBOSE) {
+		return;
+	}
+
+	fprintf(stderr, "[%s] %s:%d %s: ",
+		level == __LOG_ERROR ? "ERROR" : "WARNING", file, line, function);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+void ast_free_ptr(void *ptr)
+{
+	ast_free(ptr);
+}
+
+int ast_pthread_create_background(pthread_t *thread, pthread_attr_t *attr,
+	void *(*start_routine)(void *), void *data)
+{
+	return pthread_create(thread, attr, start_routine, data);
+}
+
+long int ast_random(void)
+{
+	return random();
+}
+
+int ast_true(const char *s)
+{
+	if (ast_strlen_zero(s)) {
+		return 0;
+	}
+
+	if (!strcasecmp(s, "yes") ||
+	    !strcasecmp(s, "true") ||
+	    !strcasecmp(s, "y") ||
+	    !strcasecmp(s, "t") ||
+	    !strcasecmp(s, "1") ||
+	    !strcasecmp(s, "on")) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int ast_false(const char *s)
+{
+	if (ast_strlen_zero(s)) {
+		return 0;
+	}
+
+	if (!strcasecmp(s, "no") ||
+	    !strcasecmp(s, "false") ||
+	    !strcasecmp(s, "n") ||
+	    !strcasecmp(s, "f") ||
+	    !strcasecmp(s, "0") ||
+	    !strcasecmp(s, "off")) {
+		return -1;
+	}
+
+	return 0;
+}
+
+#define ONE_MILLION 1000000
+
+static struct timeval tvfix(struct timeval a)
+{
+	if (a.tv_usec >= ONE_MILLION) {
+		a.tv_sec += a.tv_usec / ONE_MILLION;
+		a.tv_usec %= ONE_MILLION;
+	} else if (a.tv_usec < 0) {
+		a.tv_usec = 0;
+	}
+	return a;
+}
+
+struct timeval ast_tvadd(struct timeval a, struct timeval b)
+{
+	/* consistency checks to guarantee usec in 0..999999 */
+	a = tvfix(a);
+	b = tvfix(b);
+	a.tv_sec += b.tv_sec;
+	a.tv_usec += b.tv_usec;
+	if (a.tv_usec >= ONE_MILLION) {
+		a.tv_sec++;
+		a.tv_usec -= ONE_MILLION;
+	}
+	return a;
+}
+
+struct timeval ast_tvsub(struct timeval a, struct timeval b)
+{
+	/* consistency checks to guarantee usec in 0..999999 */
+	a = tvfix(a);
+	b = tvfix(b);
+	a.tv_sec -= b.tv_sec;
+	a.tv_usec -= b.tv_usec;
+	if (a.tv_usec < 0) {
+		a.tv_sec--;
+		a.tv_usec += ONE_MILLION;
+	}
+	return a;
+}
+
+struct ast_tm *ast_localtime(const struct timeval *timep, struct ast_tm *p_tm,
+	const char *zone)
+{
+	struct tm tm;
+
+	if (!localtime_r(&timep->tv_sec, &tm)) {
+		return NULL;
+	}
+
+	p_tm->tm_sec = tm.tm_sec;
+	p_tm->tm_min = tm.tm_min;
+	p_tm->tm_hour = tm.tm_hour;
+	p_tm->tm_mday = tm.tm_mday;
+	p_tm->tm_mon = tm.tm_mon;
+	p_tm->tm_year = tm.tm_year;
+	p_tm->tm_wday = tm.tm_wday;
+	p_tm->tm_yday = tm.tm_yday;
+	p_tm->tm_isdst = tm.tm_isdst;
+	p_tm->tm_gmtoff = tm.tm_gmtoff;
+	p_tm->tm_zone = (char *) tm.tm_zone;
+	p_tm->tm_usec = timep->tv_usec;
+
+	return p_tm;
+}
+
+int ast_strftime(char *buf, size_t len, const char *format,
+	const struct ast_tm *tm)
+{
+	char fmt[128];
+	size_t out = 0;
+	struct tm t = {
+		.tm_sec = tm->tm_sec,
+		.tm_min = tm->tm_min,
+		.tm_hour = tm->tm_hour,
+		.tm_mday = tm->tm_mday,
+		.tm_mon = tm->tm_mon,
+		.tm_year = tm->tm_year,
+		.tm_wday = tm->tm_wday,
+		.tm_yday = tm->tm_yday,
+		.tm_isdst = tm->tm_isdst,
+		.tm_gmtoff = tm->tm_gmtoff,
+		.tm_zone = tm->tm_zone,
+	};
+
+	/* Expand %q to milliseconds before handing over to strftime() */
+	for (; *format && out < sizeof(fmt) - 4; ++format) {
+		if (format[0] == '%' && format[1] == 'q') {
+			out += snprintf(fmt + out, sizeof(fmt) - out, "%03d",
+				tm->tm_usec / 1000);
+			++format;
+		} else if (format[0] == '%' && format[1]) {
+			fmt[out++] = *format++;
+			fmt[out++] = *format;
+		} else {
+			fmt[out++] = *format;
+		}
+	}
+	fmt[out] = '\0';
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+	return strftime(buf, len, fmt, &t);
+#pragma GCC diagnostic pop
+}
+
+void *ast_threadstorage_get(struct ast_threadstorage *ts, size_t init_size)
+{
+	void *buf;
+
+	pthread_once(&ts->once, ts->key_init);
+	if (!(buf = pthread_getspecific(ts->key))) {
+		if (!(buf = ast_calloc(1, init_size))) {
+			return NULL;
+		}
+		if (ts->custom_init && ts->custom_init(buf)) {
+			ast_free(buf);
+			return NULL;
+		}
+		pthread_setspecific(ts->key, buf);
+	}
+
+	return buf;
+}
+
+/* astobj2 */
+
+struct astobj2 {
+	ao2_destructor_fn destructor_fn;
+	unsigned int options;
+	int ref_counter;
+	pthread_mutex_t lock;
+} __attribute__((aligned(16)));
+
+#define INTERNAL_OBJ(user_data) \
+	((struct astobj2 *) ((char *) (user_data) - sizeof(struct astobj2)))
+#define EXTERNAL_OBJ(obj) ((void *) ((char *) (obj) + sizeof(struct astobj2)))
+
+void *ao2_alloc_options(size_t data_size, ao2_destructor_fn destructor_fn,
+	unsigned int options)
+{
+	struct astobj2 *obj;
+
+	obj = ast_calloc(1, sizeof(*obj) + data_size);
+	if (!obj) {
+		return NULL;
+	}
+
+	obj->destructor_fn = destructor_fn;
+	obj->options = options;
+	obj->ref_counter = 1;
+	if ((options & AO2_ALLOC_OPT_LOCK_MASK) != AO2_ALLOC_OPT_LOCK_NOLOCK) {
+		ast_mutex_init(&obj->lock);
+	}
+
+	return EXTERNAL_OBJ(obj);
+}
+
+int ao2_ref(void *user_data, int delta)
+{
+	struct astobj2 *obj;
+	int current;
+
+	if (!user_data) {
+		return -1;
+	}
+
+	obj = INTERNAL_OBJ(user_data);
+	current = __atomic_fetch_add(&obj->ref_counter, delta, __ATOMIC_ACQ_REL);
+	if (current + delta == 0) {
+		if (obj->destructor_fn) {
+			obj->destructor_fn(user_data);
+		}
+		if ((obj->options & AO2_ALLOC_OPT_LOCK_MASK) != AO2_ALLOC_OPT_LOCK_NOLOCK) {
+			ast_mutex_destroy(&obj->lock);
+		}
+		ast_free(obj);
+	}
+
+	return current;
+}
+
+void ao2_cleanup(void *obj)
+{
+	if (obj) {
+		ao2_ref(obj, -1);
+	}
+}
+
+int ao2_lock(void *user_data)
+{
+	struct astobj2 *obj = INTERNAL_OBJ(user_data);
+
+	if ((obj->options & AO2_ALLOC_OPT_LOCK_MASK) == AO2_ALLOC_OPT_LOCK_NOLOCK) {
+		return 0;
+	}
+	return ast_mutex_lock(&obj->lock);
+}
+
+int ao2_unlock(void *user_data)
+{
+	struct astobj2 *obj = INTERNAL_OBJ(user_data);
+
+	if ((obj->options & AO2_ALLOC_OPT_LOCK_MASK) == AO2_ALLOC_OPT_LOCK_NOLOCK) {
+		return 0;
+	}
+	return ast_mutex_unlock(&obj->lock);
+}
+
+void *__ao2_global_obj_ref(struct ao2_global_obj *holder)
+{
+	void *obj;
+
+	pthread_rwlock_rdlock(&holder->lock);
+	obj = holder->obj;
+	if (obj) {
+		ao2_ref(obj, +1);
+	}
+	pthread_rwlock_unlock(&holder->lock);
+
+	return obj;
+}
+
+void *__ao2_global_obj_replace(struct ao2_global_obj *holder, void *obj)
+{
+	void *obj_old;
+
+	if (obj) {
+		ao2_ref(obj, +1);
+	}
+	pthread_rwlock_wrlock(&holder->lock);
+	obj_old = holder->obj;
+	holder->obj = obj;
+	pthread_rwlock_unlock(&holder->lock);
+
+	return obj_old;
+}
+
+int __ao2_global_obj_replace_unref(struct ao2_global_obj *holder, void *obj)
+{
+	void *obj_old = __ao2_global_obj_replace(holder, obj);
+
+	if (obj_old) {
+		ao2_ref(obj_old, -1);
+		return 1;
+	}
+	return 0;
+}
+
+struct bucket_entry {
+	struct bucket_entry *next;
+	void *obj;
+};
+
+struct ao2_container {
+	ao2_hash_fn *hash_fn;
+	ao2_callback_fn *cmp_fn;
+	unsigned int n_buckets;
+	int elements;
+	struct bucket_entry **buckets;
+};
+
+static void container_destruct(void *obj)
+{
+	struct ao2_container *c = obj;
+	struct bucket_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < c->n_buckets; ++i) {
+		while ((entry = c->buckets[i])) {
+			c->buckets[i] = entry->next;
+			ao2_ref(entry->obj, -1);
+			ast_free(entry);
+		}
+	}
+	ast_free(c->buckets);
+}
+
+struct ao2_container *ao2_container_alloc_hash(unsigned int ao2_options,
+	unsigned int container_options, unsigned int n_buckets, ao2_hash_fn *hash_fn,
+	ao2_sort_fn *sort_fn, ao2_callback_fn *cmp_fn)
+{
+	struct ao2_container *c;
+
+	c = ao2_alloc_options(sizeof(*c), container_destruct, ao2_options);
+	if (!c) {
+		return NULL;
+	}
+
+	c->hash_fn = hash_fn;
+	c->cmp_fn = cmp_fn;
+	c->n_buckets = hash_fn && n_buckets ? n_buckets : 1;
+	c->buckets = ast_calloc(c->n_buckets, sizeof(*c->buckets));
+	if (!c->buckets) {
+		ao2_ref(c, -1);
+		return NULL;
+	}
+
+	return c;
+}
+
+int ao2_container_count(struct ao2_container *c)
+{
+	return __atomic_load_n(&c->elements, __ATOMIC_RELAXED);
+}
+
+static unsigned int container_bucket(struct ao2_container *c, const void *arg,
+	int flags)
+{
+	if (!c->hash_fn) {
+		return 0;
+	}
+	return (unsigned int) abs(c->hash_fn(arg, flags & OBJ_SEARCH_MASK)) % c->n_buckets;
+}
+
+int ao2_link_flags(struct ao2_container *c, void *obj, int flags)
+{
+	struct bucket_entry *entry;
+	unsigned int i;
+
+	entry = ast_malloc(sizeof(*entry));
+	if (!entry) {
+		return 0;
+	}
+	entry->obj = obj;
+	ao2_ref(obj, +1);
+
+	i = container_bucket(c, obj, OBJ_SEARCH_OBJECT);
+	if (!(flags & OBJ_NOLOCK)) {
+		ao2_lock(c);
+	}
+	entry->next = c->buckets[i];
+	c->buckets[i] = entry;
+	__atomic_add_fetch(&c->elements, 1, __ATOMIC_RELAXED);
+	if (!(flags & OBJ_NOLOCK)) {
+		ao2_unlock(c);
+	}
+
+	return 1;
+}
+
+/*!
+ * \brief Walk a container calling cb_fn, as ao2_callback() does.
+ *
+ * A key or object search only walks the bucket it hashes to.
+ */
+static void *container_walk(struct ao2_container *c, int flags,
+	ao2_callback_fn *cb_fn, void *arg)
+{
+	struct ao2_iterator *multi = NULL;
+	struct bucket_entry **link;
+	struct bucket_entry *entry;
+	void *found = NULL;
+	unsigned int first = 0;
+	unsigned int last = c->n_buckets;
+	unsigned int i;
+	int search = flags & OBJ_SEARCH_MASK;
+	int ret;
+
+	if ((flags & OBJ_MULTIPLE) && !(flags & OBJ_NODATA)) {
+		multi = ast_calloc(1, sizeof(*multi));
+		if (!multi) {
+			return NULL;
+		}
+		multi->flags = AO2_ITERATOR_MALLOCD;
+	}
+
+	if (search == OBJ_SEARCH_OBJECT || search == OBJ_SEARCH_KEY) {
+		first = container_bucket(c, arg, flags);
+		last = first + 1;
+	}
+
+	if (!(flags & OBJ_NOLOCK)) {
+		ao2_lock(c);
+	}
+	for (i = first; i < last; ++i) {
+		link = &c->buckets[i];
+		while ((entry = *link)) {
+			ret = cb_fn ? cb_fn(entry->obj, arg, flags) : CMP_MATCH;
+			if (!(ret & CMP_MATCH)) {
+				link = &entry->next;
+				if (ret & CMP_STOP) {
+					goto done;
+				}
+				continue;
+			}
+
+			if (multi) {
+				void **objs = ast_realloc(multi->objs,
+					(multi->count + 1) * sizeof(*objs));
+
+				if (objs) {
+					multi->objs = objs;
+					objs[multi->count++] = ao2_bump(entry->obj);
+				}
+			} else if (!(flags & OBJ_NODATA) && !found) {
+				found = ao2_bump(entry->obj);
+			}
+
+			if (flags & OBJ_UNLINK) {
+				*link = entry->next;
+				__atomic_sub_fetch(&c->elements, 1, __ATOMIC_RELAXED);
+				ao2_ref(entry->obj, -1);
+				ast_free(entry);
+			} else {
+				link = &entry->next;
+			}
+
+			if (!(flags & OBJ_MULTIPLE) || (ret & CMP_STOP)) {
+				goto done;
+			}
+		}
+	}
+done:
+	if (!(flags & OBJ_NOLOCK)) {
+		ao2_unlock(c);
+	}
+
+	return multi ? (void *) multi : found;
+}
+
+void *ao2_callback(struct ao2_container *c, enum search_flags flags,
+	ao2_callback_fn *cb_fn, void *arg)
+{
+	return container_walk(c, flags, cb_fn, arg);
+}
+
+void *ao2_find(struct ao2_container *c, const void *arg, enum search_flags flags)
+{
+	if (!(flags & OBJ_SEARCH_MASK)) {
+		flags |= OBJ_SEARCH_OBJECT;
+	}
+	return container_walk(c, flags, c->cmp_fn, (void *) arg);
+}
+
+static int match_by_addr(void *obj, void *arg, int flags)
+{
+	return obj == arg ? CMP_MATCH | CMP_STOP : 0;
+}
+
+void *ao2_unlink_flags(struct ao2_container *c, void *obj, int flags)
+{
+	flags &= OBJ_NOLOCK;
+	container_walk(c, flags | OBJ_SEARCH_OBJECT | OBJ_UNLINK | OBJ_NODATA,
+		match_by_addr, obj);
+
+	return NULL;
+}
+
+struct ao2_iterator ao2_iterator_init(struct ao2_container *c, int flags)
+{
+	struct ao2_iterator *all;
+	struct ao2_iterator iter = { .flags = flags };
+
+	all = container_walk(c, OBJ_MULTIPLE, NULL, NULL);
+	if (all) {
+		iter.objs = all->objs;
+		iter.count = all->count;
+		ast_free(all);
+	}
+
+	return iter;
+}
+
+void *ao2_iterator_next(struct ao2_iterator *iter)
+{
+	void *obj;
+
+	if (iter->next >= iter->count) {
+		return NULL;
+	}
+	obj = iter->objs[iter->next];
+	iter->objs[iter->next++] = NULL;
+
+	return obj;
+}
+
+void ao2_iterator_destroy(struct ao2_iterator *iter)
+{
+	int i;
+
+	for (i = iter->next; i < iter->count; ++i) {
+		ao2_ref(iter->objs[i], -1);
+	}
+	ast_free(iter->objs);
+	iter->objs = NULL;
+	iter->count = iter->next = 0;
+
+	if (iter->flags & AO2_ITERATOR_MALLOCD) {
+		ast_free(iter);
+	}
+}
+
+/* String fields */
+
+struct ast_string_field_pool {
+	struct ast_string_field_pool *prev;
+	char base[0];
+};
+
+static const char string_field_empty[] = "";
+
+int __ast_string_field_init(struct ast_string_field_mgr *mgr,
+	struct ast_string_field_pool **pool_head, int needed)
+{
+	ast_string_field *field = (ast_string_field *) (pool_head + 1);
+	struct ast_string_field_pool *pool;
+
+	while ((pool = *pool_head)) {
+		*pool_head = pool->prev;
+		ast_free(pool);
+	}
+
+	/* The fields lie between the pool and the manager */
+	for (; (char *) field < (char *) mgr; ++field) {
+		*field = string_field_empty;
+	}
+	mgr->sets = 0;
+
+	return 0;
+}
+
+void __ast_string_field_ptr_set(struct ast_string_field_mgr *mgr,
+	struct ast_string_field_pool **pool_head, ast_string_field *ptr,
+	const char *data)
+{
+	struct ast_string_field_pool *pool;
+	size_t len;
+
+	if (ast_strlen_zero(data)) {
+		*ptr = string_field_empty;
+		return;
+	}
+
+	len = strlen(data) + 1;
+	pool = ast_malloc(sizeof(*pool) + len);
+	if (!pool) {
+		return;
+	}
+	memcpy(pool->base, data, len);
+	pool->prev = *pool_head;
+	*pool_head = pool;
+	*ptr = pool->base;
+	++mgr->sets;
+}
+
+/* Configuration */
+
+struct ast_variable *ast_variable_new(const char *name, const char *value,
+	const char *filename)
+{
+	struct ast_variable *variable;
+	size_t name_len = strlen(name) + 1;
+	size_t val_len = strlen(value) + 1;
+	size_t fn_len = strlen(filename) + 1;
+	char *dst;
+
+	variable = ast_calloc(1, sizeof(*variable) + name_len + val_len + fn_len);
+	if (!variable) {
+		return NULL;
+	}
+
+	dst = variable->stuff;
+	variable->file = memcpy(dst, filename, fn_len);
+	dst += fn_len;
+	variable->name = memcpy(dst, name, name_len);
+	dst += name_len;
+	variable->value = memcpy(dst, value, val_len);
+
+	return variable;
+}
+
+void ast_variables_destroy(struct ast_variable *var)
+{
+	struct ast_variable *next;
+
+	for (; var; var = next) {
+		next = var->next;
+		ast_free(var);
+	}
+}
+
+struct ast_variable *ast_variable_list_append(struct ast_variable **head,
+	struct ast_variable *new_var)
+{
+	struct ast_variable *tail;
+
+	if (!*head) {
+		*head = new_var;
+	} else {
+		for (tail = *head; tail->next; tail = tail->next) {
+		}
+		tail->next = new_var;
+	}
+
+	for (tail = new_var; tail && tail->next; tail = tail->next) {
+	}
+
+	return tail;
+}
+
+struct aco_option {
+	const char *name;
+	enum aco_matchtype match_type;
+	regex_t name_regex;
+	const char *default_val;
+	enum aco_option_type type;
+	aco_option_handler handler;
+	unsigned int flags;
+	size_t argc;
+	intptr_t args[3];
+};
+
+/*! \brief Options registered for a type */
+struct aco_type_internal {
+	struct aco_option **opts;
+	size_t count;
+};
+
+struct aco_info_internal {
+	/*! \brief the configuration being applied */
+	void *pending;
+};
+
+static char *config_filename;
+
+void bench_config_file(const char *filename)
+{
+	ast_free(config_filename);
+	config_filename = ast_strdup(filename);
+}
+
+static void aco_option_destroy(void *obj)
+{
+	struct aco_option *opt = obj;
+
+	if (opt->match_type == ACO_REGEX) {
+		regfree(&opt->name_regex);
+	}
+}
+
+int aco_info_init(struct aco_info *info)
+{
+	info->internal = ast_calloc(1, sizeof(*info->internal));
+
+	return info->internal ? 0 : -1;
+}
+
+void aco_info_destroy(struct aco_info *info)
+{
+	struct aco_type *type;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	for (i = 0; info->files[i]; ++i) {
+		for (j = 0; (type = info->files[i]->types[j]); ++j) {
+			if (!type->internal) {
+				continue;
+			}
+			for (k = 0; k < type->internal->count; ++k) {
+				ao2_ref(type->internal->opts[k], -1);
+			}
+			ast_free(type->internal->opts);
+			ast_free(type->internal);
+			type->internal = NULL;
+		}
+	}
+
+	ast_free(info->internal);
+	info->internal = NULL;
+}
+
+int __aco_option_register(struct aco_info *info, const char *name,
+	enum aco_matchtype match_type, struct aco_type **types,
+	const char *default_val, enum aco_option_type type,
+	aco_option_handler handler, unsigned int flags, unsigned int no_doc,
+	size_t argc, ...)
+{
+	struct aco_option *opt;
+	struct aco_option **opts;
+	struct aco_type *aco_type;
+	va_list ap;
+	size_t i;
+
+	if (argc > ARRAY_LEN(opt->args)) {
+		ast_log(LOG_ERROR, "Option '%s' has too many arguments\n", name);
+		return -1;
+	}
+
+	opt = ao2_alloc_options(sizeof(*opt), aco_option_destroy,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!opt) {
+		return -1;
+	}
+	opt->name = name;
+	opt->match_type = match_type;
+	opt->default_val = default_val;
+	opt->type = type;
+	opt->handler = handler;
+	opt->flags = flags;
+	opt->argc = argc;
+	va_start(ap, argc);
+	for (i = 0; i < argc; ++i) {
+		opt->args[i] = va_arg(ap, size_t);
+	}
+	va_end(ap);
+
+	if (match_type == ACO_REGEX
+		&& regcomp(&opt->name_regex, name, REG_EXTENDED | REG_NOSUB)) {
+		opt->match_type = ACO_EXACT;
+		ao2_ref(opt, -1);
+		return -1;
+	}
+
+	for (i = 0; (aco_type = types[i]); ++i) {
+		if (!aco_type->internal) {
+			aco_type->internal = ast_calloc(1, sizeof(*aco_type->internal));
+			if (!aco_type->internal) {
+				ao2_ref(opt, -1);
+				return -1;
+			}
+		}
+		opts = ast_realloc(aco_type->internal->opts,
+			(aco_type->internal->count + 1) * sizeof(*opts));
+		if (!opts) {
+			ao2_ref(opt, -1);
+			return -1;
+		}
+		opts[aco_type->internal->count++] = ao2_bump(opt);
+		aco_type->internal->opts = opts;
+	}
+	ao2_ref(opt, -1);
+
+	return 0;
+}
+
+static struct aco_option *aco_option_find(struct aco_type *type,
+	const char *name)
+{
+	struct aco_option *opt;
+	size_t i;
+
+	if (!type->internal) {
+		return NULL;
+	}
+
+	for (i = 0; i < type->internal->count; ++i) {
+		opt = type->internal->opts[i];
+		if (opt->match_type == ACO_REGEX
+			? !regexec(&opt->name_regex, name, 0, NULL, 0)
+			: !strcasecmp(opt->name, name)) {
+			return opt;
+		}
+	}
+
+	return NULL;
+}
+
+static int aco_option_apply(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	char *end;
+
+	switch (opt->type) {
+	case OPT_CUSTOM_T:
+		return opt->handler(opt, var, obj);
+	case OPT_NOOP_T:
+		return 0;
+	case OPT_BOOL_T:
+		*(int *) ((char *) obj + opt->args[0]) =
+			opt->flags ? ast_true(var->value) : ast_false(var->value);
+		return 0;
+	case OPT_UINT_T:
+		errno = 0;
+		*(unsigned int *) ((char *) obj + opt->args[0]) =
+			strtoul(var->value, &end, 0);
+		return errno || *end || *var->value == '-' ? -1 : 0;
+	case OPT_INT_T:
+		errno = 0;
+		*(int *) ((char *) obj + opt->args[0]) = strtol(var->value, &end, 0);
+		return errno || *end ? -1 : 0;
+	case OPT_DOUBLE_T:
+		errno = 0;
+		*(double *) ((char *) obj + opt->args[0]) = strtod(var->value, &end);
+		return errno || *end ? -1 : 0;
+	case OPT_STRINGFIELD_T:
+		__ast_string_field_ptr_set(
+			(struct ast_string_field_mgr *) ((char *) obj + opt->args[2]),
+			(struct ast_string_field_pool **) ((char *) obj + opt->args[1]),
+			(ast_string_field *) ((char *) obj + opt->args[0]), var->value);
+		return 0;
+	default:
+		ast_log(LOG_ERROR, "Option '%s' has an unsupported type\n", opt->name);
+		return -1;
+	}
+}
+
+int aco_set_defaults(struct aco_type *type, const char *category, void *obj)
+{
+	struct aco_option *opt;
+	struct ast_variable *var;
+	size_t i;
+	int res;
+
+	if (!type->internal) {
+		return 0;
+	}
+
+	for (i = 0; i < type->internal->count; ++i) {
+		opt = type->internal->opts[i];
+		if (!opt->default_val || opt->match_type == ACO_REGEX) {
+			continue;
+		}
+		var = ast_variable_new(opt->name, opt->default_val, "");
+		if (!var) {
+			return -1;
+		}
+		res = aco_option_apply(opt, var, obj);
+		ast_variables_destroy(var);
+		if (res) {
+			ast_log(LOG_ERROR, "Unable to set default for %s, %s=%s\n",
+				category, opt->name, opt->default_val);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void *aco_pending_config(struct aco_info *info)
+{
+	return info->internal ? info->internal->pending : NULL;
+}
+
+/*! \brief A category read from the configuration file */
+struct bench_category {
+	struct bench_category *next;
+	struct ast_variable *vars;
+	char name[0];
+};
+
+static void categories_destroy(struct bench_category *cat)
+{
+	struct bench_category *next;
+
+	for (; cat; cat = next) {
+		next = cat->next;
+		ast_variables_destroy(cat->vars);
+		ast_free(cat);
+	}
+}
+
+/*!
+ * \brief Read name = value lines grouped in [categories].
+ *
+ * Comments start with a semicolon. Templates are not supported.
+ */
+static struct bench_category *categories_load(const char *filename)
+{
+	struct bench_category *head = NULL;
+	struct bench_category **tail = &head;
+	struct bench_category *cat = NULL;
+	struct ast_variable *var;
+	char line[1024];
+	char *value;
+	char *s;
+	FILE *f;
+	int lineno = 0;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		ast_log(LOG_ERROR, "Unable to open %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		++lineno;
+		if ((s = strchr(line, ';'))) {
+			*s = '\0';
+		}
+		s = ast_strip(line);
+		if (!*s) {
+			continue;
+		}
+
+		if (*s == '[') {
+			value = strchr(s, ']');
+			if (!value) {
+				ast_log(LOG_ERROR, "Unterminated category at line %d of %s\n",
+					lineno, filename);
+				goto error;
+			}
+			*value = '\0';
+			cat = ast_calloc(1, sizeof(*cat) + strlen(s + 1) + 1);
+			if (!cat) {
+				goto error;
+			}
+			strcpy(cat->name, s + 1);
+			*tail = cat;
+			tail = &cat->next;
+			continue;
+		}
+
+		value = strchr(s, '=');
+		if (!cat || !value) {
+			ast_log(LOG_ERROR, "Syntax error at line %d of %s\n", lineno, filename);
+			goto error;
+		}
+		*value++ = '\0';
+		if (*value == '>') {
+			++value;
+		}
+		var = ast_variable_new(ast_strip(s), ast_strip(value), filename);
+		if (!var) {
+			goto error;
+		}
+		var->lineno = lineno;
+		ast_variable_list_append(&cat->vars, var);
+	}
+
+	fclose(f);
+	return head;
+
+error:
+	fclose(f);
+	categories_destroy(head);
+	return NULL;
+}
+
+static int category_matches(struct aco_type *type, struct bench_category *cat)
+{
+	struct ast_variable *var;
+	regex_t regex;
+	int match;
+
+	switch (type->category_match) {
+	case ACO_WHITELIST:
+	case ACO_BLACKLIST:
+		if (regcomp(&regex, type->category, REG_EXTENDED | REG_NOSUB)) {
+			return 0;
+		}
+		match = !regexec(&regex, cat->name, 0, NULL, 0);
+		regfree(&regex);
+		if (type->category_match == ACO_BLACKLIST) {
+			match = !match;
+		}
+		break;
+	case ACO_WHITELIST_EXACT:
+		match = !strcasecmp(type->category, cat->name);
+		break;
+	case ACO_BLACKLIST_EXACT:
+		match = strcasecmp(type->category, cat->name);
+		break;
+	default:
+		return 0;
+	}
+
+	if (!match || !type->matchfield) {
+		return match;
+	}
+
+	for (var = cat->vars; var; var = var->next) {
+		if (!strcasecmp(var->name, type->matchfield)) {
+			return !strcasecmp(var->value, type->matchvalue);
+		}
+	}
+
+	return 0;
+}
+
+static int category_apply(struct aco_info *info, struct bench_category *cat,
+	void *snapshot)
+{
+	struct aco_type *type = NULL;
+	struct aco_option *opt;
+	struct ast_variable *var;
+	struct ao2_container *container = NULL;
+	void *obj;
+	size_t i;
+	size_t j;
+	int res = -1;
+
+	for (i = 0; !type && info->files[i]; ++i) {
+		for (j = 0; info->files[i]->types[j]; ++j) {
+			if (category_matches(info->files[i]->types[j], cat)) {
+				type = info->files[i]->types[j];
+				break;
+			}
+		}
+	}
+	if (!type) {
+		ast_log(LOG_ERROR, "Could not find config type for category '%s'\n",
+			cat->name);
+		return -1;
+	}
+
+	if (type->type == ACO_GLOBAL) {
+		obj = *(void **) ((char *) snapshot + type->item_offset);
+		if (!obj) {
+			return -1;
+		}
+		ao2_ref(obj, +1);
+	} else {
+		container = *(struct ao2_container **) ((char *) snapshot + type->item_offset);
+		obj = type->item_find(container, cat->name);
+		if (obj) {
+			ast_log(LOG_ERROR, "Duplicate category '%s'\n", cat->name);
+			ao2_ref(obj, -1);
+			return -1;
+		}
+		obj = type->item_alloc(cat->name);
+		if (!obj || aco_set_defaults(type, cat->name, obj)) {
+			ao2_cleanup(obj);
+			return -1;
+		}
+	}
+
+	for (var = cat->vars; var; var = var->next) {
+		opt = aco_option_find(type, var->name);
+		if (!opt) {
+			ast_log(LOG_ERROR, "Could not find option suitable for category "
+				"'%s' named '%s' at line %d\n", cat->name, var->name, var->lineno);
+			goto done;
+		}
+		if (aco_option_apply(opt, var, obj)) {
+			ast_log(LOG_ERROR, "Error parsing %s=%s at line %d\n",
+				var->name, var->value, var->lineno);
+			goto done;
+		}
+	}
+
+	if (container) {
+		if (type->item_pre_process && type->item_pre_process(obj)) {
+			goto done;
+		}
+		if (type->item_prelink && type->item_prelink(obj)) {
+			goto done;
+		}
+		if (!ao2_link(container, obj)) {
+			goto done;
+		}
+	}
+	res = 0;
+
+done:
+	ao2_ref(obj, -1);
+	return res;
+}
+
+enum aco_process_status aco_process_config(struct aco_info *info, int reload)
+{
+	struct bench_category *categories;
+	struct bench_category *cat;
+	void *snapshot;
+	enum aco_process_status res = ACO_PROCESS_ERROR;
+
+	if (!config_filename) {
+		ast_log(LOG_ERROR, "No configuration file set\n");
+		return ACO_PROCESS_ERROR;
+	}
+
+	categories = categories_load(config_filename);
+	if (!categories) {
+		return ACO_PROCESS_ERROR;
+	}
+
+	snapshot = info->snapshot_alloc();
+	if (!snapshot) {
+		categories_destroy(categories);
+		return ACO_PROCESS_ERROR;
+	}
+
+	for (cat = categories; cat; cat = cat->next) {
+		if (category_apply(info, cat, snapshot)) {
+			goto done;
+		}
+	}
+
+	info->internal->pending = snapshot;
+	if (info->pre_apply_config && info->pre_apply_config()) {
+		goto done;
+	}
+	__ao2_global_obj_replace_unref(info->global_obj, snapshot);
+	if (info->post_apply_config) {
+		info->post_apply_config();
+	}
+	res = ACO_PROCESS_OK;
+
+done:
+	info->internal->pending = NULL;
+	ao2_ref(snapshot, -1);
+	categories_destroy(categories);
+
+	return res;
+}
+
+/* JSON */
+
+void ast_json_free(void *p)
+{
+	free(p);
+}
+
+struct ast_json *ast_json_ref(struct ast_json *json)
+{
+	json_incref((json_t *) json);
+	return json;
+}
+
+void ast_json_unref(struct ast_json *json)
+{
+	json_decref((json_t *) json);
+}
+
+struct ast_json *ast_json_null(void)
+{
+	return (struct ast_json *) json_null();
+}
+
+struct ast_json *ast_json_string_create(const char *value)
+{
+	return (struct ast_json *) json_string(value);
+}
+
+struct ast_json *ast_json_integer_create(ast_json_int_t value)
+{
+	return (struct ast_json *) json_integer(value);
+}
+
+int ast_json_object_set(struct ast_json *object, const char *key,
+	struct ast_json *value)
+{
+	return json_object_set_new((json_t *) object, key, (json_t *) value);
+}
+
+int ast_json_object_del(struct ast_json *object, const char *key)
+{
+	return json_object_del((json_t *) object, key);
+}
+
+struct ast_json *ast_json_pack(char const *format, ...)
+{
+	struct ast_json *ret;
+	va_list args;
+
+	va_start(args, format);
+	ret = (struct ast_json *) json_vpack_ex(NULL, 0, format, args);
+	va_end(args);
+
+	return ret;
+}
+
+struct ast_json *ast_json_load_string(const char *input,
+	struct ast_json_error *error)
+{
+	return (struct ast_json *) json_loads(input, 0, NULL);
+}
+
+char *ast_json_dump_string_format(struct ast_json *root,
+	enum ast_json_encoding_format format)
+{
+	size_t flags = JSON_ENCODE_ANY;
+
+	if (format == AST_JSON_PRETTY) {
+		flags |= JSON_INDENT(2);
+	} else {
+		flags |= JSON_COMPACT;
+	}
+	if (format == AST_JSON_SORTED) {
+		flags |= JSON_SORT_KEYS;
+	}
+
+	return json_dumps((json_t *) root, flags);
+}
+
+struct ast_json *ast_json_timeval(const struct timeval tv, const char *zone)
+{
+	char buf[64];
+	struct ast_tm tm = {};
+
+	ast_localtime(&tv, &tm, zone);
+	ast_strftime(buf, sizeof(buf), "%FT%T.%q%z", &tm);
+
+	return ast_json_string_create(buf);
+}
+
+/* CEL */
+
+static const char * const cel_event_types[] = {
+	[AST_CEL_ALL] = "ALL",
+	[AST_CEL_CHANNEL_START] = "CHAN_START",
+	[AST_CEL_CHANNEL_END] = "CHAN_END",
+	[AST_CEL_ANSWER] = "ANSWER",
+	[AST_CEL_HANGUP] = "HANGUP",
+	[AST_CEL_APP_START] = "APP_START",
+	[AST_CEL_APP_END] = "APP_END",
+	[AST_CEL_PARK_START] = "PARK_START",
+	[AST_CEL_PARK_END] = "PARK_END",
+	[AST_CEL_USER_DEFINED] = "USER_DEFINED",
+	[AST_CEL_BRIDGE_ENTER] = "BRIDGE_ENTER",
+	[AST_CEL_BRIDGE_EXIT] = "BRIDGE_EXIT",
+	[AST_CEL_BLINDTRANSFER] = "BLINDTRANSFER",
+	[AST_CEL_ATTENDEDTRANSFER] = "ATTENDEDTRANSFER",
+	[AST_CEL_PICKUP] = "PICKUP",
+	[AST_CEL_FORWARD] = "FORWARD",
+	[AST_CEL_LINKEDID_END] = "LINKEDID_END",
+	[AST_CEL_LOCAL_OPTIMIZE] = "LOCAL_OPTIMIZE",
+	[AST_CEL_LOCAL_OPTIMIZE_BEGIN] = "LOCAL_OPTIMIZE_BEGIN",
+};
+
+const char *ast_cel_get_type_name(enum ast_cel_event_type type)
+{
+	if (type < 0 || (size_t) type >= ARRAY_LEN(cel_event_types)
+		|| !cel_event_types[type]) {
+		return "Unknown";
+	}
+	return cel_event_types[type];
+}
+
+enum ast_cel_event_type ast_cel_str_to_event_type(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_LEN(cel_event_types); ++i) {
+		if (cel_event_types[i] && !strcasecmp(name, cel_event_types[i])) {
+			return i;
+		}
+	}
+
+	return AST_CEL_INVALID_VALUE;
+}
+
+static ast_cel_backend_cb cel_backend;
+
+int ast_cel_backend_register(const char *name, ast_cel_backend_cb backend_callback)
+{
+	if (cel_backend) {
+		return -1;
+	}
+	cel_backend = backend_callback;
+	return 0;
+}
+
+int ast_cel_backend_unregister(const char *name)
+{
+	cel_backend = NULL;
+	return 0;
+}
+
+void bench_cel_event(const struct ast_cel_event_record *record)
+{
+	if (cel_backend) {
+		cel_backend((struct ast_event *) record);
+	}
+}
+
+int ast_cel_fill_record(const struct ast_event *e, struct ast_cel_event_record *r)
+{
+	const struct ast_cel_event_record *event = (const void *) e;
+
+	if (r->version != AST_CEL_EVENT_RECORD_VERSION) {
+		ast_log(LOG_ERROR, "Module ABI mismatch for ast_cel_event_record.  "
+			"Got '%u', expected '%u'\n", r->version, AST_CEL_EVENT_RECORD_VERSION);
+		return -1;
+	}
+
+	*r = *event;
+	r->version = AST_CEL_EVENT_RECORD_VERSION;
+	r->event_name = ast_cel_get_type_name(r->event_type);
+	if (r->event_type != AST_CEL_USER_DEFINED) {
+		r->user_defined_name = "";
+	}
+	r->user_defined_name = S_OR(r->user_defined_name, "");
+	r->caller_id_name = S_OR(r->caller_id_name, "");
+	r->caller_id_num = S_OR(r->caller_id_num, "");
+	r->caller_id_ani = S_OR(r->caller_id_ani, "");
+	r->caller_id_rdnis = S_OR(r->caller_id_rdnis, "");
+	r->caller_id_dnid = S_OR(r->caller_id_dnid, "");
+	r->extension = S_OR(r->extension, "");
+	r->context = S_OR(r->context, "");
+	r->channel_name = S_OR(r->channel_name, "");
+	r->application_name = S_OR(r->application_name, "");
+	r->application_data = S_OR(r->application_data, "");
+	r->account_code = S_OR(r->account_code, "");
+	r->peer_account = S_OR(r->peer_account, "");
+	r->unique_id = S_OR(r->unique_id, "");
+	r->linked_id = S_OR(r->linked_id, "");
+	r->user_field = S_OR(r->user_field, "");
+	r->peer = S_OR(r->peer, "");
+	r->extra = S_OR(r->extra, "");
+
+	return 0;
+}
+
+const char *ast_channel_amaflags2string(enum ama_flags flag)
+{
+	switch (flag) {
+	case AST_AMA_OMIT:
+		return "OMIT";
+	case AST_AMA_BILLING:
+		return "BILLING";
+	case AST_AMA_DOCUMENTATION:
+		return "DOCUMENTATION";
+	default:
+		return "Unknown";
+	}
+}
+
+/* CLI */
+
+static struct ast_cli_entry *cli_entries[16];
+
+void ast_cli(int fd, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vdprintf(fd, fmt, ap);
+	va_end(ap);
+}
+
+int ast_cli_register_multiple(struct ast_cli_entry *e, int len)
+{
+	size_t slot = 0;
+	int i;
+
+	for (i = 0; i < len; ++i) {
+		while (slot < ARRAY_LEN(cli_entries) && cli_entries[slot]) {
+			++slot;
+		}
+		if (slot == ARRAY_LEN(cli_entries)) {
+			return -1;
+		}
+		e[i].handler(&e[i], CLI_INIT, NULL);
+		cli_entries[slot] = &e[i];
+	}
+
+	return 0;
+}
+
+int ast_cli_unregister_multiple(struct ast_cli_entry *e, int len)
+{
+	size_t slot;
+	int i;
+
+	for (i = 0; i < len; ++i) {
+		for (slot = 0; slot < ARRAY_LEN(cli_entries); ++slot) {
+			if (cli_entries[slot] == &e[i]) {
+				cli_entries[slot] = NULL;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int bench_cli_command(int fd, const char *command)
+{
+	const char *argv[AST_MAX_CMD_LEN + 1];
+	char *words = ast_strdupa(command);
+	char *word;
+	size_t slot;
+	int argc = 0;
+
+	while ((word = strsep(&words, " ")) && argc < AST_MAX_CMD_LEN) {
+		if (*word) {
+			argv[argc++] = word;
+		}
+	}
+	argv[argc] = NULL;
+
+	for (slot = 0; slot < ARRAY_LEN(cli_entries); ++slot) {
+		struct ast_cli_entry *e = cli_entries[slot];
+
+		if (e && e->command && !strcmp(e->command, command)) {
+			struct ast_cli_args a = {
+				.fd = fd,
+				.argc = argc,
+				.argv = argv,
+				.line = command,
+			};
+
+			e->handler(e, CLI_HANDLER, &a);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Modules */
+
+static const struct ast_module_info *module_info;
+
+void ast_module_register(const struct ast_module_info *info)
+{
+	module_info = info;
+}
+
+const struct ast_module_info *bench_module(void)
+{
+	return module_info;
+}
+
+/* res_amqp */
+
+struct ast_amqp_connection {
+	unsigned long messages;
+	unsigned long bytes;
+	char name[0];
+};
+
+AO2_STRING_FIELD_HASH_FN(ast_amqp_connection, name);
+AO2_STRING_FIELD_CMP_FN(ast_amqp_connection, name);
+
+static struct ao2_container *amqp_connections;
+static pthread_once_t amqp_connections_once = PTHREAD_ONCE_INIT;
+
+static void amqp_connections_init(void)
+{
+	amqp_connections = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, 7,
+		ast_amqp_connection_hash_fn, NULL, ast_amqp_connection_cmp_fn);
+}
+
+static struct ast_amqp_connection *amqp_connection_find(const char *name)
+{
+	pthread_once(&amqp_connections_once, amqp_connections_init);
+	if (!amqp_connections) {
+		return NULL;
+	}
+	return ao2_find(amqp_connections, name, OBJ_SEARCH_KEY);
+}
+
+struct ast_amqp_connection *ast_amqp_get_connection(const char *name)
+{
+	struct ast_amqp_connection *cxn;
+
+	cxn = amqp_connection_find(name);
+	if (cxn || !amqp_connections) {
+		return cxn;
+	}
+
+	ao2_lock(amqp_connections);
+	cxn = ao2_find(amqp_connections, name, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!cxn) {
+		cxn = ao2_alloc_options(sizeof(*cxn) + strlen(name) + 1, NULL,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (cxn) {
+			strcpy(cxn->name, name);
+			ao2_link_flags(amqp_connections, cxn, OBJ_NOLOCK);
+		}
+	}
+	ao2_unlock(amqp_connections);
+
+	return cxn;
+}
+
+int ast_amqp_basic_publish(struct ast_amqp_connection *cxn,
+	amqp_bytes_t exchange, amqp_bytes_t routing_key, amqp_boolean_t mandatory,
+	amqp_boolean_t immediate, const amqp_basic_properties_t *properties,
+	amqp_bytes_t body)
+{
+	__atomic_add_fetch(&cxn->bytes, body.len, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&cxn->messages, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+unsigned long bench_amqp_published(const char *name, unsigned long *bytes)
+{
+	struct ast_amqp_connection *cxn = amqp_connection_find(name);
+	unsigned long messages = 0;
+
+	if (bytes) {
+		*bytes = 0;
+	}
+	if (cxn) {
+		messages = __atomic_load_n(&cxn->messages, __ATOMIC_ACQUIRE);
+		if (bytes) {
+			*bytes = __atomic_load_n(&cxn->bytes, __ATOMIC_RELAXED);
+		}
+		ao2_ref(cxn, -1);
+	}
+
+	return messages;
+}
@@ -52,6 +52,530 @@
 						<para>Defaults to empty string</para>
 					</description>
 				</configOption>
+				<configOption name="time_format">
+					<synopsis>Format of the event_time field</synopsis>
+					<description>
+						<enumlist>
+							<enum name="iso8601"><para>ISO 8601 string in local time with
+							millisecond precision, for example
+							<literal>2017-03-01T12:34:56.789-0500</literal></para></enum>
+							<enum name="epoch_us"><para>Integer number of microseconds
+							since the Unix epoch</para></enum>
+						</enumlist>
+						<para>Defaults to iso8601</para>
+					</description>
+				</configOption>
+				<configOption name="format">
+					<synopsis>Message body format</synopsis>
+					<description>
+						<enumlist>
+							<enum name="json"><para>One JSON object per event.</para></enum>
+							<enum name="arrow"><para>One Apache Arrow IPC stream per
+							batch of events, with content type
+							<literal>application/vnd.apache.arrow.stream</literal>.
+							Each stream holds the schema, the dictionaries, one record
+							batch and the end of stream marker, so it can be read on
+							its own. The columns are the fields of the JSON format,
+							with caller_id flattened into caller_id_num,
+							caller_id_name, caller_id_ani, caller_id_rdnis and
+							caller_id_dnid; event_time is a UTC timestamp in
+							microseconds. event_name, account_code and context are
+							dictionary encoded. Per event options (headers, partition,
+							sequence, delta, message_id and timestamp) do not apply.
+							Raise <literal>min_batch_size</literal> and
+							<literal>max_linger</literal> for larger batches.</para></enum>
+						</enumlist>
+						<para>Defaults to json</para>
+					</description>
+				</configOption>
+				<configOption name="sink">
+					<synopsis>Where events go</synopsis>
+					<description>
+						<enumlist>
+							<enum name="amqp"><para>Publish to the AMQP
+							<literal>connection</literal>.</para></enum>
+							<enum name="file:/path"><para>Append one JSON object per
+							line to a local file, from a writer thread of its own.
+							The file is rotated by renaming it with the date and time,
+							down to the microsecond, appended, never over an earlier
+							rotated file; see <literal>file_max_size</literal> and
+							<literal>file_rotate_interval</literal>. Where the kernel
+							allows it, batches are staged in registered buffers and
+							written through io_uring without waiting for the disk;
+							otherwise with pwritev. Only the json format can be
+							written to a file.</para></enum>
+							<enum name="shm:/dev/shm/name"><para>Copy each event into a
+							lock-free ring in a memory mapped file, for a co-located
+							process to read in place and deliver itself. The layout is
+							described in the README. Events the consumer has no room
+							for are dropped, never waited for. Only the json format can
+							be written to a ring.</para></enum>
+							<enum name="unix:/path"><para>Write one JSON object per line
+							to a unix stream socket.</para></enum>
+							<enum name="unixgram:/path"><para>Send one JSON object per
+							datagram to a unix datagram socket, a batch per
+							<literal>sendmmsg</literal> call.</para></enum>
+						</enumlist>
+						<para>Sockets are connected on first use, and reconnected
+						after a failure with a backoff of up to 32 seconds; events are
+						dropped while disconnected.</para>
+						<para>Destinations naming the same local sink share it.</para>
+						<para>Defaults to amqp</para>
+					</description>
+				</configOption>
+				<configOption name="sink_queue_size">
+					<synopsis>Maximum number of events waiting for a local sink</synopsis>
+					<description>
+						<para>Events arriving while the queue is full are dropped.</para>
+						<para>Defaults to 10000</para>
+					</description>
+				</configOption>
+				<configOption name="file_max_size">
+					<synopsis>Rotate the file when it reaches this size, in MB</synopsis>
+					<description>
+						<para>0 disables rotation by size.</para>
+						<para>Defaults to 100</para>
+					</description>
+				</configOption>
+				<configOption name="file_rotate_interval">
+					<synopsis>Rotate the file when it is this old, in seconds</synopsis>
+					<description>
+						<para>0 disables rotation by age.</para>
+						<para>Defaults to 3600</para>
+					</description>
+				</configOption>
+				<configOption name="file_fsync_interval">
+					<synopsis>Maximum time written events may wait for fsync, in ms</synopsis>
+					<description>
+						<para>Writes are group committed: whatever was written during
+						the interval is synced at once. 0 syncs after every write.</para>
+						<para>Defaults to 1000</para>
+					</description>
+				</configOption>
+				<configOption name="sample_rate">
+					<synopsis>Fraction of calls published, from 0 to 1</synopsis>
+					<description>
+						<para>Whether a call is published is decided by a hash of
+						its linked_id, so either all or none of a call's events are
+						published. The decision is made before the event is
+						serialized. The same hash is used for every destination,
+						so the calls kept at a lower rate are a subset of those
+						kept at a higher one.</para>
+						<para>Defaults to 1.0</para>
+					</description>
+				</configOption>
+				<configOption name="shm_size">
+					<synopsis>Capacity of a shared memory ring, in MB</synopsis>
+					<description>
+						<para>Rounded up to a power of two. Takes effect when the
+						ring is created; an existing file of another size is
+						replaced.</para>
+						<para>Defaults to 16</para>
+					</description>
+				</configOption>
+				<configOption name="headers">
+					<synopsis>CEL fields copied into the AMQP message headers</synopsis>
+					<description>
+						<para>Comma separated list of fields, from
+						<literal>event_name</literal>, <literal>account_code</literal>,
+						<literal>context</literal>, <literal>extension</literal>,
+						<literal>channel</literal>, <literal>application</literal>,
+						<literal>unique_id</literal>, <literal>linked_id</literal>,
+						<literal>peer</literal> and <literal>peer_account</literal>.
+						This lets a headers exchange route events, and consumers filter
+						them, without parsing the body.</para>
+						<para>Defaults to empty string</para>
+					</description>
+				</configOption>
+				<configOption name="partition">
+					<synopsis>Where to put the linked_id as a partition key</synopsis>
+					<description>
+						<para>For consistent hash exchanges, which spread messages over
+						several queues by hashing the routing key or a header while
+						keeping each call's events together, in order.</para>
+						<enumlist>
+							<enum name="none"><para>No partition key; the routing key is
+							<literal>queue</literal>.</para></enum>
+							<enum name="routing_key"><para>The routing key is the
+							event's linked_id.</para></enum>
+							<enum name="header"><para>The routing key is
+							<literal>queue</literal>, and the linked_id is set in the
+							<literal>partition_header</literal> header.</para></enum>
+						</enumlist>
+						<para>Defaults to none</para>
+					</description>
+				</configOption>
+				<configOption name="partition_header">
+					<synopsis>Header holding the partition key</synopsis>
+					<description>
+						<para>Defaults to partition_key</para>
+					</description>
+				</configOption>
+				<configOption name="publish_time_header">
+					<synopsis>Header to set to the publish time</synopsis>
+					<description>
+						<para>When set, each message gets this header with the time
+						it was handed to the broker, in microseconds since the
+						epoch, for consumers to measure the pipeline lag. Arrow
+						messages get it once per batch. See also
+						<literal>cel amqp show lag</literal>.</para>
+						<para>Defaults to empty string, for no header</para>
+					</description>
+				</configOption>
+				<configOption name="sequence">
+					<synopsis>Number events, per call and overall</synopsis>
+					<description>
+						<para>Set the <literal>call_sequence</literal> header to a
+						number counting up from 1 with each event of the call (the
+						linked_id), and the <literal>sequence</literal> header to a
+						number counting up with every event since the module was
+						loaded. Consumers may use them to put events back in order
+						and to detect lost ones.</para>
+						<para>The numbers are shared by all destinations, so with
+						the json format none of them may leave events out: their
+						<literal>events</literal> must be all of them, they may not
+						be named in <literal>[tenants]</literal>, sampled, or shed
+						by a rate limit.</para>
+						<para>Calls are forgotten on LINKEDID_END, which must be
+						enabled in <filename>cel.conf</filename>. At most 65536 calls
+						are tracked at once; events of calls beyond that get a
+						<literal>call_sequence</literal> of 0.</para>
+						<para>Defaults to no</para>
+					</description>
+				</configOption>
+				<configOption name="delta">
+					<synopsis>Only publish the fields of an event that changed</synopsis>
+					<description>
+						<para>Events of a channel (the unique_id) repeat most fields.
+						With delta encoding, a channel's first event, and every
+						<literal>delta_keyframe_interval</literal> events after that,
+						is published in full as a keyframe. Other events leave out
+						the fields that are the same as in the channel's last
+						keyframe. event_name, event_time, unique_id and extra are
+						always published.</para>
+						<para>Every event of the channel gets a
+						<literal>frame</literal> number, counting up from 1, and
+						deltas also get the <literal>keyframe</literal> number they
+						are relative to. Since deltas only depend on their keyframe,
+						they may be applied in any order.</para>
+						<para>Keyframes are shared by all destinations, so the same
+						restrictions as for <literal>sequence</literal> apply.</para>
+						<para>A reload that changes <literal>delta</literal> or the
+						<literal>delta_*</literal> options forgets the cached
+						keyframes, so every channel starts again with a keyframe
+						numbered 1.</para>
+						<para>Defaults to no</para>
+					</description>
+				</configOption>
+				<configOption name="delta_keyframe_interval">
+					<synopsis>Events between keyframes of a channel</synopsis>
+					<description>
+						<para>0 only sends keyframes when a channel starts, or when it
+						is not cached.</para>
+						<para>Defaults to 16</para>
+					</description>
+				</configOption>
+				<configOption name="delta_channels">
+					<synopsis>Most channels cached for delta encoding</synopsis>
+					<description>
+						<para>When the cache is full, the channels without an event
+						since the last time it was, at most once a second, make room.
+						Events of channels that still do not fit are published in
+						full, with a <literal>frame</literal> of 0.</para>
+						<para>Defaults to 10000</para>
+					</description>
+				</configOption>
+				<configOption name="message_id">
+					<synopsis>Set a deterministic message_id property</synopsis>
+					<description>
+						<para>When enabled, the AMQP <literal>message_id</literal>
+						property is set to a 64 bit hash, in hex, of the unique_id,
+						event type and event time. A retried or replayed event gets
+						the same message_id, so consumers can deduplicate with a
+						single property lookup.</para>
+						<para>Defaults to no</para>
+					</description>
+				</configOption>
+				<configOption name="timestamp">
+					<synopsis>Set the timestamp property to the event time</synopsis>
+					<description>
+						<para>Defaults to no</para>
+					</description>
+				</configOption>
+				<configOption name="critical_events">
+					<synopsis>CEL event types published with critical priority</synopsis>
+					<description>
+						<para>Comma separated list of CEL event names (for example
+						<literal>CHAN_START,HANGUP,LINKEDID_END</literal>) that are
+						always published before any other queued event and are the
+						last to be shed under overload.</para>
+						<para>Defaults to <literal>CHAN_START,HANGUP,LINKEDID_END</literal></para>
+					</description>
+				</configOption>
+				<configOption name="low_priority_events">
+					<synopsis>CEL event types published with low priority</synopsis>
+					<description>
+						<para>Comma separated list of CEL event names that are only
+						published when no critical or normal event is waiting, and
+						that are shed first under overload.</para>
+						<para>Defaults to empty string</para>
+					</description>
+				</configOption>
+				<configOption name="critical_queue_size">
+					<synopsis>Maximum number of critical events queued per destination</synopsis>
+					<description>
+						<para>Defaults to 10000</para>
+					</description>
+				</configOption>
+				<configOption name="normal_queue_size">
+					<synopsis>Maximum number of normal events queued per destination</synopsis>
+					<description>
+						<para>Defaults to 5000</para>
+					</description>
+				</configOption>
+				<configOption name="low_queue_size">
+					<synopsis>Maximum number of low priority events queued per destination</synopsis>
+					<description>
+						<para>Defaults to 1000</para>
+					</description>
+				</configOption>
+				<configOption name="min_batch_size">
+					<synopsis>Smallest number of events published per batch</synopsis>
+					<description>
+						<para>The publisher adapts its batch size between
+						<literal>min_batch_size</literal> and
+						<literal>max_batch_size</literal> from the observed event
+						rate and broker round-trip time.</para>
+						<para>Defaults to 1</para>
+					</description>
+				</configOption>
+				<configOption name="max_batch_size">
+					<synopsis>Largest number of events published per batch</synopsis>
+					<description>
+						<para>Defaults to 256</para>
+					</description>
+				</configOption>
+				<configOption name="max_linger">
+					<synopsis>Longest time, in milliseconds, to wait for a batch to fill</synopsis>
+					<description>
+						<para>The publisher only lingers when the current event rate
+						is high enough to fill a batch within
+						<literal>max_added_latency</literal>; at low rates events are
+						published immediately.</para>
+						<para>Defaults to 20</para>
+					</description>
+				</configOption>
+				<configOption name="max_added_latency">
+					<synopsis>Latency budget, in milliseconds, for batching</synopsis>
+					<description>
+						<para>When lingering plus publishing a batch takes longer than
+						this, the batch size and linger time are halved.</para>
+						<para>Defaults to 50</para>
+					</description>
+				</configOption>
+				<configOption name="blocked_threshold">
+					<synopsis>Time, in milliseconds, without publish progress before the connection is considered blocked</synopsis>
+					<description>
+						<para>A broker under a resource alarm stops reading from the
+						connection, which stalls the publisher. When no publish has
+						completed for this long while one is in progress, the
+						connection is reported as blocked until publishing resumes.</para>
+						<para>Defaults to 1000</para>
+					</description>
+				</configOption>
+				<configOption name="blocked_buffer_size">
+					<synopsis>Extra events buffered while the connection is blocked</synopsis>
+					<description>
+						<para>While blocked, events that do not fit in their priority
+						queue are still accepted, up to this many per destination, and
+						are published as soon as the connection is unblocked.</para>
+						<para>Defaults to 50000</para>
+					</description>
+				</configOption>
+				<configOption name="connect_backoff_min">
+					<synopsis>Initial delay, in milliseconds, between connection attempts</synopsis>
+					<description>
+						<para>The broker connection is established in the background;
+						events are queued until it is up. After each failed attempt
+						the delay doubles, up to <literal>connect_backoff_max</literal>,
+						with random jitter.</para>
+						<para>Defaults to 500</para>
+					</description>
+				</configOption>
+				<configOption name="connect_backoff_max">
+					<synopsis>Maximum delay, in milliseconds, between connection attempts</synopsis>
+					<description>
+						<para>Defaults to 30000</para>
+					</description>
+				</configOption>
+				<configOption name="breaker_threshold">
+					<synopsis>Consecutive failed or slow publishes that open the circuit breaker</synopsis>
+					<description>
+						<para>Each destination has a breaker of its own. While it is
+						open nothing is published to the destination and its events
+						stay queued; the other destinations are not held up. After
+						<literal>breaker_reset_timeout</literal> a single event is
+						published as a probe; if it succeeds the breaker closes,
+						otherwise it opens again. A failed publish is kept queued
+						and retried instead of being dropped.</para>
+						<para>Defaults to 5. 0 disables the breaker, and events that
+						fail to publish are dropped.</para>
+					</description>
+				</configOption>
+				<configOption name="breaker_slow_threshold">
+					<synopsis>Time, in milliseconds, after which a publish counts as slow</synopsis>
+					<description>
+						<para>Defaults to 1000</para>
+					</description>
+				</configOption>
+				<configOption name="breaker_reset_timeout">
+					<synopsis>Time, in milliseconds, the breaker stays open before probing</synopsis>
+					<description>
+						<para>Defaults to 5000</para>
+					</description>
+				</configOption>
+				<configOption name="rate_limit">
+					<synopsis>Maximum number of events per second published overall</synopsis>
+					<description>
+						<para>Defaults to 0, which disables the global limit</para>
+					</description>
+				</configOption>
+				<configOption name="rate_burst">
+					<synopsis>Number of events allowed above rate_limit in a burst</synopsis>
+					<description>
+						<para>Defaults to 0</para>
+					</description>
+				</configOption>
+				<configOption name="rate_limit_policy">
+					<synopsis>What to do with events above the global rate limit</synopsis>
+					<description>
+						<enumlist>
+							<enum name="buffer"><para>Keep the events queued and publish
+							them as the limit allows.</para></enum>
+							<enum name="shed"><para>Drop the events before they are
+							serialized.</para></enum>
+						</enumlist>
+						<para>Defaults to buffer</para>
+					</description>
+				</configOption>
+			</configObject>
+			<configObject name="ratelimit">
+				<synopsis>Rate limit for a single destination</synopsis>
+				<description>
+					<para>Limits the events published to one exchange and routing
+					key, in addition to the global <literal>rate_limit</literal>.</para>
+				</description>
+				<configOption name="type">
+					<synopsis>Must be <literal>ratelimit</literal></synopsis>
+				</configOption>
+				<configOption name="exchange">
+					<synopsis>Exchange the limit applies to</synopsis>
+				</configOption>
+				<configOption name="routing_key">
+					<synopsis>Routing key the limit applies to</synopsis>
+				</configOption>
+				<configOption name="rate">
+					<synopsis>Maximum number of events per second</synopsis>
+				</configOption>
+				<configOption name="burst">
+					<synopsis>Number of events allowed above rate in a burst</synopsis>
+				</configOption>
+				<configOption name="policy">
+					<synopsis>What to do with events above the limit</synopsis>
+					<description>
+						<para>Either <literal>buffer</literal> or
+						<literal>shed</literal>, see <literal>rate_limit_policy</literal>.
+						Defaults to buffer</para>
+					</description>
+				</configOption>
+			</configObject>
+			<configObject name="profile">
+				<synopsis>An additional destination</synopsis>
+				<description>
+					<para>Events are published to <literal>[global]</literal>, if
+					it has a <literal>connection</literal>, and to every profile
+					whose <literal>events</literal> they match. The record is
+					extracted once, and all the destinations sharing a format share
+					one serialized body. Per event options (headers, partition,
+					sequence, delta, message_id, timestamp, priorities and rate
+					limits) are taken from <literal>[global]</literal>. At most 16
+					destinations may be configured.</para>
+				</description>
+				<configOption name="type">
+					<synopsis>Must be <literal>profile</literal></synopsis>
+				</configOption>
+				<configOption name="connection">
+					<synopsis>Name of the connection from amqp.conf to use</synopsis>
+					<description>
+						<para>Required, unless <literal>sink</literal> is a local
+						sink.</para>
+					</description>
+				</configOption>
+				<configOption name="queue">
+					<synopsis>Name of the queue to post to</synopsis>
+					<description>
+						<para>Defaults to asterisk_cel</para>
+					</description>
+				</configOption>
+				<configOption name="exchange">
+					<synopsis>Name of the exchange to post to</synopsis>
+					<description>
+						<para>Defaults to empty string</para>
+					</description>
+				</configOption>
+				<configOption name="format">
+					<synopsis>Message body format</synopsis>
+					<description>
+						<para>See <literal>format</literal> in
+						<literal>[global]</literal>.</para>
+					</description>
+				</configOption>
+				<configOption name="sink">
+					<synopsis>Where events go</synopsis>
+					<description>
+						<para>See <literal>sink</literal> in
+						<literal>[global]</literal>; the <literal>sink_queue_size</literal>
+						<literal>shm_size</literal> and <literal>file_*</literal>
+						options apply per profile
+						likewise.</para>
+					</description>
+				</configOption>
+				<configOption name="sample_rate">
+					<synopsis>Fraction of calls published, from 0 to 1</synopsis>
+					<description>
+						<para>See <literal>sample_rate</literal> in
+						<literal>[global]</literal>.</para>
+					</description>
+				</configOption>
+				<configOption name="events">
+					<synopsis>Comma separated CEL event types to publish</synopsis>
+					<description>
+						<para>Defaults to all of them</para>
+					</description>
+				</configOption>
+			</configObject>
+			<configObject name="tenants">
+				<synopsis>Per tenant destinations</synopsis>
+				<description>
+					<para>Each line maps an account code, or with a
+					<literal>context:</literal> prefix the start of a context, to a
+					destination: <literal>[global]</literal> as
+					<literal>global</literal>, or a profile by name. A destination
+					named here only gets the events of its tenants, still filtered
+					by its <literal>events</literal>. The other destinations get
+					all events as usual.</para>
+					<para>An exact account code wins over a context prefix, and a
+					longer prefix over a shorter one. The mappings are compiled
+					into a hash table when the configuration is loaded.</para>
+					<example title="Tenants">
+[tenants]
+acme = acme_profile
+context:globex- = globex_profile
+					</example>
+				</description>
+				<configOption name="^.+$" regex="true">
+					<synopsis>Destination of an account code or context prefix</synopsis>
+				</configOption>
 			</configObject>
 		</configFile>
 	</configInfo>
@@ -59,17 +583,388 @@
 
 #include "asterisk.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
 #include "asterisk/stringfields.h"
 #include "asterisk/cel.h"
 #include "asterisk/channel.h"
+#include "asterisk/cli.h"
 #include "asterisk/config_options.h"
 #include "asterisk/json.h"
+#include "asterisk/linkedlists.h"
+#include "asterisk/localtime.h"
+#include "asterisk/lock.h"
 #include "asterisk/module.h"
+#include "asterisk/threadstorage.h"
 #include "asterisk/amqp.h"
 
 #define CEL_NAME "AMQP"
 #define CONF_FILENAME "cel_amqp.conf"
 
+/*!
+ * \brief USDT probes of the cel_amqp provider, for bpftrace, perf or
+ * SystemTap. Each is a nop until a tracer attaches to it.
+ *
+ * event__received: amqp_cel_log() was called
+ * record__filled: event type, linked_id, unique_id
+ * serialized: body length in bytes, number of events
+ * publish__start: destination, body length in bytes, number of events
+ * publish__end: destination, result (0 on success), number of events
+ * dropped: reason, number of events
+ */
+#ifdef HAVE_SYS_SDT_H
+#define CEL_AMQP_PROBE(name) DTRACE_PROBE(cel_amqp, name)
+#define CEL_AMQP_PROBE2(name, a, b) DTRACE_PROBE2(cel_amqp, name, a, b)
+#define CEL_AMQP_PROBE3(name, a, b, c) DTRACE_PROBE3(cel_amqp, name, a, b, c)
+#else
+#define CEL_AMQP_PROBE(name)
+#define CEL_AMQP_PROBE2(name, a, b)
+#define CEL_AMQP_PROBE3(name, a, b, c)
+#endif
+
+/*! \brief Upper bound on CEL event type values we classify */
+#define CEL_AMQP_MAX_EVENT_TYPES 64
+
+/*! \brief Priority classes, highest first */
+enum cel_amqp_priority {
+	CEL_AMQP_PRIORITY_CRITICAL = 0,
+	CEL_AMQP_PRIORITY_NORMAL,
+	CEL_AMQP_PRIORITY_LOW,
+	CEL_AMQP_PRIORITY_MAX,
+};
+
+static const char *priority_names[CEL_AMQP_PRIORITY_MAX] = {
+	[CEL_AMQP_PRIORITY_CRITICAL] = "critical",
+	[CEL_AMQP_PRIORITY_NORMAL] = "normal",
+	[CEL_AMQP_PRIORITY_LOW] = "low",
+};
+
+/*! \brief Indexes of header_fields */
+enum cel_amqp_header_field {
+	/* event_name must stay first; see header_value() */
+	CEL_AMQP_FIELD_EVENT_NAME = 0,
+	CEL_AMQP_FIELD_ACCOUNT_CODE,
+	CEL_AMQP_FIELD_CONTEXT,
+	CEL_AMQP_FIELD_EXTENSION,
+	CEL_AMQP_FIELD_CHANNEL,
+	CEL_AMQP_FIELD_APPLICATION,
+	CEL_AMQP_FIELD_UNIQUE_ID,
+	CEL_AMQP_FIELD_LINKED_ID,
+	CEL_AMQP_FIELD_PEER,
+	CEL_AMQP_FIELD_PEER_ACCOUNT,
+	CEL_AMQP_FIELD_MAX,
+};
+
+/*! \brief CEL record fields that can be copied into the AMQP headers */
+static const struct {
+	const char *name;
+	size_t offset;
+} header_fields[CEL_AMQP_FIELD_MAX] = {
+	[CEL_AMQP_FIELD_EVENT_NAME] = { "event_name", offsetof(struct ast_cel_event_record, event_name) },
+	[CEL_AMQP_FIELD_ACCOUNT_CODE] = { "account_code", offsetof(struct ast_cel_event_record, account_code) },
+	[CEL_AMQP_FIELD_CONTEXT] = { "context", offsetof(struct ast_cel_event_record, context) },
+	[CEL_AMQP_FIELD_EXTENSION] = { "extension", offsetof(struct ast_cel_event_record, extension) },
+	[CEL_AMQP_FIELD_CHANNEL] = { "channel", offsetof(struct ast_cel_event_record, channel_name) },
+	[CEL_AMQP_FIELD_APPLICATION] = { "application", offsetof(struct ast_cel_event_record, application_name) },
+	[CEL_AMQP_FIELD_UNIQUE_ID] = { "unique_id", offsetof(struct ast_cel_event_record, unique_id) },
+	[CEL_AMQP_FIELD_LINKED_ID] = { "linked_id", offsetof(struct ast_cel_event_record, linked_id) },
+	[CEL_AMQP_FIELD_PEER] = { "peer", offsetof(struct ast_cel_event_record, peer) },
+	[CEL_AMQP_FIELD_PEER_ACCOUNT] = { "peer_account", offsetof(struct ast_cel_event_record, peer_account) },
+};
+
+#define CEL_AMQP_MAX_HEADERS ARRAY_LEN(header_fields)
+
+/*! \brief Most calls tracked for call_sequence at once */
+#define CEL_AMQP_MAX_CALLS 65536
+
+/*! \brief AMQP headers added by the sequence option */
+#define CEL_AMQP_SEQUENCE_HEADERS 2
+
+/*!
+ * \brief Seed of the linked_id hash deciding which calls are sampled.
+ *
+ * Shared by all destinations, so the calls kept at a lower sample_rate
+ * are a subset of those kept at a higher one.
+ */
+#define CEL_AMQP_SAMPLE_SEED 0x63656c73616d706cULL
+
+/*! \brief Message body format */
+enum cel_amqp_format {
+	CEL_AMQP_FORMAT_JSON = 0,
+	CEL_AMQP_FORMAT_ARROW,
+};
+
+enum cel_amqp_arrow_type {
+	CEL_AMQP_ARROW_UTF8,
+	CEL_AMQP_ARROW_DICTIONARY,
+	CEL_AMQP_ARROW_TIMESTAMP,
+};
+
+/*! \brief Columns of the arrow format */
+static const struct {
+	const char *name;
+	size_t offset;
+	enum cel_amqp_arrow_type type;
+} arrow_columns[] = {
+	{ "event_name", offsetof(struct ast_cel_event_record, event_name), CEL_AMQP_ARROW_DICTIONARY },
+	{ "account_code", offsetof(struct ast_cel_event_record, account_code), CEL_AMQP_ARROW_DICTIONARY },
+	{ "caller_id_num", offsetof(struct ast_cel_event_record, caller_id_num), CEL_AMQP_ARROW_UTF8 },
+	{ "caller_id_name", offsetof(struct ast_cel_event_record, caller_id_name), CEL_AMQP_ARROW_UTF8 },
+	{ "caller_id_ani", offsetof(struct ast_cel_event_record, caller_id_ani), CEL_AMQP_ARROW_UTF8 },
+	{ "caller_id_rdnis", offsetof(struct ast_cel_event_record, caller_id_rdnis), CEL_AMQP_ARROW_UTF8 },
+	{ "caller_id_dnid", offsetof(struct ast_cel_event_record, caller_id_dnid), CEL_AMQP_ARROW_UTF8 },
+	{ "extension", offsetof(struct ast_cel_event_record, extension), CEL_AMQP_ARROW_UTF8 },
+	{ "context", offsetof(struct ast_cel_event_record, context), CEL_AMQP_ARROW_DICTIONARY },
+	{ "channel", offsetof(struct ast_cel_event_record, channel_name), CEL_AMQP_ARROW_UTF8 },
+	{ "application", offsetof(struct ast_cel_event_record, application_name), CEL_AMQP_ARROW_UTF8 },
+	{ "app_data", offsetof(struct ast_cel_event_record, application_data), CEL_AMQP_ARROW_UTF8 },
+	{ "event_time", offsetof(struct ast_cel_event_record, event_time), CEL_AMQP_ARROW_TIMESTAMP },
+	{ "amaflags", offsetof(struct ast_cel_event_record, amaflag), CEL_AMQP_ARROW_UTF8 },
+	{ "unique_id", offsetof(struct ast_cel_event_record, unique_id), CEL_AMQP_ARROW_UTF8 },
+	{ "linked_id", offsetof(struct ast_cel_event_record, linked_id), CEL_AMQP_ARROW_UTF8 },
+	{ "user_field", offsetof(struct ast_cel_event_record, user_field), CEL_AMQP_ARROW_UTF8 },
+	{ "peer", offsetof(struct ast_cel_event_record, peer), CEL_AMQP_ARROW_UTF8 },
+	{ "peer_account", offsetof(struct ast_cel_event_record, peer_account), CEL_AMQP_ARROW_UTF8 },
+	{ "extra", offsetof(struct ast_cel_event_record, extra), CEL_AMQP_ARROW_UTF8 },
+};
+
+#define CEL_AMQP_ARROW_COLUMNS ARRAY_LEN(arrow_columns)
+
+/*! \brief An event, as kept for the arrow format until its batch is encoded */
+struct cel_amqp_row {
+	/*! \brief event time, in microseconds since the epoch */
+	int64_t event_time;
+	/*! \brief where each column's value starts in data; the last one ends it */
+	uint32_t offsets[CEL_AMQP_ARROW_COLUMNS + 1];
+	char data[0];
+};
+
+/*! \brief Where the partition key goes */
+enum cel_amqp_partition {
+	CEL_AMQP_PARTITION_NONE = 0,
+	CEL_AMQP_PARTITION_ROUTING_KEY,
+	CEL_AMQP_PARTITION_HEADER,
+};
+
+/*! \brief Formats of the event_time field */
+enum cel_amqp_time_format {
+	CEL_AMQP_TIME_ISO8601 = 0,
+	CEL_AMQP_TIME_EPOCH_US,
+};
+
+/*! \brief Circuit breaker states */
+enum cel_amqp_breaker {
+	/*! \brief publishing normally */
+	CEL_AMQP_BREAKER_CLOSED = 0,
+	/*! \brief not publishing, events stay queued */
+	CEL_AMQP_BREAKER_OPEN,
+	/*! \brief publishing a single probe */
+	CEL_AMQP_BREAKER_HALF_OPEN,
+};
+
+static const char *breaker_names[] = {
+	[CEL_AMQP_BREAKER_CLOSED] = "closed",
+	[CEL_AMQP_BREAKER_OPEN] = "open",
+	[CEL_AMQP_BREAKER_HALF_OPEN] = "half-open",
+};
+
+/*! \brief What to do with events above a rate limit */
+enum cel_amqp_rate_policy {
+	/*! \brief keep them queued, the publisher paces itself */
+	CEL_AMQP_RATE_BUFFER = 0,
+	/*! \brief drop them on the CEL thread */
+	CEL_AMQP_RATE_SHED,
+};
+
+/*!
+ * \brief Token bucket rate limiter.
+ *
+ * Implemented as the equivalent generic cell rate algorithm, so that the
+ * whole state is a single word that can be updated with compare-and-swap
+ * from any thread without a lock.
+ */
+struct cel_amqp_bucket {
+	/*! \brief theoretical arrival time of the next event, in ns; 0 if unused */
+	int64_t tat;
+	/*! \brief time between events at the configured rate, in ns */
+	int64_t interval;
+	/*! \brief how far ahead of the rate a burst may run, in ns */
+	int64_t tolerance;
+	enum cel_amqp_rate_policy policy;
+};
+
+/*!
+ * \brief Header of a shared memory ring sink
+ *
+ * The ring is a file, normally on /dev/shm, mapped by this module and by
+ * one consumer process. All integers are in host byte order. The header
+ * takes the first CEL_AMQP_SHM_DATA_OFFSET bytes of the file and the data
+ * area of capacity bytes, a power of two, follows it.
+ *
+ * head and tail count bytes ever written and consumed; a position's offset
+ * in the data area is position & (capacity - 1). The producer writes
+ * records, then stores head with release semantics. The consumer loads
+ * head with acquire semantics, reads the records between tail and head
+ * in place, then stores tail with release semantics to free their space.
+ *
+ * Each record is a struct cel_amqp_shm_record followed by length bytes of
+ * payload, padded to 8 bytes. Records never wrap: when one does not fit
+ * before the end of the data area, a padding record fills the rest and
+ * the record starts over at offset 0. Consumers skip padding records.
+ *
+ * futex is incremented after every batch. To sleep, a consumer sets
+ * waiters, loads futex, checks head once more, then waits with
+ * FUTEX_WAIT on futex for that value, and clears waiters on waking. The
+ * producer only calls FUTEX_WAKE when waiters is set.
+ */
+struct cel_amqp_shm_header {
+	/*! \brief CEL_AMQP_SHM_MAGIC, stored last when the ring is created */
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	uint64_t data_offset;
+	/*! \brief records the producer found no room for */
+	uint64_t dropped;
+	uint8_t reserved0[32];
+	/*! \brief written by the producer only; own cache line */
+	uint64_t head;
+	uint8_t reserved1[56];
+	/*! \brief written by the consumer only; own cache line */
+	uint64_t tail;
+	uint8_t reserved2[56];
+	uint32_t futex;
+	uint32_t waiters;
+};
+
+/*! \brief Record in a shared memory ring */
+struct cel_amqp_shm_record {
+	/*! \brief payload length, without the padding */
+	uint32_t length;
+	/*! \brief CEL_AMQP_SHM_JSON or CEL_AMQP_SHM_PADDING */
+	uint32_t type;
+	unsigned char data[0];
+};
+
+#define CEL_AMQP_SHM_MAGIC 0x524C4543 /* "CELR" in memory on little endian */
+#define CEL_AMQP_SHM_VERSION 1
+#define CEL_AMQP_SHM_DATA_OFFSET 4096
+#define CEL_AMQP_SHM_JSON 1
+#define CEL_AMQP_SHM_PADDING 2
+#define CEL_AMQP_SHM_ALIGN(len) (((len) + 7) & ~(uint64_t) 7)
+
+/*! \brief Settings of a local sink */
+struct cel_amqp_sink_conf {
+	/*! \brief maximum number of events waiting for the writer thread */
+	unsigned int queue_size;
+	/*! \brief rotate files at this size, in MB; 0 to disable */
+	unsigned int file_max_size;
+	/*! \brief rotate files this often, in seconds; 0 to disable */
+	unsigned int file_rotate_interval;
+	/*! \brief sync files at most this often, in ms */
+	unsigned int file_fsync_interval;
+	/*! \brief capacity of shared memory rings, in MB */
+	unsigned int shm_size;
+};
+
+/*! \brief Maximum number of events a sink's writer thread takes at once */
+#define CEL_AMQP_SINK_BATCH 64
+
+/*! \brief Longest a unix socket sink waits on its collector, in ms */
+#define CEL_AMQP_SOCK_TIMEOUT 1000
+
+struct cel_amqp_sink;
+struct cel_amqp_body;
+
+/*! \brief A kind of local sink */
+struct cel_amqp_sink_ops {
+	/*! \brief prefix of the sink option selecting this kind */
+	const char *prefix;
+	void (*init)(struct cel_amqp_sink *sink);
+	/*!
+	 * \brief write a batch of events; called from the writer thread
+	 * \return number of events written, the rest being dropped, or -1 on error
+	 */
+	int (*write)(struct cel_amqp_sink *sink, struct cel_amqp_body **bodies,
+		unsigned int count);
+	/*! \brief periodic work; returns ms until it is due again, or -1 */
+	int (*tick)(struct cel_amqp_sink *sink);
+	void (*close)(struct cel_amqp_sink *sink);
+};
+
+/*! \brief A local destination, written by a thread of its own */
+struct cel_amqp_sink {
+	const struct cel_amqp_sink_ops *ops;
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	pthread_t thread;
+	int stop;
+	/*! \brief ring of queued events, under lock */
+	struct cel_amqp_body **ring;
+	unsigned int size;
+	unsigned int head;
+	unsigned int queued;
+	/*! \brief settings, under lock */
+	struct cel_amqp_sink_conf conf;
+	/*! \brief settings in use by the writer thread */
+	struct cel_amqp_sink_conf active;
+	/*! \brief statistics; atomic */
+	int written;
+	int dropped;
+	int errors;
+	/*! \brief name without the prefix */
+	const char *path;
+	/*! \brief file sink state; only used by the writer thread */
+	struct {
+		int fd;
+		off_t size;
+		/*! \brief set while written data waits for fsync */
+		int dirty;
+		struct timeval opened;
+		struct timeval synced;
+		/*! \brief asynchronous writes, when available */
+		struct cel_amqp_uring *uring;
+		int uring_unavailable;
+	} file;
+	/*! \brief shared memory ring sink state; only used by the writer thread */
+	struct {
+		int fd;
+		struct cel_amqp_shm_header *header;
+		size_t map_size;
+		unsigned char *data;
+	} shm;
+	/*! \brief unix socket sink state; only used by the writer thread */
+	struct {
+		int fd;
+		/*! \brief SOCK_STREAM or SOCK_DGRAM */
+		int type;
+		/*! \brief consecutive failed connection attempts */
+		unsigned int failures;
+		/*! \brief earliest time for the next connection attempt */
+		struct timeval retry;
+	} sock;
+	/*! \brief sink option value */
+	char name[0];
+};
+
+/*! \brief Local sinks by name; they outlive configurations */
+static struct ao2_container *sinks;
+
 /*! \brief global config structure */
 struct cel_amqp_global_conf {
 	AST_DECLARE_STRING_FIELDS(
@@ -79,167 +974,4878 @@ struct cel_amqp_global_conf {
 		AST_STRING_FIELD(queue);
 		/*! \brief exchange name */
 		AST_STRING_FIELD(exchange);
+		/*! \brief header holding the partition key */
+		AST_STRING_FIELD(partition_header);
+		/*! \brief header holding the publish time; empty for none */
+		AST_STRING_FIELD(publish_time_header);
+		/*! \brief sink option; empty for amqp */
+		AST_STRING_FIELD(sink);
 	);
 
-	/*! \brief current connection to amqp */
-	struct ast_amqp_connection *amqp;
-};
+	/*! \brief local sink settings */
+	struct cel_amqp_sink_conf sink_conf;
+	/*! \brief fraction of calls published */
+	double sample_rate;
 
-/*! \brief cel_amqp configuration */
-struct cel_amqp_conf {
-	struct cel_amqp_global_conf *global;
+	/*! \brief format of the event_time field */
+	enum cel_amqp_time_format time_format;
+	/*! \brief set the message_id property */
+	int message_id;
+	/*! \brief set the timestamp property */
+	int timestamp;
+	/*! \brief header_fields copied into the AMQP headers; one more for the partition key */
+	unsigned char header_field[CEL_AMQP_MAX_HEADERS + 1];
+	/*! \brief AMQP headers with their keys filled in, values patched per event */
+	amqp_table_entry_t header_template[CEL_AMQP_MAX_HEADERS + 1];
+	unsigned int num_headers;
+	/*! \brief message body format */
+	enum cel_amqp_format format;
+	/*! \brief where the partition key goes */
+	enum cel_amqp_partition partition;
+	/*! \brief whether to number events */
+	int sequence;
+	/*! \brief whether to only publish changed fields */
+	int delta;
+	unsigned int delta_keyframe_interval;
+	unsigned int delta_channels;
+	/*! \brief priority class of each CEL event type */
+	unsigned char event_priority[CEL_AMQP_MAX_EVENT_TYPES];
+	/*! \brief maximum number of queued events per priority class */
+	unsigned int queue_size[CEL_AMQP_PRIORITY_MAX];
+	/*! \brief bounds for the adaptive batch size */
+	unsigned int min_batch_size;
+	unsigned int max_batch_size;
+	/*! \brief upper bound for the adaptive linger time, in ms */
+	unsigned int max_linger;
+	/*! \brief latency budget the batching adapts to, in ms */
+	unsigned int max_added_latency;
+	/*! \brief publish stall, in ms, after which the connection is blocked */
+	unsigned int blocked_threshold;
+	/*! \brief events accepted beyond the queue sizes while blocked */
+	unsigned int blocked_buffer_size;
+	/*! \brief bounds of the delay between connection attempts, in ms */
+	unsigned int connect_backoff_min;
+	unsigned int connect_backoff_max;
+	/*! \brief consecutive failed or slow publishes opening the breaker */
+	unsigned int breaker_threshold;
+	/*! \brief publish time, in ms, that counts as slow */
+	unsigned int breaker_slow_threshold;
+	/*! \brief time, in ms, before an open breaker is probed */
+	unsigned int breaker_reset_timeout;
+	/*! \brief global rate limit, in events per second; 0 if unlimited */
+	unsigned int rate_limit;
+	unsigned int rate_burst;
+	struct cel_amqp_bucket bucket;
 };
 
-/*! \brief Locking container for safe configuration access. */
-static AO2_GLOBAL_OBJ_STATIC(confs);
+/*! \brief per destination rate limit */
+struct cel_amqp_ratelimit_conf {
+	AST_DECLARE_STRING_FIELDS(
+		/*! \brief section name */
+		AST_STRING_FIELD(name);
+		/*! \brief exchange name */
+		AST_STRING_FIELD(exchange);
+		/*! \brief routing key */
+		AST_STRING_FIELD(routing_key);
+	);
 
-static struct aco_type global_option = {
-	.type = ACO_GLOBAL,
-	.name = "global",
-	.item_offset = offsetof(struct cel_amqp_conf, global),
-	.category = "^global$",
-	.category_match = ACO_WHITELIST,
+	unsigned int rate;
+	unsigned int burst;
+	struct cel_amqp_bucket bucket;
 };
 
-static struct aco_type *global_options[] = ACO_TYPES(&global_option);
+/*! \brief Most destinations, [global] included */
+#define CEL_AMQP_MAX_PROFILES 16
 
-static void conf_global_dtor(void *obj)
-{
-	struct cel_amqp_global_conf *global = obj;
-	ao2_cleanup(global->amqp);
-	ast_string_field_free_memory(global);
-}
+struct cel_amqp_message;
+AST_LIST_HEAD_NOLOCK(cel_amqp_message_list, cel_amqp_message);
 
-static struct cel_amqp_global_conf *conf_global_create(void)
-{
-	RAII_VAR(struct cel_amqp_global_conf *, global, NULL, ao2_cleanup);
+/*! \brief A destination events are published to */
+struct cel_amqp_profile {
+	AST_DECLARE_STRING_FIELDS(
+		/*! \brief section name; global for the [global] destination */
+		AST_STRING_FIELD(name);
+		/*! \brief connection name */
+		AST_STRING_FIELD(connection);
+		/*! \brief queue name */
+		AST_STRING_FIELD(queue);
+		/*! \brief exchange name */
+		AST_STRING_FIELD(exchange);
+		/*! \brief sink option; empty for amqp */
+		AST_STRING_FIELD(sink);
+	);
+
+	/*! \brief message body format */
+	enum cel_amqp_format format;
+	/*! \brief local sink settings */
+	struct cel_amqp_sink_conf sink_conf;
+	/*! \brief local sink; NULL when publishing to amqp */
+	struct cel_amqp_sink *local;
+	/*! \brief named in [tenants]; only gets the events of its tenants */
+	int tenant;
+	/*! \brief fraction of calls published */
+	double sample_rate;
+	/*! \brief calls whose linked_id hashes below this are published; UINT64_MAX for all */
+	uint64_t sample_threshold;
+	/*! \brief event types published, one bit each */
+	uint64_t events;
+	/*! \brief matching per destination rate limit, if any */
+	struct cel_amqp_ratelimit_conf *ratelimit;
+	/*! \brief connection to amqp; set up lazily, under publisher.lock */
+	struct ast_amqp_connection *amqp;
+	/*! \brief consecutive failed connection attempts; under publisher.lock */
+	unsigned int connect_failures;
+	/*! \brief earliest time for the next connection attempt */
+	struct timeval connect_next;
+	unsigned long connects;
+	/*! \brief messages queued for this destination, one bounded queue per
+	 * priority class; under publisher.lock, like the fields up to retry */
+	struct cel_amqp_message_list queues[CEL_AMQP_PRIORITY_MAX];
+	unsigned int queue_length[CEL_AMQP_PRIORITY_MAX];
+	/*! \brief total of queue_length */
+	unsigned int queued;
+	/*! \brief set while a class is shedding, to log only once per episode */
+	int shedding[CEL_AMQP_PRIORITY_MAX];
+	/*! \brief configuration of the queued messages; borrowed while any are queued */
+	struct cel_amqp_conf *conf;
+	/*! \brief in publisher.active while it has queued messages */
+	AST_LIST_ENTRY(cel_amqp_profile) active;
+	/*! \brief when last found not ready, earliest time it may be; zero otherwise */
+	struct timeval retry;
+	/*! \brief circuit breaker; only changed by the publisher thread */
+	enum cel_amqp_breaker breaker;
+	/*! \brief consecutive failed or slow publishes; publisher thread only */
+	unsigned int breaker_failures;
+	struct timeval breaker_opened;
+	/*! \brief probed once more while stopping; publisher thread only */
+	int stop_probed;
+	/*! \brief publisher.round the destination was last considered in */
+	unsigned int round;
+};
+
+/*! \brief JSON body shared by the messages of an event */
+struct cel_amqp_body {
+	/*! \brief allocated by ast_json_dump_string */
+	char *json;
+	/*! \brief event time, in microseconds since the epoch */
+	int64_t event_time;
+};
+
+struct cel_amqp_conf;
+
+/*! \brief A serialized CEL event waiting to be published */
+struct cel_amqp_message {
+	AST_LIST_ENTRY(cel_amqp_message) list;
+	/*! \brief configuration the event was accepted under; see publisher_enqueue() */
+	struct cel_amqp_conf *conf;
+	/*! \brief destination; owned by conf */
+	struct cel_amqp_profile *profile;
+	enum cel_amqp_priority priority;
+	/*! \brief held until then by a buffering rate limit, in the ns the
+	 * buckets count in; 0 if not held */
+	int64_t not_before;
+	/*! \brief AMQP headers; entries and their values live in header_entries */
+	amqp_table_t headers;
+	/*! \brief routing key, if not the configured queue; lives in header_entries */
+	amqp_bytes_t routing_key;
+	/*! \brief message_id property, in hex; empty if not set */
+	char message_id[17];
+	/*! \brief timestamp property; 0 if not set */
+	uint64_t timestamp;
+	/*! \brief the last header is set to the publish time */
+	int publish_time;
+	/*! \brief message body; shared with the event's other destinations */
+	struct cel_amqp_body *body;
+	/*! \brief event to encode instead, for the arrow format; shared likewise */
+	struct cel_amqp_row *row;
+	/*! \brief header entries, followed by the header values and routing key */
+	amqp_table_entry_t header_entries[0];
+};
+
+/*! \brief Growable byte buffer */
+struct arrow_buf {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+	/*! \brief set when growing failed; the contents are then incomplete */
+	int error;
+};
+
+/*! \brief FlatBuffer under construction; the data is at the end of buf */
+struct fb_builder {
+	unsigned char *buf;
+	size_t cap;
+	size_t len;
+	size_t minalign;
+	int error;
+	/*! \brief table under construction */
+	size_t table_start;
+	unsigned int num_fields;
+	struct {
+		unsigned int id;
+		size_t off;
+	} fields[8];
+};
+
+/*! \brief Arrow encoder state; only used by the publisher thread */
+static struct {
+	struct fb_builder fb;
+	/*! \brief body of the IPC message being built */
+	struct arrow_buf body;
+	/*! \brief the IPC stream */
+	struct arrow_buf out;
+	/*! \brief position of each buffer in the body */
+	struct {
+		size_t offset;
+		size_t length;
+	} buffers[3 * CEL_AMQP_ARROW_COLUMNS];
+	unsigned int num_buffers;
+	/*! \brief length of each column */
+	size_t nodes[CEL_AMQP_ARROW_COLUMNS];
+	unsigned int num_nodes;
+	/*! \brief per row arrays, sized for rows_size rows */
+	void *mem;
+	size_t rows_size;
+	int64_t *times;
+	struct cel_amqp_row **rows;
+	/*! \brief row of each dictionary value */
+	uint32_t *values;
+	/*! \brief dictionary index of each row, per column */
+	uint32_t *indexes;
+	/*! \brief open addressing table of dictionary value numbers, plus one */
+	uint32_t *table;
+	size_t table_size;
+} arrow;
+
+/*! \brief State shared between the CEL handler and the publisher thread */
+static struct {
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	pthread_t thread;
+	int stop;
+	/*! \brief destinations with queued messages */
+	AST_LIST_HEAD_NOLOCK(, cel_amqp_profile) active;
+	/*! \brief queued messages per priority class, of all destinations */
+	unsigned int queued[CEL_AMQP_PRIORITY_MAX];
+	/*! \brief statistics */
+	unsigned long enqueued[CEL_AMQP_PRIORITY_MAX];
+	unsigned long dropped[CEL_AMQP_PRIORITY_MAX];
+	unsigned long published;
+	unsigned long failed;
+	/*! \brief publisher thread is waiting for any event */
+	int idle;
+	/*! \brief destination the publisher thread is waiting for a batch of */
+	struct cel_amqp_profile *lingering;
+	/*! \brief current adaptive batch size */
+	unsigned int batch_size;
+	/*! \brief current adaptive linger time, in us */
+	unsigned int linger_us;
+	/*! \brief smoothed per-message publish round-trip time, in us */
+	unsigned int rtt_us;
+	/*! \brief smoothed incoming event rate, in events per second */
+	unsigned int rate;
+	/*! \brief event count and time of the last rate sample */
+	unsigned long rate_events;
+	struct timeval rate_time;
+	/*! \brief publisher thread is inside a batch publish */
+	int publishing;
+	/*! \brief messages published so far; updated without the lock */
+	int progress;
+	/*! \brief last observed progress and when it was observed */
+	int progress_seen;
+	struct timeval progress_time;
+	/*! \brief connection is blocked by the broker */
+	int blocked;
+	struct timeval blocked_since;
+	/*! \brief blocked statistics */
+	unsigned long blocked_count;
+	int64_t blocked_ms;
+	unsigned long spilled;
+	/*! \brief events shed by a rate limit; updated without the lock */
+	int rate_shed;
+	/*! \brief events left out by sampling; updated without the lock */
+	int sampled_out;
+	/*! \brief time events were held for a buffering rate limit, in us */
+	int64_t rate_waited_us;
+	/*! \brief breaker transitions, of all destinations */
+	unsigned long breaker_trips;
+	unsigned long breaker_probes;
+	unsigned long breaker_recoveries;
+	/*! \brief counts the publisher thread's choices of a destination */
+	unsigned int round;
+} publisher = {
+	.thread = AST_PTHREADT_NULL,
+};
+
+/*! \brief [tenants] section, as read */
+struct cel_amqp_tenants_conf {
+	/*! \brief account code or context:prefix = destination, in file order */
+	struct ast_variable *mappings;
+};
+
+/*! \brief Key prefix of a [tenants] mapping by context prefix */
+#define CEL_AMQP_TENANT_CONTEXT "context:"
+
+enum cel_amqp_tenant_key {
+	CEL_AMQP_TENANT_KEY_ACCOUNT_CODE,
+	CEL_AMQP_TENANT_KEY_CONTEXT,
+};
+
+/*! \brief Slot of the tenant lookup table */
+struct cel_amqp_tenant_slot {
+	uint64_t hash;
+	/*! \brief borrowed from the [tenants] section; NULL in an empty slot */
+	const char *key;
+	size_t len;
+	enum cel_amqp_tenant_key kind;
+	/*! \brief borrowed from the configuration's outputs */
+	struct cel_amqp_profile *output;
+};
+
+/*! \brief cel_amqp configuration */
+struct cel_amqp_conf {
+	struct cel_amqp_global_conf *global;
+	/*! \brief per destination rate limits */
+	struct ao2_container *ratelimits;
+	/*! \brief [type=profile] sections */
+	struct ao2_container *profiles;
+	/*! \brief destinations: [global], if it has a connection, and the profiles */
+	struct cel_amqp_profile *outputs[CEL_AMQP_MAX_PROFILES];
+	unsigned int num_outputs;
+	/*! \brief destinations of each event type; borrowed from outputs */
+	struct {
+		unsigned int count;
+		struct cel_amqp_profile *outputs[CEL_AMQP_MAX_PROFILES];
+	} dispatch[CEL_AMQP_MAX_EVENT_TYPES];
+	/*! \brief [tenants] section */
+	struct cel_amqp_tenants_conf *tenants;
+	/*! \brief open addressing table of the tenant keys, tenant_mask + 1 slots */
+	struct cel_amqp_tenant_slot *tenant_table;
+	size_t tenant_mask;
+	unsigned int num_tenants;
+	/*! \brief distinct lengths of the context prefixes, longest first */
+	size_t *tenant_prefix_lens;
+	unsigned int num_tenant_prefix_lens;
+	/*! \brief queued or in-flight messages; protected by publisher.lock */
+	unsigned int pending;
+};
+
+/*! \brief Locking container for safe configuration access. */
+static AO2_GLOBAL_OBJ_STATIC(confs);
+
+/*! \brief Bumped each time a new configuration has been applied */
+static int conf_generation;
+
+/*!
+ * \brief Configuration reference cached by a thread.
+ *
+ * Entries are also linked in the conf_caches list, so that unload can
+ * release the references they hold even for threads that are not ours.
+ * An entry and its slot are freed by whichever comes first: its thread
+ * exiting, or unload.
+ */
+struct conf_cache {
+	AST_LIST_ENTRY(conf_cache) list;
+	/*! \brief thread storage pointing at this entry */
+	struct conf_cache **slot;
+	/*! \brief conf_generation the reference was taken at */
+	int generation;
+	struct cel_amqp_conf *conf;
+};
+
+static AST_LIST_HEAD_STATIC(conf_caches, conf_cache);
+
+static void conf_cache_slot_free(void *data);
+
+/*! \brief Pointer to the calling thread's conf_cache */
+AST_THREADSTORAGE_CUSTOM(conf_cache_slot, NULL, conf_cache_slot_free);
+
+/*! \brief ISO 8601 rendering of the second last formatted by a thread */
+struct event_time_cache {
+	/*! \brief second the strings below are for */
+	time_t sec;
+	/*! \brief date and time up to and including the decimal point */
+	char prefix[32];
+	/*! \brief UTC offset */
+	char zone[8];
+};
+
+AST_THREADSTORAGE(event_time_cache_buf);
+
+/*! \brief Events numbered so far */
+static int64_t sequence;
+
+/*! \brief Number of buckets of a lag histogram */
+#define CEL_AMQP_LAG_BUCKETS 32
+
+/*! \brief Pipeline stages whose lag behind the event time is measured */
+enum cel_amqp_lag_stage {
+	/*! \brief handed to the publisher thread or a local sink */
+	CEL_AMQP_LAG_ENQUEUE,
+	/*! \brief message body built */
+	CEL_AMQP_LAG_SERIALIZE,
+	/*! \brief accepted by the broker or written by a local sink */
+	CEL_AMQP_LAG_PUBLISH,
+	CEL_AMQP_LAG_MAX,
+};
+
+static const char *lag_stage_names[CEL_AMQP_LAG_MAX] = {
+	[CEL_AMQP_LAG_ENQUEUE] = "enqueue",
+	[CEL_AMQP_LAG_SERIALIZE] = "serialize",
+	[CEL_AMQP_LAG_PUBLISH] = "publish",
+};
+
+/*!
+ * \brief Lag histograms, updated atomically.
+ *
+ * Bucket 0 counts lags of 0 us, and bucket i lags from 2^(i-1) to 2^i us;
+ * the last one also counts everything longer.
+ */
+static struct {
+	int64_t buckets[CEL_AMQP_LAG_MAX][CEL_AMQP_LAG_BUCKETS];
+	int64_t sum_us[CEL_AMQP_LAG_MAX];
+	int64_t max_us[CEL_AMQP_LAG_MAX];
+} lag;
+
+/*! \brief Event numbering of a call */
+struct cel_amqp_call {
+	/*! \brief events numbered so far */
+	int64_t sequence;
+	char linked_id[0];
+};
+
+/*! \brief Calls being numbered, by linked_id */
+static struct ao2_container *calls;
+
+/*! \brief Whether the calls limit has been logged about */
+static int calls_full;
+
+/*!
+ * \brief Fields left out of delta events when unchanged.
+ *
+ * Fields sharing a key (the caller_id object) are kept or left out
+ * together, and must be adjacent.
+ */
+static const struct {
+	const char *key;
+	size_t offset;
+} delta_fields[] = {
+	{ "account_code", offsetof(struct ast_cel_event_record, account_code) },
+	{ "caller_id", offsetof(struct ast_cel_event_record, caller_id_num) },
+	{ "caller_id", offsetof(struct ast_cel_event_record, caller_id_name) },
+	{ "caller_id", offsetof(struct ast_cel_event_record, caller_id_ani) },
+	{ "caller_id", offsetof(struct ast_cel_event_record, caller_id_rdnis) },
+	{ "caller_id", offsetof(struct ast_cel_event_record, caller_id_dnid) },
+	{ "extension", offsetof(struct ast_cel_event_record, extension) },
+	{ "context", offsetof(struct ast_cel_event_record, context) },
+	{ "channel", offsetof(struct ast_cel_event_record, channel_name) },
+	{ "application", offsetof(struct ast_cel_event_record, application_name) },
+	{ "app_data", offsetof(struct ast_cel_event_record, application_data) },
+	{ "linked_id", offsetof(struct ast_cel_event_record, linked_id) },
+	{ "user_field", offsetof(struct ast_cel_event_record, user_field) },
+	{ "peer", offsetof(struct ast_cel_event_record, peer) },
+	{ "peer_acount", offsetof(struct ast_cel_event_record, peer_account) },
+};
+
+#define CEL_AMQP_DELTA_FIELDS ARRAY_LEN(delta_fields)
+
+/*! \brief Keyframe of a channel, for delta encoding */
+struct cel_amqp_channel {
+	/*! \brief frame number of the channel's last event */
+	unsigned int frame;
+	/*! \brief frame number of the keyframe */
+	unsigned int keyframe;
+	/*! \brief delta_sweep when the channel last had an event */
+	unsigned int sweep;
+	unsigned int amaflag;
+	/*! \brief delta_fields values of the keyframe; stored after unique_id */
+	const char *values[CEL_AMQP_DELTA_FIELDS];
+	char unique_id[0];
+};
+
+/*! \brief Keyframes, by unique_id */
+static struct ao2_container *channels;
+
+/*! \brief Number and time of the last sweep of channels; under its lock */
+static unsigned int delta_sweep;
+static struct timeval delta_swept;
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t xxh_rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_read64(const unsigned char *p)
+{
+	return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16
+		| (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40
+		| (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static uint32_t xxh_read32(const unsigned char *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+		| (uint32_t) p[3] << 24;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = xxh_rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/*!
+ * \brief XXH64 hash.
+ *
+ * Fast and well distributed. Input bytes are read as little endian, so
+ * the result does not depend on the host.
+ */
+static uint64_t xxh64(const void *input, size_t len, uint64_t seed)
+{
+	const unsigned char *p = input;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		const unsigned char *limit = end - 32;
+		uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = seed + XXH_PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, xxh_read64(p));
+			v2 = xxh64_round(v2, xxh_read64(p + 8));
+			v3 = xxh64_round(v3, xxh_read64(p + 16));
+			v4 = xxh64_round(v4, xxh_read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12)
+			+ xxh_rotl64(v4, 18);
+		h = xxh64_merge_round(h, v1);
+		h = xxh64_merge_round(h, v2);
+		h = xxh64_merge_round(h, v3);
+		h = xxh64_merge_round(h, v4);
+	} else {
+		h = seed + XXH_PRIME64_5;
+	}
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, xxh_read64(p));
+		h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t) xxh_read32(p) * XXH_PRIME64_1;
+		h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		h ^= *p * XXH_PRIME64_5;
+		h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static struct aco_type global_option = {
+	.type = ACO_GLOBAL,
+	.name = "global",
+	.item_offset = offsetof(struct cel_amqp_conf, global),
+	.category = "^global$",
+	.category_match = ACO_WHITELIST,
+};
+
+static struct aco_type *global_options[] = ACO_TYPES(&global_option);
+
+static void *ratelimit_alloc(const char *cat);
+static void *ratelimit_find(struct ao2_container *container, const char *cat);
+
+static struct aco_type ratelimit_option = {
+	.type = ACO_ITEM,
+	.name = "ratelimit",
+	.category = "^(global|tenants)$",
+	.category_match = ACO_BLACKLIST,
+	.matchfield = "type",
+	.matchvalue = "ratelimit",
+	.item_alloc = ratelimit_alloc,
+	.item_find = ratelimit_find,
+	.item_offset = offsetof(struct cel_amqp_conf, ratelimits),
+};
+
+static struct aco_type *ratelimit_options[] = ACO_TYPES(&ratelimit_option);
+
+static void *profile_alloc(const char *cat);
+static void *profile_find(struct ao2_container *container, const char *cat);
+
+static struct aco_type profile_option = {
+	.type = ACO_ITEM,
+	.name = "profile",
+	.category = "^(global|tenants)$",
+	.category_match = ACO_BLACKLIST,
+	.matchfield = "type",
+	.matchvalue = "profile",
+	.item_alloc = profile_alloc,
+	.item_find = profile_find,
+	.item_offset = offsetof(struct cel_amqp_conf, profiles),
+};
+
+static struct aco_type *profile_options[] = ACO_TYPES(&profile_option);
+
+static struct aco_type tenants_option = {
+	.type = ACO_GLOBAL,
+	.name = "tenants",
+	.item_offset = offsetof(struct cel_amqp_conf, tenants),
+	.category = "^tenants$",
+	.category_match = ACO_WHITELIST,
+};
+
+static struct aco_type *tenants_options[] = ACO_TYPES(&tenants_option);
+
+/*!
+ * \brief Configure a bucket for a rate and burst.
+ *
+ * A rate of 0 leaves the bucket disabled. The interval is kept in ns, so
+ * that rates above one event per us still limit, and rates that do not
+ * divide a second evenly are not rounded up by much.
+ */
+static void bucket_init(struct cel_amqp_bucket *bucket, unsigned int rate,
+	unsigned int burst)
+{
+	bucket->tat = 0;
+	bucket->interval = rate ? MAX(1000000000 / rate, 1U) : 0;
+	bucket->tolerance = (int64_t) burst * bucket->interval;
+}
+
+/*! \brief Current time, in the ns the buckets count in */
+static int64_t bucket_now(void)
+{
+	return ast_tvdiff_us(ast_tvnow(), ast_tv(0, 0)) * 1000;
+}
+
+/*!
+ * \brief Take one token, unless the bucket is empty.
+ *
+ * Lock free; safe to call from any number of threads.
+ *
+ * \retval 0 if the event conforms to the rate.
+ * \retval -1 if it is over the limit.
+ */
+static int bucket_take(struct cel_amqp_bucket *bucket, int64_t now)
+{
+	int64_t tat = __atomic_load_n(&bucket->tat, __ATOMIC_RELAXED);
+	int64_t next;
+
+	if (!bucket->interval) {
+		return 0;
+	}
+
+	do {
+		if (now < tat - bucket->tolerance) {
+			return -1;
+		}
+		next = MAX(tat, now) + bucket->interval;
+	} while (!__atomic_compare_exchange_n(&bucket->tat, &tat, next, 0,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return 0;
+}
+
+/*!
+ * \brief Reserve one token, however long that takes.
+ *
+ * \return how long to wait, in ns, before the event conforms to the rate.
+ */
+static int64_t bucket_reserve(struct cel_amqp_bucket *bucket, int64_t now)
+{
+	int64_t tat = __atomic_load_n(&bucket->tat, __ATOMIC_RELAXED);
+	int64_t allowed;
+
+	if (!bucket->interval) {
+		return 0;
+	}
+
+	do {
+		allowed = MAX(now, tat - bucket->tolerance);
+	} while (!__atomic_compare_exchange_n(&bucket->tat, &tat,
+		MAX(tat, allowed) + bucket->interval, 0,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return allowed - now;
+}
+
+static int rate_policy_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	enum cel_amqp_rate_policy *policy = obj;
+
+	if (!strcasecmp(var->value, "buffer")) {
+		*policy = CEL_AMQP_RATE_BUFFER;
+	} else if (!strcasecmp(var->value, "shed")) {
+		*policy = CEL_AMQP_RATE_SHED;
+	} else {
+		ast_log(LOG_ERROR, "Invalid rate limit policy '%s'\n", var->value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int global_rate_policy_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_global_conf *global = obj;
+
+	return rate_policy_handler(opt, var, &global->bucket.policy);
+}
+
+static int ratelimit_policy_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_ratelimit_conf *ratelimit = obj;
+
+	return rate_policy_handler(opt, var, &ratelimit->bucket.policy);
+}
+
+/*!
+ * \brief Assign a priority class to a comma separated list of CEL event names.
+ *
+ * Event types previously assigned to \a priority are reset to normal first,
+ * so that an explicit setting replaces the default list instead of extending it.
+ */
+static int set_event_priorities(struct cel_amqp_global_conf *global,
+	const char *value, enum cel_amqp_priority priority)
+{
+	char *names = ast_strdupa(value);
+	char *name;
+	int i;
+
+	for (i = 0; i < CEL_AMQP_MAX_EVENT_TYPES; ++i) {
+		if (global->event_priority[i] == priority) {
+			global->event_priority[i] = CEL_AMQP_PRIORITY_NORMAL;
+		}
+	}
+
+	while ((name = strsep(&names, ","))) {
+		enum ast_cel_event_type type;
+
+		name = ast_strip(name);
+		if (ast_strlen_zero(name)) {
+			continue;
+		}
+
+		type = ast_cel_str_to_event_type(name);
+		if (type == AST_CEL_INVALID_VALUE
+			|| type >= CEL_AMQP_MAX_EVENT_TYPES) {
+			ast_log(LOG_ERROR, "Unknown CEL event type '%s'\n", name);
+			return -1;
+		}
+
+		global->event_priority[type] = priority;
+	}
+
+	return 0;
+}
+
+static int time_format_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_global_conf *global = obj;
+
+	if (!strcasecmp(var->value, "iso8601")) {
+		global->time_format = CEL_AMQP_TIME_ISO8601;
+	} else if (!strcasecmp(var->value, "epoch_us")) {
+		global->time_format = CEL_AMQP_TIME_EPOCH_US;
+	} else {
+		ast_log(LOG_ERROR, "Invalid time_format '%s'\n", var->value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int headers_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_global_conf *global = obj;
+	char *names = ast_strdupa(var->value);
+	char *name;
+
+	global->num_headers = 0;
+	while ((name = strsep(&names, ","))) {
+		amqp_table_entry_t *entry;
+		unsigned int i;
+
+		name = ast_strip(name);
+		if (ast_strlen_zero(name)) {
+			continue;
+		}
+
+		for (i = 0; i < CEL_AMQP_MAX_HEADERS; ++i) {
+			if (!strcasecmp(name, header_fields[i].name)) {
+				break;
+			}
+		}
+		if (i == CEL_AMQP_MAX_HEADERS) {
+			ast_log(LOG_ERROR, "Unknown header field '%s'\n", name);
+			return -1;
+		}
+		if (global->num_headers == CEL_AMQP_MAX_HEADERS) {
+			ast_log(LOG_ERROR, "Too many header fields\n");
+			return -1;
+		}
+
+		entry = &global->header_template[global->num_headers];
+		entry->key = amqp_cstring_bytes(header_fields[i].name);
+		entry->value.kind = AMQP_FIELD_KIND_UTF8;
+		entry->value.value.bytes = amqp_empty_bytes;
+		global->header_field[global->num_headers++] = i;
+	}
+
+	return 0;
+}
+
+static int format_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	enum cel_amqp_format *format = obj;
+
+	if (!strcasecmp(var->value, "json")) {
+		*format = CEL_AMQP_FORMAT_JSON;
+	} else if (!strcasecmp(var->value, "arrow")) {
+		*format = CEL_AMQP_FORMAT_ARROW;
+	} else {
+		ast_log(LOG_ERROR, "Invalid format '%s'\n", var->value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int global_format_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_global_conf *global = obj;
+
+	return format_handler(opt, var, &global->format);
+}
+
+static int profile_format_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_profile *profile = obj;
+
+	return format_handler(opt, var, &profile->format);
+}
+
+static int profile_events_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_profile *profile = obj;
+	char *names = ast_strdupa(var->value);
+	char *name;
+
+	if (ast_strlen_zero(ast_strip(names))) {
+		profile->events = UINT64_MAX;
+		return 0;
+	}
+
+	profile->events = 0;
+	while ((name = strsep(&names, ","))) {
+		enum ast_cel_event_type type;
+
+		name = ast_strip(name);
+		if (ast_strlen_zero(name)) {
+			continue;
+		}
+
+		type = ast_cel_str_to_event_type(name);
+		if (type == AST_CEL_ALL) {
+			profile->events = UINT64_MAX;
+			continue;
+		}
+		if (type == AST_CEL_INVALID_VALUE
+			|| type >= CEL_AMQP_MAX_EVENT_TYPES) {
+			ast_log(LOG_ERROR, "Unknown CEL event type '%s'\n", name);
+			return -1;
+		}
+
+		profile->events |= (uint64_t) 1 << type;
+	}
+
+	return 0;
+}
+
+static int tenants_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_tenants_conf *tenants = obj;
+	struct ast_variable *mapping;
+
+	if (ast_strlen_zero(var->value)) {
+		ast_log(LOG_ERROR, "No destination for tenant %s\n", var->name);
+		return -1;
+	}
+
+	mapping = ast_variable_new(var->name, var->value, "");
+	if (!mapping) {
+		return -1;
+	}
+	ast_variable_list_append(&tenants->mappings, mapping);
+
+	return 0;
+}
+
+static int partition_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	struct cel_amqp_global_conf *global = obj;
+
+	if (!strcasecmp(var->value, "none")) {
+		global->partition = CEL_AMQP_PARTITION_NONE;
+	} else if (!strcasecmp(var->value, "routing_key")) {
+		global->partition = CEL_AMQP_PARTITION_ROUTING_KEY;
+	} else if (!strcasecmp(var->value, "header")) {
+		global->partition = CEL_AMQP_PARTITION_HEADER;
+	} else {
+		ast_log(LOG_ERROR, "Invalid partition '%s'\n", var->value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int critical_events_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	return set_event_priorities(obj, var->value, CEL_AMQP_PRIORITY_CRITICAL);
+}
+
+static int low_priority_events_handler(const struct aco_option *opt,
+	struct ast_variable *var, void *obj)
+{
+	return set_event_priorities(obj, var->value, CEL_AMQP_PRIORITY_LOW);
+}
+
+static void conf_global_dtor(void *obj)
+{
+	struct cel_amqp_global_conf *global = obj;
+	ast_string_field_free_memory(global);
+}
+
+static struct cel_amqp_global_conf *conf_global_create(void)
+{
+	RAII_VAR(struct cel_amqp_global_conf *, global, NULL, ao2_cleanup);
+
+	global = ao2_alloc(sizeof(*global), conf_global_dtor);
+	if (!global) {
+		return NULL;
+	}
+
+	if (ast_string_field_init(global, 64) != 0) {
+		return NULL;
+	}
+
+	aco_set_defaults(&global_option, "global", global);
+
+	return ao2_bump(global);
+}
+
+AO2_STRING_FIELD_HASH_FN(cel_amqp_ratelimit_conf, name);
+AO2_STRING_FIELD_CMP_FN(cel_amqp_ratelimit_conf, name);
+
+static void ratelimit_dtor(void *obj)
+{
+	struct cel_amqp_ratelimit_conf *ratelimit = obj;
+
+	ast_string_field_free_memory(ratelimit);
+}
+
+static void *ratelimit_alloc(const char *cat)
+{
+	RAII_VAR(struct cel_amqp_ratelimit_conf *, ratelimit, NULL, ao2_cleanup);
+
+	ratelimit = ao2_alloc_options(sizeof(*ratelimit), ratelimit_dtor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!ratelimit) {
+		return NULL;
+	}
+
+	if (ast_string_field_init(ratelimit, 64) != 0) {
+		return NULL;
+	}
+	ast_string_field_set(ratelimit, name, cat);
+
+	return ao2_bump(ratelimit);
+}
+
+static void *ratelimit_find(struct ao2_container *container, const char *cat)
+{
+	return ao2_find(container, cat, OBJ_SEARCH_KEY);
+}
+
+AO2_STRING_FIELD_HASH_FN(cel_amqp_call, linked_id);
+AO2_STRING_FIELD_CMP_FN(cel_amqp_call, linked_id);
+AO2_STRING_FIELD_HASH_FN(cel_amqp_channel, unique_id);
+AO2_STRING_FIELD_CMP_FN(cel_amqp_channel, unique_id);
+
+AO2_STRING_FIELD_HASH_FN(cel_amqp_profile, name);
+AO2_STRING_FIELD_CMP_FN(cel_amqp_profile, name);
+AO2_STRING_FIELD_HASH_FN(cel_amqp_sink, name);
+AO2_STRING_FIELD_CMP_FN(cel_amqp_sink, name);
+
+static void profile_dtor(void *obj)
+{
+	struct cel_amqp_profile *profile = obj;
+
+	ao2_cleanup(profile->amqp);
+	ao2_cleanup(profile->ratelimit);
+	ao2_cleanup(profile->local);
+	ast_string_field_free_memory(profile);
+}
+
+static void *profile_alloc(const char *cat)
+{
+	RAII_VAR(struct cel_amqp_profile *, profile, NULL, ao2_cleanup);
+
+	profile = ao2_alloc_options(sizeof(*profile), profile_dtor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!profile) {
+		return NULL;
+	}
+
+	if (ast_string_field_init(profile, 64) != 0) {
+		return NULL;
+	}
+	ast_string_field_set(profile, name, cat);
+	profile->events = UINT64_MAX;
+
+	return ao2_bump(profile);
+}
+
+static void *profile_find(struct ao2_container *container, const char *cat)
+{
+	return ao2_find(container, cat, OBJ_SEARCH_KEY);
+}
+
+/*! \brief The conf file that's processed for the module. */
+static struct aco_file conf_file = {
+	/*! The config file name. */
+	.filename = CONF_FILENAME,
+	/*! The mapping object types to be processed. */
+	.types = ACO_TYPES(&global_option, &ratelimit_option, &profile_option,
+		&tenants_option),
+};
+
+static void tenants_dtor(void *obj)
+{
+	struct cel_amqp_tenants_conf *tenants = obj;
+
+	ast_variables_destroy(tenants->mappings);
+}
+
+static void conf_dtor(void *obj)
+{
+	struct cel_amqp_conf *conf = obj;
+	unsigned int i;
+
+	ast_free(conf->tenant_table);
+	ast_free(conf->tenant_prefix_lens);
+	ao2_cleanup(conf->tenants);
+	ao2_cleanup(conf->global);
+	ao2_cleanup(conf->ratelimits);
+	ao2_cleanup(conf->profiles);
+	for (i = 0; i < conf->num_outputs; ++i) {
+		ao2_ref(conf->outputs[i], -1);
+	}
+}
+
+static void *conf_alloc(void)
+{
+	RAII_VAR(struct cel_amqp_conf *, conf, NULL, ao2_cleanup);
+
+	conf = ao2_alloc_options(sizeof(*conf), conf_dtor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!conf) {
+		return NULL;
+	}
+
+	conf->global = conf_global_create();
+	if (!conf->global) {
+		return NULL;
+	}
+
+	conf->ratelimits = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, 7,
+		cel_amqp_ratelimit_conf_hash_fn, NULL, cel_amqp_ratelimit_conf_cmp_fn);
+	if (!conf->ratelimits) {
+		return NULL;
+	}
+
+	conf->profiles = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, 7,
+		cel_amqp_profile_hash_fn, NULL, cel_amqp_profile_cmp_fn);
+	if (!conf->profiles) {
+		return NULL;
+	}
+
+	conf->tenants = ao2_alloc_options(sizeof(*conf->tenants), tenants_dtor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!conf->tenants) {
+		return NULL;
+	}
+
+	return ao2_bump(conf);
+}
+
+static int64_t tv_us(struct timeval tv)
+{
+	return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*!
+ * \brief Record how long after its event time an event reached a stage.
+ *
+ * \param now_us Current time, in microseconds since the epoch; read once
+ * by callers recording a whole batch.
+ */
+static void lag_record(enum cel_amqp_lag_stage stage, int64_t event_time,
+	int64_t now_us)
+{
+	int64_t us = MAX(now_us - event_time, 0);
+	int64_t max = __atomic_load_n(&lag.max_us[stage], __ATOMIC_RELAXED);
+	int bucket = us ? MIN(64 - __builtin_clzll(us), CEL_AMQP_LAG_BUCKETS - 1) : 0;
+
+	__atomic_fetch_add(&lag.buckets[stage][bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&lag.sum_us[stage], us, __ATOMIC_RELAXED);
+	while (us > max && !__atomic_compare_exchange_n(&lag.max_us[stage], &max, us,
+			1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+/*! \brief Whether a sink option names a local sink rather than amqp */
+static int sink_is_local(const char *sink)
+{
+	return !ast_strlen_zero(sink) && strcasecmp(sink, "amqp");
+}
+
+/*!
+ * \brief Write all of an iovec array, resuming after partial writes.
+ *
+ * \param offset file offset to write at, or -1 for the current position
+ *
+ * \note The iovec array is modified.
+ */
+static int writev_all(int fd, struct iovec *iov, int count, off_t offset)
+{
+	ssize_t res;
+
+	while (count > 0) {
+		if (offset < 0) {
+			res = writev(fd, iov, MIN(count, IOV_MAX));
+		} else {
+			res = pwritev(fd, iov, MIN(count, IOV_MAX), offset);
+		}
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (offset >= 0) {
+			offset += res;
+		}
+		while (count > 0 && (size_t) res >= iov->iov_len) {
+			res -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + res;
+			iov->iov_len -= res;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*! \brief Size of each registered staging buffer; larger batches are written directly */
+#define CEL_AMQP_URING_BUFFER (256 * 1024)
+
+/*! \brief io_uring of a file sink, used through raw system calls */
+struct cel_amqp_uring {
+	int fd;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/*! \brief registered staging buffers, filled alternately */
+	struct {
+		unsigned char *data;
+		size_t len;
+		off_t offset;
+		unsigned int events;
+		int busy;
+	} buf[2];
+	unsigned int next;
+	unsigned int inflight;
+};
+
+static void uring_free(struct cel_amqp_uring *uring)
+{
+	int i;
+
+	if (uring->sqes) {
+		munmap(uring->sqes, uring->sqes_size);
+	}
+	if (uring->cq_ring) {
+		munmap(uring->cq_ring, uring->cq_ring_size);
+	}
+	if (uring->sq_ring) {
+		munmap(uring->sq_ring, uring->sq_ring_size);
+	}
+	if (uring->fd >= 0) {
+		close(uring->fd);
+	}
+	for (i = 0; i < 2; ++i) {
+		ast_free(uring->buf[i].data);
+	}
+	ast_free(uring);
+}
+
+static void *uring_map(int fd, size_t size, off_t offset)
+{
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		fd, offset);
+
+	return map == MAP_FAILED ? NULL : map;
+}
+
+/*!
+ * \brief Set up an io_uring with two registered staging buffers.
+ *
+ * \return NULL when io_uring is not available, e.g. on older kernels or
+ * under a seccomp policy; writes then go through pwritev().
+ */
+static struct cel_amqp_uring *uring_setup(void)
+{
+	struct cel_amqp_uring *uring;
+	struct io_uring_params params = { 0, };
+	struct iovec iov[2];
+	int i;
+
+	uring = ast_calloc(1, sizeof(*uring));
+	if (!uring) {
+		return NULL;
+	}
+
+	uring->fd = syscall(__NR_io_uring_setup, 4, &params);
+	if (uring->fd < 0) {
+		ast_debug(1, "io_uring unavailable: %s\n", strerror(errno));
+		uring_free(uring);
+		return NULL;
+	}
+
+	uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	uring->cq_ring_size = params.cq_off.cqes
+		+ params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sq_ring = uring_map(uring->fd, uring->sq_ring_size, IORING_OFF_SQ_RING);
+	uring->cq_ring = uring_map(uring->fd, uring->cq_ring_size, IORING_OFF_CQ_RING);
+	uring->sqes = uring_map(uring->fd, uring->sqes_size, IORING_OFF_SQES);
+	if (!uring->sq_ring || !uring->cq_ring || !uring->sqes) {
+		uring_free(uring);
+		return NULL;
+	}
+
+	uring->sq_head = (unsigned int *) ((char *) uring->sq_ring + params.sq_off.head);
+	uring->sq_tail = (unsigned int *) ((char *) uring->sq_ring + params.sq_off.tail);
+	uring->sq_mask = (unsigned int *) ((char *) uring->sq_ring + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned int *) ((char *) uring->sq_ring + params.sq_off.array);
+	uring->cq_head = (unsigned int *) ((char *) uring->cq_ring + params.cq_off.head);
+	uring->cq_tail = (unsigned int *) ((char *) uring->cq_ring + params.cq_off.tail);
+	uring->cq_mask = (unsigned int *) ((char *) uring->cq_ring + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *) ((char *) uring->cq_ring + params.cq_off.cqes);
+
+	for (i = 0; i < 2; ++i) {
+		uring->buf[i].data = ast_malloc(CEL_AMQP_URING_BUFFER);
+		if (!uring->buf[i].data) {
+			uring_free(uring);
+			return NULL;
+		}
+		iov[i].iov_base = uring->buf[i].data;
+		iov[i].iov_len = CEL_AMQP_URING_BUFFER;
+	}
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS, iov, 2)) {
+		ast_debug(1, "io_uring buffers not registered: %s\n", strerror(errno));
+		uring_free(uring);
+		return NULL;
+	}
+
+	return uring;
+}
+
+/*!
+ * \brief Handle the completion of a staged write.
+ *
+ * A short write is finished, and a failed one retried, synchronously;
+ * writes carry their own offset, so this cannot reorder the file. The
+ * events only count as errors when the retry fails too.
+ */
+static void uring_complete(struct cel_amqp_sink *sink, unsigned int index, int res)
+{
+	struct cel_amqp_uring *uring = sink->file.uring;
+	struct iovec iov;
+
+	if (index >= 2 || !uring->buf[index].busy) {
+		return;
+	}
+	uring->buf[index].busy = 0;
+	--uring->inflight;
+
+	/* Finish a short write, or retry a failed one, synchronously */
+	if (res < 0 || (size_t) res < uring->buf[index].len) {
+		size_t written = res < 0 ? 0 : res;
+
+		iov.iov_base = uring->buf[index].data + written;
+		iov.iov_len = uring->buf[index].len - written;
+		res = writev_all(sink->file.fd, &iov, 1,
+			uring->buf[index].offset + written) ? -errno : 0;
+	}
+	if (res < 0) {
+		ast_log(LOG_ERROR, "Could not write to CEL file %s: %s\n",
+			sink->path, strerror(-res));
+		ast_atomic_fetchadd_int(&sink->errors, uring->buf[index].events);
+	}
+}
+
+/*!
+ * \brief Reap completed writes.
+ *
+ * \param wait whether to wait for at least one
+ */
+static int uring_reap(struct cel_amqp_sink *sink, int wait)
+{
+	struct cel_amqp_uring *uring = sink->file.uring;
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	unsigned int tail;
+
+	if (wait && syscall(__NR_io_uring_enter, uring->fd, 0, 1,
+			IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+		return -1;
+	}
+
+	head = *uring->cq_head;
+	tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		cqe = &uring->cqes[head & *uring->cq_mask];
+		uring_complete(sink, cqe->user_data, cqe->res);
+	}
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*! \brief Wait for all staged writes, before syncing or closing the file */
+static void uring_drain(struct cel_amqp_sink *sink)
+{
+	while (sink->file.uring && sink->file.uring->inflight) {
+		if (uring_reap(sink, 1)) {
+			ast_log(LOG_ERROR, "Could not wait for writes to CEL file %s: %s\n",
+				sink->path, strerror(errno));
+			break;
+		}
+	}
+}
+
+/*!
+ * \brief Stage a batch in a registered buffer and submit it.
+ *
+ * The submission does not wait for the write, so the batch after it is
+ * staged while the disk works. The writer thread only waits when both
+ * buffers are in flight.
+ *
+ * \return 0 if submitted, -1 to write the batch synchronously instead.
+ */
+static int uring_write(struct cel_amqp_sink *sink, const struct iovec *iov,
+	unsigned int iovcnt, size_t len, unsigned int events)
+{
+	struct cel_amqp_uring *uring = sink->file.uring;
+	unsigned int index = uring->next;
+	struct io_uring_sqe *sqe;
+	unsigned char *data;
+	unsigned int tail;
+	unsigned int i;
+
+	if (len > CEL_AMQP_URING_BUFFER) {
+		return -1;
+	}
+
+	uring_reap(sink, 0);
+	while (uring->buf[index].busy) {
+		if (uring_reap(sink, 1)) {
+			return -1;
+		}
+	}
+
+	data = uring->buf[index].data;
+	for (i = 0; i < iovcnt; ++i) {
+		memcpy(data, iov[i].iov_base, iov[i].iov_len);
+		data += iov[i].iov_len;
+	}
+	uring->buf[index].len = len;
+	uring->buf[index].offset = sink->file.size;
+	uring->buf[index].events = events;
+
+	tail = *uring->sq_tail;
+	sqe = &uring->sqes[tail & *uring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = sink->file.fd;
+	sqe->addr = (uintptr_t) uring->buf[index].data;
+	sqe->len = len;
+	sqe->off = sink->file.size;
+	sqe->buf_index = index;
+	sqe->user_data = index;
+	uring->sq_array[tail & *uring->sq_mask] = tail & *uring->sq_mask;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (syscall(__NR_io_uring_enter, uring->fd, 1, 0, 0, NULL, 0) != 1) {
+		/* Not consumed by the kernel; take it back */
+		if (__atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) == tail) {
+			__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+			return -1;
+		}
+	}
+	uring->buf[index].busy = 1;
+	++uring->inflight;
+	uring->next = !index;
+
+	return 0;
+}
+#endif
+
+static void file_close(struct cel_amqp_sink *sink)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	uring_drain(sink);
+#endif
+
+	if (sink->file.fd < 0) {
+		return;
+	}
+
+	if (sink->file.dirty) {
+		fdatasync(sink->file.fd);
+		sink->file.dirty = 0;
+	}
+	close(sink->file.fd);
+	sink->file.fd = -1;
+}
+
+static int file_open(struct cel_amqp_sink *sink)
+{
+	struct stat st;
+
+	if (sink->file.fd >= 0) {
+		return 0;
+	}
+
+	/* Not O_APPEND: every write carries its offset, so that writes in
+	 * flight together cannot land out of order */
+	sink->file.fd = open(sink->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0640);
+	if (sink->file.fd < 0) {
+		ast_log(LOG_ERROR, "Could not open CEL file %s: %s\n",
+			sink->path, strerror(errno));
+		return -1;
+	}
+
+	sink->file.size = fstat(sink->file.fd, &st) ? 0 : st.st_size;
+	sink->file.opened = ast_tvnow();
+	sink->file.synced = sink->file.opened;
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (!sink->file.uring && !sink->file.uring_unavailable) {
+		sink->file.uring = uring_setup();
+		sink->file.uring_unavailable = !sink->file.uring;
+	}
+#endif
+
+	return 0;
+}
+
+/*!
+ * \brief Rotate the file if it has grown too large or too old.
+ *
+ * The current file is renamed with the time of rotation appended, down to
+ * the us, and a new one is opened on next write. An earlier rotated file
+ * is never replaced: if the name is taken, a counter is appended too.
+ */
+static void file_rotate(struct cel_amqp_sink *sink)
+{
+	const struct cel_amqp_sink_conf *conf = &sink->active;
+	struct ast_tm tm;
+	struct timeval now = ast_tvnow();
+	char date[32];
+	char *rotated;
+	unsigned int i;
+	int res;
+	int error = EEXIST;
+
+	if (sink->file.fd < 0 || !sink->file.size) {
+		return;
+	}
+	if ((!conf->file_max_size
+			|| sink->file.size < (off_t) conf->file_max_size * 1024 * 1024)
+		&& (!conf->file_rotate_interval
+			|| ast_tvdiff_ms(now, sink->file.opened)
+				< (int64_t) conf->file_rotate_interval * 1000)) {
+		return;
+	}
+
+	file_close(sink);
+
+	ast_localtime(&now, &tm, NULL);
+	ast_strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm);
+	for (i = 0; i < 1000; ++i) {
+		if (!i) {
+			res = ast_asprintf(&rotated, "%s.%s.%06ld", sink->path, date,
+				(long) now.tv_usec);
+		} else {
+			res = ast_asprintf(&rotated, "%s.%s.%06ld.%u", sink->path, date,
+				(long) now.tv_usec, i);
+		}
+		if (res < 0) {
+			return;
+		}
+		/* Unlike rename(), link() does not replace an existing file */
+		res = link(sink->path, rotated);
+		error = errno;
+		ast_free(rotated);
+		if (!res || error != EEXIST) {
+			break;
+		}
+	}
+	if (res) {
+		/* Carry on appending to the current file */
+		ast_log(LOG_WARNING, "Could not rotate CEL file %s: %s\n",
+			sink->path, strerror(error));
+		return;
+	}
+	if (unlink(sink->path)) {
+		ast_log(LOG_WARNING, "Could not remove rotated CEL file %s: %s\n",
+			sink->path, strerror(errno));
+	}
+}
+
+static int file_write(struct cel_amqp_sink *sink, struct cel_amqp_body **bodies,
+	unsigned int count)
+{
+	struct iovec iov[2 * CEL_AMQP_SINK_BATCH];
+	unsigned int i;
+	size_t len = 0;
+
+	file_rotate(sink);
+	if (file_open(sink)) {
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		iov[2 * i].iov_base = bodies[i]->json;
+		iov[2 * i].iov_len = strlen(bodies[i]->json);
+		iov[2 * i + 1].iov_base = "\n";
+		iov[2 * i + 1].iov_len = 1;
+		len += iov[2 * i].iov_len + 1;
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (sink->file.uring && !uring_write(sink, iov, 2 * count, len, count)) {
+		sink->file.size += len;
+		sink->file.dirty = 1;
+		return count;
+	}
+#endif
+
+	if (writev_all(sink->file.fd, iov, 2 * count, sink->file.size)) {
+		ast_log(LOG_ERROR, "Could not write to CEL file %s: %s\n",
+			sink->path, strerror(errno));
+		file_close(sink);
+		return -1;
+	}
+	sink->file.size += len;
+	sink->file.dirty = 1;
+
+	return count;
+}
+
+/*!
+ * \brief Group commit: fsync at most once per file_fsync_interval.
+ *
+ * \return ms until the next fsync is due, or -1 if none is.
+ */
+static int file_tick(struct cel_amqp_sink *sink)
+{
+	int64_t due;
+
+	if (!sink->file.dirty) {
+		return -1;
+	}
+
+	due = (int64_t) sink->active.file_fsync_interval
+		- ast_tvdiff_ms(ast_tvnow(), sink->file.synced);
+	if (due > 0) {
+		return due;
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	uring_drain(sink);
+#endif
+	if (fdatasync(sink->file.fd)) {
+		ast_log(LOG_WARNING, "Could not sync CEL file %s: %s\n",
+			sink->path, strerror(errno));
+	}
+	sink->file.dirty = 0;
+	sink->file.synced = ast_tvnow();
+
+	return -1;
+}
+
+static void file_init(struct cel_amqp_sink *sink)
+{
+	sink->file.fd = -1;
+}
+
+static void file_stop(struct cel_amqp_sink *sink)
+{
+	file_close(sink);
+#ifdef HAVE_LINUX_IO_URING_H
+	if (sink->file.uring) {
+		uring_free(sink->file.uring);
+		sink->file.uring = NULL;
+	}
+#endif
+}
+
+static void shm_close(struct cel_amqp_sink *sink)
+{
+	if (sink->shm.header) {
+		munmap(sink->shm.header, sink->shm.map_size);
+		sink->shm.header = NULL;
+	}
+	if (sink->shm.fd >= 0) {
+		close(sink->shm.fd);
+		sink->shm.fd = -1;
+	}
+}
+
+/*!
+ * \brief Map the ring, creating or recreating the file if needed.
+ *
+ * A file left by an earlier run with the same layout and capacity is kept
+ * as is, so a consumer reading it can carry on where it was.
+ */
+static int shm_open_ring(struct cel_amqp_sink *sink)
+{
+	struct cel_amqp_shm_header *header;
+	struct stat st;
+	uint64_t capacity = 1;
+	size_t size;
+	int create = 0;
+
+	if (sink->shm.header) {
+		return 0;
+	}
+
+	while (capacity < (uint64_t) MAX(sink->active.shm_size, 1U) * 1024 * 1024) {
+		capacity <<= 1;
+	}
+	size = CEL_AMQP_SHM_DATA_OFFSET + capacity;
+
+	sink->shm.fd = open(sink->path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+	if (sink->shm.fd >= 0 && !fstat(sink->shm.fd, &st) && st.st_size != (off_t) size) {
+		/* Never resize a file a consumer may have mapped; replace it */
+		close(sink->shm.fd);
+		unlink(sink->path);
+		sink->shm.fd = open(sink->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+		create = 1;
+	}
+	if (sink->shm.fd < 0 || (create && ftruncate(sink->shm.fd, size))) {
+		ast_log(LOG_ERROR, "Could not create CEL ring %s: %s\n",
+			sink->path, strerror(errno));
+		shm_close(sink);
+		return -1;
+	}
+
+	header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sink->shm.fd, 0);
+	if (header == MAP_FAILED) {
+		ast_log(LOG_ERROR, "Could not map CEL ring %s: %s\n",
+			sink->path, strerror(errno));
+		shm_close(sink);
+		return -1;
+	}
+	sink->shm.header = header;
+	sink->shm.map_size = size;
+	sink->shm.data = (unsigned char *) header + CEL_AMQP_SHM_DATA_OFFSET;
+
+	if (header->magic != CEL_AMQP_SHM_MAGIC
+		|| header->version != CEL_AMQP_SHM_VERSION
+		|| header->capacity != capacity
+		|| header->data_offset != CEL_AMQP_SHM_DATA_OFFSET) {
+		memset(header, 0, sizeof(*header));
+		header->version = CEL_AMQP_SHM_VERSION;
+		header->capacity = capacity;
+		header->data_offset = CEL_AMQP_SHM_DATA_OFFSET;
+		/* Consumers wait for the magic before trusting the rest */
+		__atomic_store_n(&header->magic, CEL_AMQP_SHM_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/*! \brief Wake the consumer if it sleeps on the ring's futex word */
+static void shm_notify(struct cel_amqp_shm_header *header)
+{
+	__atomic_add_fetch(&header->futex, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+#ifdef __linux__
+	syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/*!
+ * \brief Copy a batch of events into the ring.
+ *
+ * The sink's writer thread is the only producer. Events that do not fit
+ * in the space the consumer has freed are dropped, never waited for.
+ */
+static int shm_write(struct cel_amqp_sink *sink, struct cel_amqp_body **bodies,
+	unsigned int count)
+{
+	struct cel_amqp_shm_header *header;
+	uint64_t mask;
+	uint64_t head;
+	uint64_t tail;
+	unsigned int written = 0;
+	unsigned int i;
+
+	if (shm_open_ring(sink)) {
+		return -1;
+	}
+	header = sink->shm.header;
+	mask = header->capacity - 1;
+	head = header->head;
+	tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < count; ++i) {
+		struct cel_amqp_shm_record *record;
+		size_t len = strlen(bodies[i]->json);
+		uint64_t need = CEL_AMQP_SHM_ALIGN(sizeof(*record) + len);
+		uint64_t pad = header->capacity - (head & mask);
+
+		/* Records never wrap; the rest of the ring is skipped instead */
+		if (pad >= need) {
+			pad = 0;
+		}
+		if (header->capacity - (head - tail) < pad + need) {
+			tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+			if (header->capacity - (head - tail) < pad + need) {
+				ast_atomic_fetch_add(&header->dropped, 1, __ATOMIC_RELAXED);
+				continue;
+			}
+		}
+		if (pad) {
+			record = (struct cel_amqp_shm_record *) (sink->shm.data + (head & mask));
+			record->length = pad - sizeof(*record);
+			record->type = CEL_AMQP_SHM_PADDING;
+			head += pad;
+		}
+		record = (struct cel_amqp_shm_record *) (sink->shm.data + (head & mask));
+		record->length = len;
+		record->type = CEL_AMQP_SHM_JSON;
+		memcpy(record->data, bodies[i]->json, len);
+		head += need;
+		++written;
+	}
+
+	if (written) {
+		__atomic_store_n(&header->head, head, __ATOMIC_RELEASE);
+		shm_notify(header);
+	}
+
+	return written;
+}
+
+static void shm_init(struct cel_amqp_sink *sink)
+{
+	sink->shm.fd = -1;
+}
+
+static void unix_close(struct cel_amqp_sink *sink)
+{
+	if (sink->sock.fd >= 0) {
+		close(sink->sock.fd);
+		sink->sock.fd = -1;
+	}
+}
+
+/*! \brief Close the socket and back off before connecting again */
+static void unix_fail(struct cel_amqp_sink *sink)
+{
+	unix_close(sink);
+	sink->sock.retry = ast_tvadd(ast_tvnow(),
+		ast_samp2tv(1 << MIN(sink->sock.failures, 5U), 1));
+	++sink->sock.failures;
+}
+
+/*!
+ * \brief Connect to the collector, unless a retry is not due yet.
+ *
+ * Retries back off from 1 to 32 seconds; events are dropped meanwhile.
+ * Connecting and sending give up after CEL_AMQP_SOCK_TIMEOUT, so that a
+ * collector which stops reading cannot hold up the writer thread, and with
+ * it unload or a reload that drops the sink.
+ */
+static int unix_connect(struct cel_amqp_sink *sink)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX, };
+	struct timeval timeout = ast_samp2tv(CEL_AMQP_SOCK_TIMEOUT, 1000);
+	struct timeval now;
+
+	if (sink->sock.fd >= 0) {
+		return 0;
+	}
+
+	now = ast_tvnow();
+	if (sink->sock.failures && ast_tvcmp(now, sink->sock.retry) < 0) {
+		return -1;
+	}
+
+	if (strlen(sink->path) >= sizeof(addr.sun_path)) {
+		ast_log(LOG_ERROR, "CEL socket path %s is too long\n", sink->path);
+		return -1;
+	}
+	strcpy(addr.sun_path, sink->path);
+
+	sink->sock.fd = socket(AF_UNIX, sink->sock.type | SOCK_CLOEXEC, 0);
+	if (sink->sock.fd < 0
+		|| setsockopt(sink->sock.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))
+		|| connect(sink->sock.fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		if (!sink->sock.failures) {
+			ast_log(LOG_WARNING, "Could not connect to CEL socket %s: %s\n",
+				sink->path, strerror(errno));
+		}
+		unix_fail(sink);
+		return -1;
+	}
+
+	if (sink->sock.failures) {
+		ast_log(LOG_NOTICE, "Connected to CEL socket %s after %u attempts\n",
+			sink->path, sink->sock.failures + 1);
+		sink->sock.failures = 0;
+	}
+
+	return 0;
+}
+
+/*! \brief Send a batch as one datagram per event */
+static int unix_send_datagrams(struct cel_amqp_sink *sink,
+	struct cel_amqp_body **bodies, unsigned int count)
+{
+	struct mmsghdr msgs[CEL_AMQP_SINK_BATCH];
+	struct iovec iov[CEL_AMQP_SINK_BATCH];
+	unsigned int sent = 0;
+	unsigned int written = 0;
+	unsigned int i;
+	int res;
+
+	memset(msgs, 0, sizeof(msgs[0]) * count);
+	for (i = 0; i < count; ++i) {
+		iov[i].iov_base = bodies[i]->json;
+		iov[i].iov_len = strlen(bodies[i]->json);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < count) {
+		res = sendmmsg(sink->sock.fd, msgs + sent, count - sent, 0);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EMSGSIZE) {
+				/* Too large for a datagram; only this one is lost */
+				++sent;
+				continue;
+			}
+			ast_log(LOG_WARNING, "Could not send to CEL socket %s: %s\n",
+				sink->path, strerror(errno));
+			unix_fail(sink);
+			break;
+		}
+		sent += res;
+		written += res;
+	}
+
+	return written;
+}
+
+static int unix_write(struct cel_amqp_sink *sink, struct cel_amqp_body **bodies,
+	unsigned int count)
+{
+	struct iovec iov[2 * CEL_AMQP_SINK_BATCH];
+	unsigned int i;
+
+	if (unix_connect(sink)) {
+		return -1;
+	}
+
+	if (sink->sock.type == SOCK_DGRAM) {
+		return unix_send_datagrams(sink, bodies, count);
+	}
+
+	/* Stream sockets get the same newline delimited records as files */
+	for (i = 0; i < count; ++i) {
+		iov[2 * i].iov_base = bodies[i]->json;
+		iov[2 * i].iov_len = strlen(bodies[i]->json);
+		iov[2 * i + 1].iov_base = "\n";
+		iov[2 * i + 1].iov_len = 1;
+	}
+	if (writev_all(sink->sock.fd, iov, 2 * count, -1)) {
+		/* A timeout may have cut a record short; a new connection starts
+		 * clean */
+		ast_log(LOG_WARNING, "Could not write to CEL socket %s: %s\n",
+			sink->path, strerror(errno));
+		unix_fail(sink);
+		return -1;
+	}
+
+	return count;
+}
+
+static void unix_init(struct cel_amqp_sink *sink)
+{
+	sink->sock.fd = -1;
+	sink->sock.type = strncmp(sink->name, "unixgram:", 9) ? SOCK_STREAM : SOCK_DGRAM;
+}
+
+static const struct cel_amqp_sink_ops sink_types[] = {
+	{
+		.prefix = "file:",
+		.init = file_init,
+		.write = file_write,
+		.tick = file_tick,
+		.close = file_stop,
+	},
+	{
+		.prefix = "shm:",
+		.init = shm_init,
+		.write = shm_write,
+		.close = shm_close,
+	},
+	{
+		.prefix = "unix:",
+		.init = unix_init,
+		.write = unix_write,
+		.close = unix_close,
+	},
+	{
+		.prefix = "unixgram:",
+		.init = unix_init,
+		.write = unix_write,
+		.close = unix_close,
+	},
+};
+
+/*!
+ * \brief Writer thread of a sink.
+ *
+ * Takes the queued records a batch at a time, so that a slow write only
+ * delays the sink, never the CEL thread.
+ */
+static void *sink_thread(void *data)
+{
+	struct cel_amqp_sink *sink = data;
+	struct cel_amqp_body *batch[CEL_AMQP_SINK_BATCH];
+	unsigned int count;
+	unsigned int i;
+	int written;
+	int timeout = -1;
+
+	ast_mutex_lock(&sink->lock);
+	for (;;) {
+		if (!sink->queued) {
+			if (sink->stop) {
+				break;
+			}
+			if (timeout < 0) {
+				ast_cond_wait(&sink->cond, &sink->lock);
+			} else {
+				struct timeval wait = ast_tvadd(ast_tvnow(),
+					ast_samp2tv(timeout, 1000));
+				struct timespec ts = {
+					.tv_sec = wait.tv_sec,
+					.tv_nsec = wait.tv_usec * 1000,
+				};
+
+				ast_cond_timedwait(&sink->cond, &sink->lock, &ts);
+			}
+		}
+
+		sink->active = sink->conf;
+		for (count = 0; count < CEL_AMQP_SINK_BATCH && sink->queued; ++count) {
+			batch[count] = sink->ring[sink->head];
+			sink->head = (sink->head + 1) % sink->size;
+			--sink->queued;
+		}
+		ast_mutex_unlock(&sink->lock);
+
+		written = 0;
+		if (count) {
+			CEL_AMQP_PROBE3(publish__start, sink->name, 0, count);
+			written = sink->ops->write(sink, batch, count);
+			CEL_AMQP_PROBE3(publish__end, sink->name, written < 0 ? -1 : 0, count);
+		}
+		if (written < 0) {
+			ast_atomic_fetchadd_int(&sink->errors, count);
+		} else {
+			ast_atomic_fetchadd_int(&sink->written, written);
+			ast_atomic_fetchadd_int(&sink->dropped, count - written);
+		}
+		/* Which events a partial write dropped is unknown; skip those batches */
+		if (count && written == (int) count) {
+			int64_t now_us = tv_us(ast_tvnow());
+
+			for (i = 0; i < count; ++i) {
+				lag_record(CEL_AMQP_LAG_PUBLISH, batch[i]->event_time, now_us);
+			}
+		}
+		for (i = 0; i < count; ++i) {
+			ao2_ref(batch[i], -1);
+		}
+		timeout = sink->ops->tick ? sink->ops->tick(sink) : -1;
+
+		ast_mutex_lock(&sink->lock);
+	}
+	ast_mutex_unlock(&sink->lock);
+
+	sink->ops->close(sink);
+
+	return NULL;
+}
+
+/*!
+ * \brief Queue a record for a sink's writer thread.
+ *
+ * When the sink's queue is full the record is dropped.
+ */
+static void sink_enqueue(struct cel_amqp_sink *sink, struct cel_amqp_body *body)
+{
+	int signal;
+
+	ast_mutex_lock(&sink->lock);
+	if (sink->stop || sink->queued == sink->size) {
+		ast_mutex_unlock(&sink->lock);
+		ast_atomic_fetchadd_int(&sink->dropped, 1);
+		CEL_AMQP_PROBE2(dropped, "sink_full", 1);
+		return;
+	}
+	sink->ring[(sink->head + sink->queued) % sink->size] = ao2_bump(body);
+	signal = !sink->queued++;
+	ast_mutex_unlock(&sink->lock);
+
+	if (signal) {
+		ast_cond_signal(&sink->cond);
+	}
+}
+
+static void sink_stop(struct cel_amqp_sink *sink)
+{
+	if (sink->thread == AST_PTHREADT_NULL) {
+		return;
+	}
+
+	ast_mutex_lock(&sink->lock);
+	sink->stop = 1;
+	ast_cond_signal(&sink->cond);
+	ast_mutex_unlock(&sink->lock);
+
+	pthread_join(sink->thread, NULL);
+	sink->thread = AST_PTHREADT_NULL;
+}
+
+static void sink_dtor(void *obj)
+{
+	struct cel_amqp_sink *sink = obj;
+
+	ast_assert(sink->thread == AST_PTHREADT_NULL);
+
+	while (sink->queued) {
+		ao2_ref(sink->ring[sink->head], -1);
+		sink->head = (sink->head + 1) % sink->size;
+		--sink->queued;
+	}
+	ast_free(sink->ring);
+	ast_cond_destroy(&sink->cond);
+	ast_mutex_destroy(&sink->lock);
+}
+
+/*!
+ * \brief Resize a sink's queue.
+ *
+ * \note Must be called with the sink's lock held.
+ */
+static int sink_resize(struct cel_amqp_sink *sink, unsigned int size)
+{
+	struct cel_amqp_body **ring;
+	unsigned int i;
+
+	size = MAX(size, 1U);
+	if (size == sink->size || size < sink->queued) {
+		return 0;
+	}
+
+	ring = ast_calloc(size, sizeof(*ring));
+	if (!ring) {
+		return -1;
+	}
+	for (i = 0; i < sink->queued; ++i) {
+		ring[i] = sink->ring[(sink->head + i) % sink->size];
+	}
+	ast_free(sink->ring);
+	sink->ring = ring;
+	sink->head = 0;
+	sink->size = size;
+
+	return 0;
+}
+
+/*! \brief Type of a local sink option; NULL if unknown */
+static const struct cel_amqp_sink_ops *sink_ops_find(const char *sink)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LEN(sink_types); ++i) {
+		if (!strncmp(sink, sink_types[i].prefix, strlen(sink_types[i].prefix))) {
+			return &sink_types[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Get the sink for a destination, creating it if needed.
+ *
+ * Sinks outlive configurations, so that a reload does not reopen them;
+ * a running sink just takes the destination's current settings.
+ *
+ * \param profile Destination with a local sink of a known type.
+ */
+static struct cel_amqp_sink *sink_get(struct cel_amqp_profile *profile)
+{
+	const struct cel_amqp_sink_ops *ops = sink_ops_find(profile->sink);
+	struct cel_amqp_sink *sink;
+	size_t len;
+
+	ao2_lock(sinks);
+	sink = ao2_find(sinks, profile->sink, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (sink) {
+		ao2_unlock(sinks);
+		ast_mutex_lock(&sink->lock);
+		sink->conf = profile->sink_conf;
+		sink_resize(sink, profile->sink_conf.queue_size);
+		ast_mutex_unlock(&sink->lock);
+		return sink;
+	}
+
+	len = strlen(profile->sink) + 1;
+	sink = ao2_alloc_options(sizeof(*sink) + len, sink_dtor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!sink) {
+		ao2_unlock(sinks);
+		return NULL;
+	}
+	ast_mutex_init(&sink->lock);
+	ast_cond_init(&sink->cond, NULL);
+	sink->thread = AST_PTHREADT_NULL;
+	sink->ops = ops;
+	sink->conf = profile->sink_conf;
+	memcpy(sink->name, profile->sink, len);
+	sink->path = sink->name + strlen(ops->prefix);
+	ops->init(sink);
+
+	if (sink_resize(sink, profile->sink_conf.queue_size)
+		|| ast_pthread_create_background(&sink->thread, NULL, sink_thread, sink)) {
+		ast_log(LOG_ERROR, "Failed to start CEL sink %s\n", sink->name);
+		sink->thread = AST_PTHREADT_NULL;
+		ao2_unlock(sinks);
+		ao2_ref(sink, -1);
+		return NULL;
+	}
+	ao2_link_flags(sinks, sink, OBJ_NOLOCK);
+	ao2_unlock(sinks);
+
+	return sink;
+}
+
+static int sink_unused_cb(void *obj, void *arg, int flags)
+{
+	struct cel_amqp_sink *sink = obj;
+	struct cel_amqp_conf *conf = arg;
+	unsigned int i;
+
+	for (i = 0; conf && i < conf->num_outputs; ++i) {
+		if (conf->outputs[i]->local == sink) {
+			return 0;
+		}
+	}
+
+	return CMP_MATCH;
+}
+
+/*!
+ * \brief Stop the sinks no destination of the current configuration uses.
+ *
+ * Records still queued are written first. Events handled under an older
+ * configuration while this happens are dropped.
+ */
+static void sinks_sweep(void)
+{
+	RAII_VAR(struct cel_amqp_conf *, conf, ao2_global_obj_ref(confs), ao2_cleanup);
+	struct ao2_iterator *unused;
+	struct cel_amqp_sink *sink;
+
+	unused = ao2_callback(sinks, OBJ_MULTIPLE | OBJ_UNLINK, sink_unused_cb, conf);
+	if (!unused) {
+		return;
+	}
+	while ((sink = ao2_iterator_next(unused))) {
+		sink_stop(sink);
+		ao2_ref(sink, -1);
+	}
+	ao2_iterator_destroy(unused);
+}
+
+static int setup_amqp(void);
+static void conf_applied(void);
+
+CONFIG_INFO_STANDARD(cfg_info, confs, conf_alloc,
+	.files = ACO_FILES(&conf_file),
+	.pre_apply_config = setup_amqp,
+	.post_apply_config = conf_applied,
+);
+
+/*! \brief Invalidate the configuration cached by every thread */
+static void conf_applied(void)
+{
+	ast_atomic_fetchadd_int(&conf_generation, +1);
+	sinks_sweep();
+}
+
+/*!
+ * \brief Get the current configuration on a hot path.
+ *
+ * ao2_global_obj_ref() takes the global object's lock and bumps a shared
+ * reference count on every call. Instead, each thread keeps its own
+ * reference and only refreshes it when conf_generation changes, so the
+ * common case is a single load and compare.
+ *
+ * \note The returned reference is borrowed. It stays valid until the
+ * calling thread calls this function again.
+ *
+ * \return current configuration, or NULL if there is none.
+ */
+static struct cel_amqp_conf *conf_snapshot(void)
+{
+	struct conf_cache **slot;
+	struct conf_cache *cache;
+	int generation = __atomic_load_n(&conf_generation, __ATOMIC_ACQUIRE);
+
+	slot = ast_threadstorage_get(&conf_cache_slot, sizeof(*slot));
+	if (!slot) {
+		return NULL;
+	}
+
+	cache = *slot;
+	if (cache && cache->generation == generation) {
+		return cache->conf;
+	}
+
+	if (!cache) {
+		cache = ast_calloc(1, sizeof(*cache));
+		if (!cache) {
+			return NULL;
+		}
+		cache->slot = slot;
+		AST_LIST_LOCK(&conf_caches);
+		AST_LIST_INSERT_TAIL(&conf_caches, cache, list);
+		*slot = cache;
+		AST_LIST_UNLOCK(&conf_caches);
+	}
+
+	AST_LIST_LOCK(&conf_caches);
+	ao2_cleanup(cache->conf);
+	cache->conf = ao2_global_obj_ref(confs);
+	cache->generation = generation;
+	AST_LIST_UNLOCK(&conf_caches);
+
+	return cache->conf;
+}
+
+/*!
+ * \brief Thread storage destructor of conf_cache_slot.
+ *
+ * Unlinks and frees the exiting thread's entry, unless unload already did.
+ */
+static void conf_cache_slot_free(void *data)
+{
+	struct conf_cache **slot = data;
+	struct conf_cache *cache;
+
+	AST_LIST_LOCK(&conf_caches);
+	cache = *slot;
+	if (cache) {
+		AST_LIST_REMOVE(&conf_caches, cache, list);
+	}
+	AST_LIST_UNLOCK(&conf_caches);
+
+	if (cache) {
+		ao2_cleanup(cache->conf);
+		ast_free(cache);
+	}
+	ast_free(slot);
+}
+
+/*!
+ * \brief Free the entries and slots of all threads, and the references
+ * they hold.
+ *
+ * Core threads outlive the module, so its thread storage key is deleted
+ * first: a thread exiting later must not call conf_cache_slot_free() once
+ * the module is unmapped. A load creates a new key.
+ */
+static void conf_caches_release(void)
+{
+	struct conf_cache *cache;
+
+	/* Never delete a key that was not created; it may be someone else's */
+	pthread_once(&conf_cache_slot.once, conf_cache_slot.key_init);
+	pthread_key_delete(conf_cache_slot.key);
+
+	AST_LIST_LOCK(&conf_caches);
+	while ((cache = AST_LIST_REMOVE_HEAD(&conf_caches, list))) {
+		ao2_cleanup(cache->conf);
+		ast_free(cache->slot);
+		ast_free(cache);
+	}
+	AST_LIST_UNLOCK(&conf_caches);
+}
+
+static int ratelimit_init_cb(void *obj, void *arg, int flags)
+{
+	struct cel_amqp_ratelimit_conf *ratelimit = obj;
+
+	bucket_init(&ratelimit->bucket, ratelimit->rate, ratelimit->burst);
+
+	return 0;
+}
+
+static int ratelimit_match_cb(void *obj, void *arg, int flags)
+{
+	struct cel_amqp_ratelimit_conf *ratelimit = obj;
+	struct cel_amqp_profile *profile = arg;
+
+	return !strcmp(ratelimit->exchange, profile->exchange)
+		&& !strcmp(ratelimit->routing_key, profile->queue) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+static int output_add_cb(void *obj, void *arg, int flags)
+{
+	struct cel_amqp_profile *profile = obj;
+	struct cel_amqp_conf *conf = arg;
+
+	if (conf->num_outputs == CEL_AMQP_MAX_PROFILES) {
+		ast_log(LOG_ERROR, "More than %d destinations; ignoring profile %s\n",
+			CEL_AMQP_MAX_PROFILES, profile->name);
+		return 0;
+	}
+	conf->outputs[conf->num_outputs++] = ao2_bump(profile);
+
+	return 0;
+}
+
+static struct cel_amqp_tenant_slot *tenant_slot(const struct cel_amqp_conf *conf,
+	enum cel_amqp_tenant_key kind, const char *key, size_t len, uint64_t hash)
+{
+	struct cel_amqp_tenant_slot *slot;
+	size_t i = hash & conf->tenant_mask;
+
+	for (;; i = (i + 1) & conf->tenant_mask) {
+		slot = &conf->tenant_table[i];
+		if (!slot->key || (slot->hash == hash && slot->kind == kind
+				&& slot->len == len && !memcmp(slot->key, key, len))) {
+			return slot;
+		}
+	}
+}
+
+/*!
+ * \brief Find the tenant destination of an event.
+ *
+ * An exact account code match wins over a context prefix, and a longer
+ * prefix over a shorter one. Nothing is allocated.
+ *
+ * \return destination, or NULL if the event belongs to no tenant.
+ */
+static struct cel_amqp_profile *tenant_lookup(const struct cel_amqp_conf *conf,
+	const struct ast_cel_event_record *record)
+{
+	const char *key = record->account_code;
+	size_t len;
+	unsigned int i;
+
+	if (!conf->num_tenants) {
+		return NULL;
+	}
+
+	len = strlen(key);
+	if (len) {
+		struct cel_amqp_tenant_slot *slot = tenant_slot(conf,
+			CEL_AMQP_TENANT_KEY_ACCOUNT_CODE, key, len,
+			xxh64(key, len, CEL_AMQP_TENANT_KEY_ACCOUNT_CODE));
+
+		if (slot->key) {
+			return slot->output;
+		}
+	}
+
+	key = record->context;
+	len = strlen(key);
+	for (i = 0; i < conf->num_tenant_prefix_lens; ++i) {
+		size_t prefix = conf->tenant_prefix_lens[i];
+		struct cel_amqp_tenant_slot *slot;
+
+		if (prefix > len) {
+			continue;
+		}
+		slot = tenant_slot(conf, CEL_AMQP_TENANT_KEY_CONTEXT, key, prefix,
+			xxh64(key, prefix, CEL_AMQP_TENANT_KEY_CONTEXT));
+		if (slot->key) {
+			return slot->output;
+		}
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Compile [tenants] into an open addressing table.
+ *
+ * The table is kept at most half full, so lookups from amqp_cel_log()
+ * take a probe or two.
+ */
+static int setup_tenants(struct cel_amqp_conf *conf)
+{
+	struct ast_variable *mapping;
+	struct cel_amqp_tenant_slot *slot;
+	struct cel_amqp_profile *output;
+	size_t size = 8;
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (mapping = conf->tenants->mappings; mapping; mapping = mapping->next) {
+		++count;
+	}
+	if (!count) {
+		return 0;
+	}
+	while (size < 2 * count) {
+		size <<= 1;
+	}
+
+	conf->tenant_table = ast_calloc(size, sizeof(*conf->tenant_table));
+	conf->tenant_prefix_lens = ast_calloc(count, sizeof(*conf->tenant_prefix_lens));
+	if (!conf->tenant_table || !conf->tenant_prefix_lens) {
+		return -1;
+	}
+	conf->tenant_mask = size - 1;
+
+	for (mapping = conf->tenants->mappings; mapping; mapping = mapping->next) {
+		enum cel_amqp_tenant_key kind = CEL_AMQP_TENANT_KEY_ACCOUNT_CODE;
+		const char *key = mapping->name;
+		size_t len;
+
+		if (!strncmp(key, CEL_AMQP_TENANT_CONTEXT, strlen(CEL_AMQP_TENANT_CONTEXT))) {
+			kind = CEL_AMQP_TENANT_KEY_CONTEXT;
+			key += strlen(CEL_AMQP_TENANT_CONTEXT);
+		}
+		len = strlen(key);
+		if (!len) {
+			ast_log(LOG_ERROR, "Empty tenant key in [tenants]\n");
+			return -1;
+		}
+
+		output = NULL;
+		for (i = 0; i < conf->num_outputs; ++i) {
+			if (!strcmp(conf->outputs[i]->name, mapping->value)) {
+				output = conf->outputs[i];
+				break;
+			}
+		}
+		if (!output) {
+			ast_log(LOG_ERROR, "Tenant %s maps to unknown destination %s\n",
+				mapping->name, mapping->value);
+			return -1;
+		}
+		output->tenant = 1;
+
+		slot = tenant_slot(conf, kind, key, len, xxh64(key, len, kind));
+		if (slot->key) {
+			ast_log(LOG_WARNING, "Tenant %s is mapped more than once; "
+				"keeping the first\n", mapping->name);
+			continue;
+		}
+		slot->hash = xxh64(key, len, kind);
+		slot->key = key;
+		slot->len = len;
+		slot->kind = kind;
+		slot->output = output;
+		++conf->num_tenants;
+
+		if (kind == CEL_AMQP_TENANT_KEY_CONTEXT) {
+			i = 0;
+			while (i < conf->num_tenant_prefix_lens && conf->tenant_prefix_lens[i] > len) {
+				++i;
+			}
+			if (i == conf->num_tenant_prefix_lens || conf->tenant_prefix_lens[i] != len) {
+				memmove(&conf->tenant_prefix_lens[i + 1], &conf->tenant_prefix_lens[i],
+					(conf->num_tenant_prefix_lens - i) * sizeof(*conf->tenant_prefix_lens));
+				conf->tenant_prefix_lens[i] = len;
+				++conf->num_tenant_prefix_lens;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Compile the destinations of a configuration.
+ *
+ * [global] is turned into a profile of its own, so that events are
+ * dispatched the same way to all destinations, and the profiles are
+ * indexed by the event types they publish.
+ */
+static int setup_outputs(struct cel_amqp_conf *conf, struct cel_amqp_conf *old)
+{
+	struct cel_amqp_profile *profile;
+	unsigned int i;
+	unsigned int j;
+	int type;
+
+	if (!ast_strlen_zero(conf->global->connection)
+		|| sink_is_local(conf->global->sink)) {
+		profile = profile_alloc("global");
+		if (!profile) {
+			return -1;
+		}
+		ast_string_field_set(profile, connection, conf->global->connection);
+		ast_string_field_set(profile, queue, conf->global->queue);
+		ast_string_field_set(profile, exchange, conf->global->exchange);
+		ast_string_field_set(profile, sink, conf->global->sink);
+		profile->format = conf->global->format;
+		profile->sample_rate = conf->global->sample_rate;
+		profile->sink_conf = conf->global->sink_conf;
+		conf->outputs[conf->num_outputs++] = profile;
+	}
+	ao2_callback(conf->profiles, OBJ_NODATA, output_add_cb, conf);
+
+	if (setup_tenants(conf)) {
+		return -1;
+	}
+
+	if (!conf->num_outputs) {
+		ast_log(LOG_WARNING, "No connection in [global] and no profiles; "
+			"CEL events will not be published\n");
+	}
+
+	for (i = 0; i < conf->num_outputs; ++i) {
+		profile = conf->outputs[i];
+
+		if (profile->sample_rate < 0 || profile->sample_rate > 1) {
+			ast_log(LOG_ERROR, "sample_rate of %s must be between 0 and 1\n",
+				profile->name);
+			return -1;
+		}
+		/* Its events would stay queued forever */
+		if (ast_strlen_zero(profile->connection) && !sink_is_local(profile->sink)) {
+			ast_log(LOG_ERROR, "%s needs either a connection or a local sink\n",
+				profile->name);
+			return -1;
+		}
+
+		/* Scaled by 2^64; below 1, the product fits */
+		profile->sample_threshold = profile->sample_rate >= 1 ? UINT64_MAX
+			: (uint64_t) (profile->sample_rate * 18446744073709551616.0);
+
+		if (sink_is_local(profile->sink)) {
+			if (!sink_ops_find(profile->sink)) {
+				ast_log(LOG_ERROR, "Unknown sink '%s' for %s\n", profile->sink,
+					profile->name);
+				return -1;
+			}
+			if (profile->format != CEL_AMQP_FORMAT_JSON) {
+				ast_log(LOG_ERROR, "Sink %s of %s only takes the json format\n",
+					profile->sink, profile->name);
+				return -1;
+			}
+		}
+
+		ao2_cleanup(profile->ratelimit);
+		profile->ratelimit = ao2_callback(conf->ratelimits, 0,
+			ratelimit_match_cb, profile);
+
+		/* Connecting may block on an unreachable broker, so it is left to
+		 * the publisher thread. An established connection is carried over
+		 * though, so a reload does not reconnect, and so is a tripped
+		 * breaker, so a reload does not hammer a failing broker. */
+		ao2_cleanup(profile->amqp);
+		profile->amqp = NULL;
+		for (j = 0; old && j < old->num_outputs; ++j) {
+			if (!strcmp(old->outputs[j]->name, profile->name)
+				&& !strcmp(old->outputs[j]->connection, profile->connection)) {
+				ast_mutex_lock(&publisher.lock);
+				profile->amqp = ao2_bump(old->outputs[j]->amqp);
+				if (old->outputs[j]->breaker != CEL_AMQP_BREAKER_CLOSED) {
+					profile->breaker = CEL_AMQP_BREAKER_OPEN;
+					profile->breaker_opened = old->outputs[j]->breaker_opened;
+				}
+				ast_mutex_unlock(&publisher.lock);
+				break;
+			}
+		}
+
+		for (type = 0; type < CEL_AMQP_MAX_EVENT_TYPES && !profile->tenant; ++type) {
+			if (profile->events & ((uint64_t) 1 << type)) {
+				conf->dispatch[type].outputs[conf->dispatch[type].count++] = profile;
+			}
+		}
+
+		/* Keyframes and sequence numbers are shared by the JSON
+		 * destinations, so each of them must get every event: one that
+		 * skipped a keyframe could not apply the deltas relative to it,
+		 * and one that skipped events would see gaps for losses. */
+		if ((conf->global->delta || conf->global->sequence)
+			&& profile->format == CEL_AMQP_FORMAT_JSON
+			&& (profile->events != UINT64_MAX || profile->tenant
+				|| profile->sample_threshold != UINT64_MAX
+				|| (profile->ratelimit && profile->ratelimit->bucket.interval
+					&& profile->ratelimit->bucket.policy == CEL_AMQP_RATE_SHED))) {
+			ast_log(LOG_ERROR, "delta and sequence need every event published to %s; "
+				"it may not filter events, be a tenant's, sample or shed\n",
+				profile->name);
+			return -1;
+		}
+	}
+
+	/* Sinks are shared with the running configuration, so they are only
+	 * started or changed once this one is known to be valid */
+	for (i = 0; i < conf->num_outputs; ++i) {
+		profile = conf->outputs[i];
+		if (!sink_is_local(profile->sink)) {
+			continue;
+		}
+		ao2_cleanup(profile->local);
+		profile->local = sink_get(profile);
+		if (!profile->local) {
+			/* Stop those just started for this configuration */
+			sinks_sweep();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int setup_amqp(void)
+{
+	struct cel_amqp_conf *conf = aco_pending_config(&cfg_info);
+	RAII_VAR(struct cel_amqp_conf *, old, NULL, ao2_cleanup);
+
+	if (!conf) {
+		return 0;
+	}
+
+	if (!conf->global) {
+		ast_log(LOG_ERROR, "Invalid cdr_amqp.conf\n");
+		return -1;
+	}
+
+	/* The partition header is patched per event like any other */
+	if (conf->global->partition == CEL_AMQP_PARTITION_HEADER) {
+		amqp_table_entry_t *entry =
+			&conf->global->header_template[conf->global->num_headers];
+
+		entry->key = amqp_cstring_bytes(conf->global->partition_header);
+		entry->value.kind = AMQP_FIELD_KIND_UTF8;
+		entry->value.value.bytes = amqp_empty_bytes;
+		conf->global->header_field[conf->global->num_headers++] =
+			CEL_AMQP_FIELD_LINKED_ID;
+	}
+
+	/* Resolve the rate limits once, so events never look them up */
+	bucket_init(&conf->global->bucket, conf->global->rate_limit,
+		conf->global->rate_burst);
+	ao2_callback(conf->ratelimits, OBJ_NODATA, ratelimit_init_cb, NULL);
+
+	old = ao2_global_obj_ref(confs);
+
+	if (setup_outputs(conf, old)) {
+		return -1;
+	}
+
+	/* Keyframes taken under other delta settings must not be deltas' base */
+	if (old && (old->global->delta != conf->global->delta
+		|| old->global->delta_keyframe_interval != conf->global->delta_keyframe_interval
+		|| old->global->delta_channels != conf->global->delta_channels)) {
+		ao2_callback(channels, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL);
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Total number of queued events.
+ *
+ * \note Must be called with publisher.lock held.
+ */
+static unsigned int publisher_queued(void)
+{
+	unsigned int queued = 0;
+	int i;
+
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX; ++i) {
+		queued += publisher.queued[i];
+	}
+
+	return queued;
+}
+
+/*!
+ * \brief Number of events queued for a destination beyond its queue sizes.
+ *
+ * \note Must be called with publisher.lock held.
+ */
+static unsigned int publisher_overflow(struct cel_amqp_conf *conf,
+	struct cel_amqp_profile *profile)
+{
+	unsigned int overflow = 0;
+	int i;
+
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX; ++i) {
+		if (profile->queue_length[i] > conf->global->queue_size[i]) {
+			overflow += profile->queue_length[i] - conf->global->queue_size[i];
+		}
+	}
+
+	return overflow;
+}
+
+/*!
+ * \brief Track whether the broker is blocking the connection.
+ *
+ * res_amqp does not surface connection.blocked/unblocked, but a blocked
+ * connection is visible as a publish that makes no progress: the broker
+ * stops reading and the socket write stalls. The publisher counts completed
+ * publishes without taking the lock; if that count has not moved for
+ * blocked_threshold while a batch is being published, the connection is
+ * blocked, and it is unblocked again as soon as the count moves.
+ *
+ * \note Must be called with publisher.lock held.
+ */
+static void publisher_check_blocked(struct cel_amqp_conf *conf)
+{
+	int progress = ast_atomic_fetchadd_int(&publisher.progress, 0);
+	struct timeval now = ast_tvnow();
+
+	if (progress != publisher.progress_seen || !publisher.publishing) {
+		publisher.progress_seen = progress;
+		publisher.progress_time = now;
+		if (publisher.blocked) {
+			int64_t blocked_ms = ast_tvdiff_ms(now, publisher.blocked_since);
+
+			publisher.blocked = 0;
+			publisher.blocked_ms += blocked_ms;
+			ast_log(LOG_NOTICE, "CEL AMQP connection unblocked after %" PRId64 " ms\n",
+				blocked_ms);
+		}
+		return;
+	}
+
+	if (!publisher.blocked
+		&& ast_tvdiff_ms(now, publisher.progress_time) >= conf->global->blocked_threshold) {
+		publisher.blocked = 1;
+		publisher.blocked_since = publisher.progress_time;
+		++publisher.blocked_count;
+		ast_log(LOG_WARNING, "CEL AMQP connection blocked; buffering events\n");
+	}
+}
+
+/*!
+ * \brief Apply a rate limit, if its policy is to shed.
+ *
+ * \retval 1 if the event must be dropped.
+ */
+static int rate_limit_shed(struct cel_amqp_bucket *bucket)
+{
+	if (bucket->policy != CEL_AMQP_RATE_SHED) {
+		return 0;
+	}
+
+	return bucket_take(bucket, bucket_now()) != 0;
+}
+
+/*!
+ * \brief Apply a rate limit, if its policy is to buffer.
+ *
+ * The token is reserved when the event is accepted, so the event is only
+ * charged once however long it is then held, and the publisher thread holds
+ * it in its destination's queue rather than sleeping.
+ *
+ * \return the earliest time the event may be published, in the ns the
+ * buckets count in; 0 if it need not be held.
+ */
+static int64_t rate_limit_hold(struct cel_amqp_bucket *bucket, int64_t now)
+{
+	int64_t delay;
+
+	if (bucket->policy != CEL_AMQP_RATE_BUFFER) {
+		return 0;
+	}
+
+	delay = bucket_reserve(bucket, now);
+
+	return delay > 0 ? now + delay : 0;
+}
+
+/*! \brief Value of a header_fields entry in a record */
+static const char *header_value(const struct ast_cel_event_record *record,
+	const char *name, unsigned int field)
+{
+	if (field == CEL_AMQP_FIELD_EVENT_NAME) {
+		/* The event name, as resolved for user defined events */
+		return name;
+	}
+	return S_OR(*(const char * const *) ((const char *) record
+		+ header_fields[field].offset), "");
+}
+
+/*!
+ * \brief Allocate a message with its AMQP headers filled in.
+ *
+ * The headers are copied from the configuration's template and only their
+ * values are patched; the entries, the values and the partition routing
+ * key, if any, share the message's allocation.
+ *
+ * \param global Current global configuration.
+ * \param record Event the message is for.
+ * \param name Event name, as resolved for user defined events.
+ */
+static struct cel_amqp_message *message_alloc(struct cel_amqp_global_conf *global,
+	const struct ast_cel_event_record *record, const char *name)
+{
+	struct cel_amqp_message *msg;
+	size_t lengths[CEL_AMQP_MAX_HEADERS + 1];
+	unsigned int entries = global->num_headers;
+	size_t routing_key_len = 0;
+	size_t size = 0;
+	char *data;
+	unsigned int i;
+
+	for (i = 0; i < global->num_headers; ++i) {
+		lengths[i] = strlen(header_value(record, name, global->header_field[i]));
+		size += lengths[i];
+	}
+	if (global->partition == CEL_AMQP_PARTITION_ROUTING_KEY) {
+		routing_key_len = strlen(record->linked_id);
+		size += routing_key_len;
+	}
+	if (global->sequence) {
+		entries += CEL_AMQP_SEQUENCE_HEADERS;
+	}
+	if (!ast_strlen_zero(global->publish_time_header)) {
+		++entries;
+	}
+
+	msg = ast_calloc(1, sizeof(*msg)
+		+ entries * sizeof(amqp_table_entry_t) + size);
+	if (!msg) {
+		return NULL;
+	}
+
+	memcpy(msg->header_entries, global->header_template,
+		global->num_headers * sizeof(amqp_table_entry_t));
+	data = (char *) (msg->header_entries + entries);
+	for (i = 0; i < global->num_headers; ++i) {
+		memcpy(data, header_value(record, name, global->header_field[i]), lengths[i]);
+		msg->header_entries[i].value.value.bytes.bytes = data;
+		msg->header_entries[i].value.value.bytes.len = lengths[i];
+		data += lengths[i];
+	}
+	msg->headers.num_entries = entries;
+	msg->headers.entries = msg->header_entries;
+
+	/* Set when published */
+	if (!ast_strlen_zero(global->publish_time_header)) {
+		msg->header_entries[entries - 1].key =
+			amqp_cstring_bytes(global->publish_time_header);
+		msg->header_entries[entries - 1].value.kind = AMQP_FIELD_KIND_I64;
+		msg->publish_time = 1;
+	}
+
+	if (global->partition == CEL_AMQP_PARTITION_ROUTING_KEY) {
+		memcpy(data, record->linked_id, routing_key_len);
+		msg->routing_key.bytes = data;
+		msg->routing_key.len = routing_key_len;
+	}
+
+	return msg;
+}
+
+/*!
+ * \brief Number an event.
+ *
+ * \param record Event to number.
+ * \param[out] call_sequence Number of the event within its call; 0 if the
+ * call could not be tracked.
+ * \return Number of the event since the module was loaded.
+ */
+static int64_t sequence_next(const struct ast_cel_event_record *record,
+	int64_t *call_sequence)
+{
+	struct cel_amqp_call *call;
+	size_t len;
+
+	*call_sequence = 0;
+
+	ao2_lock(calls);
+	call = ao2_find(calls, record->linked_id, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (!call && ao2_container_count(calls) < CEL_AMQP_MAX_CALLS) {
+		len = strlen(record->linked_id) + 1;
+		call = ao2_alloc_options(sizeof(*call) + len, NULL,
+			AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (call) {
+			memcpy(call->linked_id, record->linked_id, len);
+			ao2_link_flags(calls, call, OBJ_NOLOCK);
+		}
+	} else if (!call && !calls_full) {
+		ast_log(LOG_WARNING, "Tracking %d calls for call_sequence; is "
+			"LINKEDID_END enabled in cel.conf?\n", CEL_AMQP_MAX_CALLS);
+		calls_full = 1;
+	}
+	if (call) {
+		*call_sequence = ++call->sequence;
+	}
+	ao2_unlock(calls);
+
+	ao2_cleanup(call);
+
+	return ast_atomic_fetch_add(&sequence, 1, __ATOMIC_RELAXED) + 1;
+}
+
+/*!
+ * \brief Forget about a call once its last event has been numbered.
+ */
+static void sequence_end(const struct ast_cel_event_record *record)
+{
+	ao2_find(calls, record->linked_id,
+		OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA);
+
+	if (calls_full && ao2_container_count(calls) < CEL_AMQP_MAX_CALLS / 2) {
+		calls_full = 0;
+	}
+}
+
+/*!
+ * \brief Set the sequence headers of a message.
+ */
+static void message_sequence_set(struct cel_amqp_global_conf *global,
+	struct cel_amqp_message *msg, int64_t call_sequence, int64_t seq)
+{
+	amqp_table_entry_t *entry = &msg->header_entries[global->num_headers];
+
+	entry[0].key = amqp_cstring_bytes("call_sequence");
+	entry[0].value.kind = AMQP_FIELD_KIND_I64;
+	entry[0].value.value.i64 = call_sequence;
+	entry[1].key = amqp_cstring_bytes("sequence");
+	entry[1].value.kind = AMQP_FIELD_KIND_I64;
+	entry[1].value.value.i64 = seq;
+}
+
+static const char *delta_value(const struct ast_cel_event_record *record,
+	int field)
+{
+	return S_OR(*(const char * const *) ((const char *) record
+		+ delta_fields[field].offset), "");
+}
+
+/*!
+ * \brief Take a keyframe of a channel.
+ *
+ * The values are copied into the object's own allocation.
+ */
+static struct cel_amqp_channel *channel_alloc(
+	const struct ast_cel_event_record *record, unsigned int frame)
+{
+	struct cel_amqp_channel *channel;
+	size_t lengths[CEL_AMQP_DELTA_FIELDS];
+	size_t len = strlen(record->unique_id) + 1;
+	size_t size = len;
+	char *data;
+	unsigned int i;
+
+	for (i = 0; i < CEL_AMQP_DELTA_FIELDS; ++i) {
+		lengths[i] = strlen(delta_value(record, i)) + 1;
+		size += lengths[i];
+	}
+
+	channel = ao2_alloc_options(sizeof(*channel) + size, NULL,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!channel) {
+		return NULL;
+	}
+
+	channel->frame = frame;
+	channel->keyframe = frame;
+	channel->sweep = delta_sweep;
+	channel->amaflag = record->amaflag;
+	memcpy(channel->unique_id, record->unique_id, len);
+	data = channel->unique_id + len;
+	for (i = 0; i < CEL_AMQP_DELTA_FIELDS; ++i) {
+		memcpy(data, delta_value(record, i), lengths[i]);
+		channel->values[i] = data;
+		data += lengths[i];
+	}
+
+	return channel;
+}
+
+/*! \brief ao2_callback() matching the channels idle since the last sweep */
+static int channel_idle_cb(void *obj, void *arg, int flags)
+{
+	struct cel_amqp_channel *channel = obj;
+
+	return channel->sweep != delta_sweep ? CMP_MATCH : 0;
+}
+
+/*!
+ * \brief Make room in the full keyframe cache.
+ *
+ * Drops the keyframes of the channels that had no event since the last
+ * sweep, such as those whose CHAN_END is not enabled in cel.conf. Sweeps at
+ * most once a second, so that a cache full of live channels is not walked
+ * for each new one; those are published in full instead.
+ *
+ * \note Must be called with the channels container locked.
+ */
+static void delta_sweep_idle(void)
+{
+	struct timeval now = ast_tvnow();
+
+	if (ast_tvdiff_ms(now, delta_swept) < 1000) {
+		return;
+	}
+	ao2_callback(channels, OBJ_NOLOCK | OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE,
+		channel_idle_cb, NULL);
+	++delta_sweep;
+	delta_swept = now;
+}
+
+/*!
+ * \brief Take the keyframe of an ending channel out of the cache.
+ *
+ * Called for every CHAN_END before anything can drop it, as sequence_end()
+ * is, since a dropped one would otherwise leave its keyframe behind.
+ *
+ * \return the keyframe, to encode the CHAN_END against, or NULL.
+ */
+static struct cel_amqp_channel *delta_end(const struct ast_cel_event_record *record)
+{
+	return ao2_find(channels, record->unique_id, OBJ_SEARCH_KEY | OBJ_UNLINK);
+}
+
+/*!
+ * \brief Delta encode an event.
+ *
+ * Either takes a new keyframe of the channel, leaving the event whole, or
+ * removes the fields that are the same as in the channel's keyframe.
+ *
+ * \param global Current global configuration.
+ * \param record Event to encode.
+ * \param ended For a CHAN_END, the keyframe delta_end() took out, if any.
+ * \param json The event, with all of its fields.
+ */
+static void delta_encode(struct cel_amqp_global_conf *global,
+	const struct ast_cel_event_record *record, struct cel_amqp_channel *ended,
+	struct ast_json *json)
+{
+	struct cel_amqp_channel *channel;
+	unsigned int frame;
+	unsigned int i;
+	unsigned int j;
+	int same;
+
+	ao2_lock(channels);
+	if (record->event_type == AST_CEL_CHANNEL_END) {
+		channel = ao2_bump(ended);
+	} else {
+		channel = ao2_find(channels, record->unique_id,
+			OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	}
+	frame = channel ? channel->frame + 1 : 1;
+	if (!channel || record->event_type == AST_CEL_CHANNEL_START
+		|| (global->delta_keyframe_interval
+			&& frame - channel->keyframe >= global->delta_keyframe_interval)) {
+		if (channel) {
+			if (channel != ended) {
+				ao2_unlink_flags(channels, channel, OBJ_NOLOCK);
+			}
+			ao2_ref(channel, -1);
+			channel = NULL;
+		} else if ((unsigned int) ao2_container_count(channels)
+			>= global->delta_channels) {
+			delta_sweep_idle();
+			if ((unsigned int) ao2_container_count(channels)
+				>= global->delta_channels) {
+				frame = 0;
+			}
+		}
+		/* Nothing follows these to be encoded against the keyframe */
+		if (frame && record->event_type != AST_CEL_CHANNEL_END
+			&& record->event_type != AST_CEL_LINKEDID_END) {
+			channel = channel_alloc(record, frame);
+			if (channel) {
+				ao2_link_flags(channels, channel, OBJ_NOLOCK);
+				ao2_ref(channel, -1);
+			}
+		}
+		ao2_unlock(channels);
+
+		ast_json_object_set(json, "frame", ast_json_integer_create(frame));
+		return;
+	}
+	channel->frame = frame;
+	channel->sweep = delta_sweep;
+	ao2_unlock(channels);
+
+	/* The keyframe's values never change, so compare without the lock */
+	for (i = 0; i < CEL_AMQP_DELTA_FIELDS; i = j) {
+		same = 1;
+		for (j = i; j < CEL_AMQP_DELTA_FIELDS
+			&& !strcmp(delta_fields[j].key, delta_fields[i].key); ++j) {
+			same = same && !strcmp(delta_value(record, j), channel->values[j]);
+		}
+		if (same) {
+			ast_json_object_del(json, delta_fields[i].key);
+		}
+	}
+	if (record->amaflag == channel->amaflag) {
+		ast_json_object_del(json, "amaflags");
+	}
+
+	ast_json_object_set(json, "frame", ast_json_integer_create(frame));
+	ast_json_object_set(json, "keyframe",
+		ast_json_integer_create(channel->keyframe));
+
+	ao2_ref(channel, -1);
+}
+
+/*!
+ * \brief Compute the message_id of an event.
+ *
+ * A hash of the unique_id, the event type (and name, for user defined
+ * events) and the event time, which together identify a CEL event.
+ *
+ * \param record Event the message is for.
+ * \param name Event name, as resolved for user defined events.
+ * \param[out] buf Buffer for 16 hex digits and a terminator.
+ */
+static void message_id_set(const struct ast_cel_event_record *record,
+	const char *name, char *buf)
+{
+	unsigned char key[20];
+	uint64_t values[] = {
+		(uint64_t) record->event_type,
+		(uint64_t) record->event_time.tv_sec,
+		(uint64_t) record->event_time.tv_usec,
+	};
+	uint64_t hash;
+	int i;
+
+	/* Serialize the numbers little endian, for a host independent hash */
+	key[0] = values[0];
+	key[1] = values[0] >> 8;
+	key[2] = values[0] >> 16;
+	key[3] = values[0] >> 24;
+	for (i = 0; i < 8; ++i) {
+		key[4 + i] = values[1] >> (8 * i);
+		key[12 + i] = values[2] >> (8 * i);
+	}
+
+	hash = xxh64(record->unique_id, strlen(record->unique_id), 0);
+	hash = xxh64(key, sizeof(key), hash);
+	if (record->event_type == AST_CEL_USER_DEFINED) {
+		hash = xxh64(name, strlen(name), hash);
+	}
+
+	snprintf(buf, 17, "%016" PRIx64, hash);
+}
+
+static void message_free(struct cel_amqp_message *msg)
+{
+	if (!msg) {
+		return;
+	}
+	ao2_cleanup(msg->body);
+	ao2_cleanup(msg->row);
+	ast_free(msg);
+}
+
+/*!
+ * \brief Queue a serialized event for the publisher thread.
+ *
+ * Each destination has a bounded queue per priority class. When a class is
+ * full the event is shed; since the publisher always drains higher classes
+ * first, lower classes back up and start shedding long before critical
+ * events do. A destination that is down or whose breaker is open only fills,
+ * and sheds from, its own queues. While the connection is blocked, an
+ * allowance of blocked_buffer_size events per destination is accepted on
+ * top of the queue sizes.
+ *
+ * A queued message is published with the configuration, and therefore the
+ * connection and destination, it was accepted under, even if a reload swaps
+ * in a new one meanwhile. Rather than a reference per message, the publisher
+ * holds one reference per configuration while it has pending messages, so
+ * the old configuration is retired once its last message is published.
+ *
+ * \param conf Current configuration.
+ * \param priority Priority class of the event.
+ * \param msg Message to queue; ownership is taken in all cases.
+ */
+static void publisher_enqueue(struct cel_amqp_conf *conf,
+	enum cel_amqp_priority priority, struct cel_amqp_message *msg)
+{
+	struct cel_amqp_profile *profile = msg->profile;
+	unsigned int size = conf->global->queue_size[priority];
+	int shed = 0;
+
+	ast_mutex_lock(&publisher.lock);
+	publisher_check_blocked(conf);
+	if (profile->queue_length[priority] >= size
+		&& (!publisher.blocked
+			|| publisher_overflow(conf, profile) >= conf->global->blocked_buffer_size)) {
+		++publisher.dropped[priority];
+		CEL_AMQP_PROBE2(dropped, priority_names[priority], 1);
+		if (!profile->shedding[priority]) {
+			profile->shedding[priority] = 1;
+			shed = 1;
+		}
+	} else {
+		if (profile->queue_length[priority] >= size) {
+			++publisher.spilled;
+		}
+		msg->conf = conf;
+		msg->priority = priority;
+		if (!conf->pending++) {
+			ao2_ref(conf, +1);
+		}
+		if (msg->not_before) {
+			publisher.rate_waited_us += MAX(msg->not_before - bucket_now(), 0) / 1000;
+		}
+		if (!profile->queued) {
+			profile->conf = conf;
+			AST_LIST_INSERT_TAIL(&publisher.active, profile, active);
+		}
+		AST_LIST_INSERT_TAIL(&profile->queues[priority], msg, list);
+		++profile->queue_length[priority];
+		++profile->queued;
+		++publisher.queued[priority];
+		++publisher.enqueued[priority];
+		profile->shedding[priority] = 0;
+		/* Only wake the publisher for a destination it can publish to, and
+		 * a lingering one once its batch is full */
+		if ((publisher.idle && ast_tvzero(profile->retry))
+			|| (publisher.lingering == profile
+				&& profile->queued >= publisher.batch_size)) {
+			ast_cond_signal(&publisher.cond);
+		}
+		msg = NULL;
+	}
+	ast_mutex_unlock(&publisher.lock);
+
+	if (shed) {
+		ast_log(LOG_WARNING, "CEL AMQP %s priority queue of %s full; shedding events\n",
+			priority_names[priority], profile->name);
+	}
+	message_free(msg);
+}
+
+/*!
+ * \brief Remove the next messages for a destination, highest priority first.
+ *
+ * Messages held by a rate limit stay queued, unless stopping.
+ *
+ * \note Must be called with publisher.lock held.
+ *
+ * \param profile Destination to take messages of.
+ * \param limit Most messages to take.
+ * \param batch List the messages are appended to.
+ *
+ * \return number of messages taken.
+ */
+static unsigned int publisher_dequeue_profile(struct cel_amqp_profile *profile,
+	unsigned int limit, struct cel_amqp_message_list *batch)
+{
+	struct cel_amqp_message *msg;
+	int64_t now = bucket_now();
+	unsigned int count = 0;
+	int i;
+
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX && count < limit; ++i) {
+		while (count < limit && (msg = AST_LIST_FIRST(&profile->queues[i]))) {
+			if (msg->not_before > now && !publisher.stop) {
+				break;
+			}
+			AST_LIST_REMOVE_HEAD(&profile->queues[i], list);
+			AST_LIST_INSERT_TAIL(batch, msg, list);
+			--profile->queue_length[i];
+			--publisher.queued[i];
+			++count;
+		}
+	}
+
+	profile->queued -= count;
+	if (count && !profile->queued) {
+		AST_LIST_REMOVE(&publisher.active, profile, active);
+		profile->retry = ast_tv(0, 0);
+	}
+
+	return count;
+}
+
+/*!
+ * \brief Account for messages of a configuration that are done with.
+ *
+ * Releases the configuration when this was its last pending message.
+ *
+ * \note Must be called with publisher.lock held; it is dropped while
+ * releasing the configuration.
+ */
+static void publisher_done(struct cel_amqp_conf *conf, unsigned int count)
+{
+	conf->pending -= count;
+	if (!conf->pending) {
+		/* Last message accepted under this configuration */
+		ast_mutex_unlock(&publisher.lock);
+		ao2_ref(conf, -1);
+		ast_mutex_lock(&publisher.lock);
+	}
+}
+
+/*!
+ * \brief Drop every queued message for a destination.
+ *
+ * \note Must be called with publisher.lock held; it is dropped while
+ * releasing the configuration.
+ */
+static void publisher_flush(struct cel_amqp_profile *profile)
+{
+	struct cel_amqp_message_list flushed = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct cel_amqp_message *msg;
+	struct cel_amqp_conf *conf;
+	unsigned int count;
+
+	count = publisher_dequeue_profile(profile, UINT_MAX, &flushed);
+	if (!count) {
+		return;
+	}
+
+	/* A destination belongs to a single configuration */
+	conf = AST_LIST_FIRST(&flushed)->conf;
+	publisher.failed += count;
+	while ((msg = AST_LIST_REMOVE_HEAD(&flushed, list))) {
+		message_free(msg);
+	}
+	publisher_done(conf, count);
+}
+
+/*!
+ * \brief Wait on the publisher condition until a deadline.
+ *
+ * \note Must be called with publisher.lock held.
+ *
+ * \retval ETIMEDOUT if the deadline passed.
+ */
+static int publisher_wait_until(struct timeval deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline.tv_sec,
+		.tv_nsec = deadline.tv_usec * 1000,
+	};
+
+	return ast_cond_timedwait(&publisher.cond, &publisher.lock, &ts);
+}
+
+/*!
+ * \brief Make sure a destination has its broker connection.
+ *
+ * Connection attempts are spaced with exponential backoff and jitter:
+ * after n consecutive failures the delay is connect_backoff_min * 2^n,
+ * capped at connect_backoff_max, of which a random half is waited.
+ * Until connected, events simply stay queued.
+ *
+ * \note Must be called with publisher.lock held; it is dropped while
+ * connecting.
+ *
+ * \param conf Configuration the destination belongs to.
+ * \param profile Destination to connect.
+ *
+ * \retval 0 if connected.
+ * \retval -1 if not (yet).
+ */
+static int publisher_connect(struct cel_amqp_conf *conf,
+	struct cel_amqp_profile *profile)
+{
+	struct cel_amqp_global_conf *global = conf->global;
+	struct ast_amqp_connection *amqp;
+	unsigned int backoff;
+	unsigned int i;
+
+	if (profile->amqp) {
+		return 0;
+	}
+
+	if (ast_tvcmp(ast_tvnow(), profile->connect_next) < 0) {
+		return -1;
+	}
+
+	ast_mutex_unlock(&publisher.lock);
+	amqp = ast_amqp_get_connection(profile->connection);
+	ast_mutex_lock(&publisher.lock);
+
+	if (amqp) {
+		if (profile->connect_failures) {
+			ast_log(LOG_NOTICE, "Connected to AMQP connection %s after %u attempts\n",
+				profile->connection, profile->connect_failures + 1);
+		}
+		ao2_cleanup(profile->amqp);
+		profile->amqp = amqp;
+		profile->connect_failures = 0;
+		++profile->connects;
+		return 0;
+	}
+
+	backoff = global->connect_backoff_min;
+	for (i = 0; i < profile->connect_failures
+		&& backoff < global->connect_backoff_max; ++i) {
+		backoff *= 2;
+	}
+	backoff = MIN(backoff, global->connect_backoff_max);
+	backoff = backoff / 2 + (backoff ? ast_random() % (backoff / 2 + 1) : 0);
+
+	ast_log(LOG_WARNING, "Could not get AMQP connection %s; retrying in %u ms\n",
+		profile->connection, backoff);
+
+	++profile->connect_failures;
+	profile->connect_next = ast_tvadd(ast_tvnow(), ast_samp2tv(backoff, 1000));
+
+	return -1;
+}
+
+/*!
+ * \brief Whether a destination can be published to now.
+ *
+ * Not until one of its messages is no longer held by a rate limit. Connects
+ * it if need be, and lets its open circuit breaker through for a probe once
+ * breaker_reset_timeout has passed. When stopping there is no waiting: rate
+ * limits are ignored, a destination that is not connected is given up on,
+ * and one whose breaker is open is probed right away, but only once.
+ *
+ * \note Must be called with publisher.lock held; it is dropped while
+ * connecting.
+ *
+ * \param conf Configuration the destination belongs to.
+ * \param profile Destination to check.
+ * \param[out] next When not ready, earliest time it may be.
+ *
+ * \retval 1 if ready.
+ * \retval 0 if not yet.
+ * \retval -1 if given up on.
+ */
+static int publisher_ready(struct cel_amqp_conf *conf,
+	struct cel_amqp_profile *profile, struct timeval *next)
+{
+	struct cel_amqp_message *msg;
+	struct timeval retry;
+	int64_t due = INT64_MAX;
+	int i;
+
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX && !publisher.stop; ++i) {
+		msg = AST_LIST_FIRST(&profile->queues[i]);
+		if (msg) {
+			due = MIN(due, msg->not_before);
+		}
+	}
+	if (due != INT64_MAX && due > bucket_now()) {
+		/* Round up, so it is not tried before the message conforms */
+		due = (due + 999) / 1000;
+		*next = ast_tv(due / 1000000, due % 1000000);
+		return 0;
+	}
+
+	if (publisher_connect(conf, profile) != 0) {
+		if (publisher.stop) {
+			/* Nowhere to drain to */
+			ast_log(LOG_WARNING, "Dropping %u queued CEL events for %s; not connected\n",
+				profile->queued, profile->name);
+			return -1;
+		}
+		*next = profile->connect_next;
+		return 0;
+	}
+
+	if (profile->breaker != CEL_AMQP_BREAKER_OPEN) {
+		return 1;
+	}
+
+	retry = ast_tvadd(profile->breaker_opened,
+		ast_samp2tv(conf->global->breaker_reset_timeout, 1000));
+	if (publisher.stop) {
+		/* Probe right away, but only once, rather than wait */
+		if (profile->stop_probed) {
+			ast_log(LOG_WARNING, "Dropping %u queued CEL events for %s; circuit breaker open\n",
+				profile->queued, profile->name);
+			return -1;
+		}
+		profile->stop_probed = 1;
+	} else if (ast_tvcmp(ast_tvnow(), retry) < 0) {
+		*next = retry;
+		return 0;
+	}
+	profile->breaker = CEL_AMQP_BREAKER_HALF_OPEN;
+	++publisher.breaker_probes;
+
+	return 1;
+}
+
+/*!
+ * \brief Pick the destination to publish a batch to.
+ *
+ * The ready destination with the highest priority messages queued, so that
+ * a destination which is down or whose breaker is open does not hold up the
+ * others; destinations on a par take turns. The messages of a destination
+ * given up on are dropped. This only walks the destinations, not their
+ * queues.
+ *
+ * \note Must be called with publisher.lock held; it is dropped while
+ * connecting and while dropping messages.
+ *
+ * \param[out] conf Configuration the destination belongs to.
+ * \param[out] next When none is ready, earliest time one may be.
+ *
+ * \return destination, or NULL if none is ready.
+ */
+static struct cel_amqp_profile *publisher_next(struct cel_amqp_conf **conf,
+	struct timeval *next)
+{
+	unsigned int round = ++publisher.round;
+
+	*next = ast_tv(0, 0);
+	for (;;) {
+		struct cel_amqp_profile *profile = NULL;
+		struct cel_amqp_profile *candidate;
+		struct timeval ready;
+		int i;
+
+		/* The destination not considered yet with the highest priority
+		 * messages. Rescanned each time, as destinations come and go
+		 * while unlocked. */
+		for (i = 0; i < CEL_AMQP_PRIORITY_MAX && !profile; ++i) {
+			AST_LIST_TRAVERSE(&publisher.active, candidate, active) {
+				if (candidate->round != round && candidate->queue_length[i]) {
+					profile = candidate;
+					break;
+				}
+			}
+		}
+		if (!profile) {
+			return NULL;
+		}
+		profile->round = round;
+		*conf = profile->conf;
+
+		switch (publisher_ready(*conf, profile, &ready)) {
+		case 1:
+			profile->retry = ast_tv(0, 0);
+			/* To the back of the line */
+			AST_LIST_REMOVE(&publisher.active, profile, active);
+			AST_LIST_INSERT_TAIL(&publisher.active, profile, active);
+			return profile;
+		case 0:
+			/* Events for it need not wake the publisher until then */
+			profile->retry = ready;
+			if (ast_tvzero(*next) || ast_tvcmp(ready, *next) < 0) {
+				*next = ready;
+			}
+			break;
+		default:
+			publisher_flush(profile);
+			break;
+		}
+	}
+}
+
+/*!
+ * \brief Put a batch of messages back at the head of their queues.
+ *
+ * \note Must be called with publisher.lock held.
+ */
+static void publisher_requeue_list(struct cel_amqp_message_list *list)
+{
+	struct cel_amqp_message_list requeue[CEL_AMQP_PRIORITY_MAX];
+	struct cel_amqp_profile *profile;
+	struct cel_amqp_message *msg;
+	int i;
+
+	msg = AST_LIST_FIRST(list);
+	if (!msg) {
+		return;
+	}
+
+	/* A batch is for a single destination */
+	profile = msg->profile;
+	if (!profile->queued) {
+		profile->conf = msg->conf;
+		AST_LIST_INSERT_TAIL(&publisher.active, profile, active);
+	}
+
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX; ++i) {
+		AST_LIST_HEAD_INIT_NOLOCK(&requeue[i]);
+	}
+
+	while ((msg = AST_LIST_REMOVE_HEAD(list, list))) {
+		AST_LIST_INSERT_TAIL(&requeue[msg->priority], msg, list);
+		++profile->queue_length[msg->priority];
+		++profile->queued;
+		++publisher.queued[msg->priority];
+	}
+
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX; ++i) {
+		AST_LIST_APPEND_LIST(&requeue[i], &profile->queues[i], list);
+		AST_LIST_APPEND_LIST(&profile->queues[i], &requeue[i], list);
+	}
+}
+
+/*!
+ * \brief Feed the outcome of a publish to a destination's circuit breaker.
+ *
+ * \param conf Configuration the message was published with.
+ * \param profile Destination the message was published to.
+ * \param ok Whether the publish succeeded in reasonable time.
+ */
+static void breaker_record(struct cel_amqp_conf *conf,
+	struct cel_amqp_profile *profile, int ok)
+{
+	unsigned int threshold = conf->global->breaker_threshold;
+
+	if (ok) {
+		profile->breaker_failures = 0;
+		if (profile->breaker == CEL_AMQP_BREAKER_HALF_OPEN) {
+			ast_mutex_lock(&publisher.lock);
+			profile->breaker = CEL_AMQP_BREAKER_CLOSED;
+			++publisher.breaker_recoveries;
+			ast_mutex_unlock(&publisher.lock);
+			ast_log(LOG_NOTICE, "CEL AMQP circuit breaker of %s closed\n",
+				profile->name);
+		}
+		return;
+	}
+
+	if (!threshold) {
+		return;
+	}
+
+	if (profile->breaker == CEL_AMQP_BREAKER_HALF_OPEN
+		|| ++profile->breaker_failures >= threshold) {
+		if (profile->breaker == CEL_AMQP_BREAKER_CLOSED) {
+			ast_log(LOG_WARNING, "CEL AMQP circuit breaker of %s opened after %u failed or slow publishes\n",
+				profile->name, profile->breaker_failures);
+		}
+		ast_mutex_lock(&publisher.lock);
+		profile->breaker = CEL_AMQP_BREAKER_OPEN;
+		profile->breaker_opened = ast_tvnow();
+		++publisher.breaker_trips;
+		ast_mutex_unlock(&publisher.lock);
+		profile->breaker_failures = 0;
+	}
+}
+
+/*!
+ * \brief Allocate a row for the arrow format.
+ *
+ * \param record Event the row is for.
+ * \param name Event name, as resolved for user defined events.
+ */
+static struct cel_amqp_row *row_alloc(const struct ast_cel_event_record *record,
+	const char *name)
+{
+	struct cel_amqp_row *row;
+	const char *values[CEL_AMQP_ARROW_COLUMNS];
+	size_t size = 0;
+	unsigned int i;
+
+	for (i = 0; i < CEL_AMQP_ARROW_COLUMNS; ++i) {
+		if (arrow_columns[i].type == CEL_AMQP_ARROW_TIMESTAMP) {
+			values[i] = "";
+		} else if (arrow_columns[i].offset
+			== offsetof(struct ast_cel_event_record, event_name)) {
+			values[i] = name;
+		} else if (arrow_columns[i].offset
+			== offsetof(struct ast_cel_event_record, amaflag)) {
+			values[i] = ast_channel_amaflags2string(record->amaflag);
+		} else {
+			values[i] = S_OR(*(const char * const *) ((const char *) record
+				+ arrow_columns[i].offset), "");
+		}
+		size += strlen(values[i]);
+	}
+
+	row = ao2_alloc_options(sizeof(*row) + size, NULL,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!row) {
+		return NULL;
+	}
+
+	row->event_time = (int64_t) record->event_time.tv_sec * 1000000
+		+ record->event_time.tv_usec;
+	row->offsets[0] = 0;
+	for (i = 0; i < CEL_AMQP_ARROW_COLUMNS; ++i) {
+		size = strlen(values[i]);
+		memcpy(row->data + row->offsets[i], values[i], size);
+		row->offsets[i + 1] = row->offsets[i] + size;
+	}
+
+	return row;
+}
+
+static const char *row_value(const struct cel_amqp_row *row,
+	unsigned int column, size_t *len)
+{
+	*len = row->offsets[column + 1] - row->offsets[column];
+	return row->data + row->offsets[column];
+}
+
+/*! \brief Append n bytes to a buffer, returning where they go */
+static unsigned char *arrow_buf_grow(struct arrow_buf *buf, size_t n)
+{
+	if (buf->error) {
+		return NULL;
+	}
+
+	if (buf->len + n > buf->size) {
+		size_t size = MAX(MAX(buf->size * 2, buf->len + n), (size_t) 4096);
+		unsigned char *data = ast_realloc(buf->data, size);
+
+		if (!data) {
+			buf->error = 1;
+			return NULL;
+		}
+		buf->data = data;
+		buf->size = size;
+	}
+
+	buf->len += n;
+	return buf->data + buf->len - n;
+}
+
+static void put_le(unsigned char *p, uint64_t v, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		p[i] = v >> (8 * i);
+	}
+}
+
+/*!
+ * \brief Reserve n bytes at the front of the FlatBuffer being built.
+ *
+ * FlatBuffers are built back to front, so that objects are written before
+ * the tables referring to them; offsets are kept relative to the end.
+ */
+static unsigned char *fb_push(struct fb_builder *fb, size_t n)
+{
+	if (fb->error) {
+		return NULL;
+	}
+
+	if (fb->len + n > fb->cap) {
+		size_t cap = MAX(MAX(fb->cap * 2, fb->len + n), (size_t) 1024);
+		unsigned char *buf = ast_malloc(cap);
+
+		if (!buf) {
+			fb->error = 1;
+			return NULL;
+		}
+		if (fb->len) {
+			memcpy(buf + cap - fb->len, fb->buf + fb->cap - fb->len, fb->len);
+		}
+		ast_free(fb->buf);
+		fb->buf = buf;
+		fb->cap = cap;
+	}
+
+	fb->len += n;
+	return fb->buf + fb->cap - fb->len;
+}
+
+/*! \brief Pad so that align divides the size once len more bytes are pushed */
+static void fb_prealign(struct fb_builder *fb, size_t len, size_t align)
+{
+	size_t pad = (~(fb->len + len) + 1) & (align - 1);
+	unsigned char *p;
+
+	fb->minalign = MAX(fb->minalign, align);
+	if (pad && (p = fb_push(fb, pad))) {
+		memset(p, 0, pad);
+	}
+}
+
+static void fb_scalar(struct fb_builder *fb, uint64_t v, size_t size)
+{
+	unsigned char *p;
+
+	fb_prealign(fb, 0, size);
+	p = fb_push(fb, size);
+	if (p) {
+		put_le(p, v, size);
+	}
+}
+
+/*! \brief Push an offset to an object built earlier */
+static void fb_ref(struct fb_builder *fb, size_t off)
+{
+	fb_prealign(fb, 0, 4);
+	fb_scalar(fb, fb->len + 4 - off, 4);
+}
+
+static void fb_start(struct fb_builder *fb)
+{
+	fb->table_start = fb->len;
+	fb->num_fields = 0;
+}
+
+static void fb_field(struct fb_builder *fb, unsigned int id)
+{
+	ast_assert(fb->num_fields < ARRAY_LEN(fb->fields));
+	fb->fields[fb->num_fields].id = id;
+	fb->fields[fb->num_fields].off = fb->len;
+	++fb->num_fields;
+}
+
+static void fb_add(struct fb_builder *fb, unsigned int id, uint64_t v,
+	size_t size)
+{
+	fb_scalar(fb, v, size);
+	fb_field(fb, id);
+}
+
+static void fb_add_ref(struct fb_builder *fb, unsigned int id, size_t off)
+{
+	fb_ref(fb, off);
+	fb_field(fb, id);
+}
+
+/*! \brief Finish a table, writing its vtable in front of it */
+static size_t fb_end(struct fb_builder *fb)
+{
+	unsigned int count = 0;
+	unsigned int id;
+	unsigned int i;
+	size_t table_end;
+	size_t entry;
+
+	/* Offset to the vtable, patched once it is written */
+	fb_scalar(fb, 0, 4);
+	table_end = fb->len;
+
+	for (i = 0; i < fb->num_fields; ++i) {
+		count = MAX(count, fb->fields[i].id + 1);
+	}
+	for (id = count; id-- > 0;) {
+		entry = 0;
+		for (i = 0; i < fb->num_fields; ++i) {
+			if (fb->fields[i].id == id) {
+				entry = table_end - fb->fields[i].off;
+			}
+		}
+		fb_scalar(fb, entry, 2);
+	}
+	fb_scalar(fb, table_end - fb->table_start, 2);
+	fb_scalar(fb, 4 + 2 * count, 2);
+
+	if (!fb->error) {
+		put_le(fb->buf + fb->cap - table_end, fb->len - table_end, 4);
+	}
+
+	return table_end;
+}
+
+static size_t fb_string(struct fb_builder *fb, const char *s, size_t n)
+{
+	unsigned char *p;
+
+	fb_prealign(fb, n + 1, 4);
+	p = fb_push(fb, n + 1);
+	if (p) {
+		memcpy(p, s, n);
+		p[n] = '\0';
+	}
+	fb_scalar(fb, n, 4);
+
+	return fb->len;
+}
+
+/*! \brief Align for a vector; the elements are then pushed last to first */
+static void fb_vector_start(struct fb_builder *fb, size_t count, size_t size,
+	size_t align)
+{
+	fb_prealign(fb, count * size, 4);
+	fb_prealign(fb, count * size, align);
+}
+
+static size_t fb_vector_end(struct fb_builder *fb, size_t count)
+{
+	fb_scalar(fb, count, 4);
+	return fb->len;
+}
+
+/*! \brief Write a buffer's position in the body, padding it to 8 bytes */
+static void arrow_buffer(size_t start)
+{
+	unsigned char *p;
+	size_t pad = (8 - (arrow.body.len & 7)) & 7;
+
+	arrow.buffers[arrow.num_buffers].offset = start;
+	arrow.buffers[arrow.num_buffers].length = arrow.body.len - start;
+	++arrow.num_buffers;
+
+	if (pad && (p = arrow_buf_grow(&arrow.body, pad))) {
+		memset(p, 0, pad);
+	}
+}
+
+static void arrow_node(size_t length)
+{
+	arrow.nodes[arrow.num_nodes++] = length;
+}
+
+/*!
+ * \brief Write a Utf8 column to the body.
+ *
+ * \param column Column of the rows to write.
+ * \param rows Rows to write, or NULL for all of them in order.
+ * \param count Number of rows to write.
+ */
+static void arrow_utf8(unsigned int column, const uint32_t *rows, size_t count)
+{
+	unsigned char *p;
+	const char *value;
+	size_t start;
+	size_t len;
+	uint32_t off = 0;
+	size_t i;
+
+	/* No nulls, so no validity bitmap */
+	arrow_buffer(arrow.body.len);
+
+	start = arrow.body.len;
+	p = arrow_buf_grow(&arrow.body, 4 * (count + 1));
+	if (p) {
+		put_le(p, 0, 4);
+		for (i = 0; i < count; ++i) {
+			row_value(arrow.rows[rows ? rows[i] : i], column, &len);
+			off += len;
+			put_le(p + 4 * (i + 1), off, 4);
+		}
+	}
+	arrow_buffer(start);
+
+	start = arrow.body.len;
+	for (i = 0; i < count; ++i) {
+		value = row_value(arrow.rows[rows ? rows[i] : i], column, &len);
+		if (len && (p = arrow_buf_grow(&arrow.body, len))) {
+			memcpy(p, value, len);
+		}
+	}
+	arrow_buffer(start);
+
+	arrow_node(count);
+}
+
+/*! \brief Write a column of 4 or 8 byte integers to the body */
+static void arrow_ints(const int64_t *values, const uint32_t *indexes,
+	size_t count, size_t size)
+{
+	unsigned char *p;
+	size_t start;
+	size_t i;
+
+	arrow_buffer(arrow.body.len);
+
+	start = arrow.body.len;
+	p = arrow_buf_grow(&arrow.body, size * count);
+	if (p) {
+		for (i = 0; i < count; ++i) {
+			put_le(p + size * i, values ? (uint64_t) values[i] : indexes[i], size);
+		}
+	}
+	arrow_buffer(start);
+
+	arrow_node(count);
+}
+
+/*!
+ * \brief Wrap the header just built in a Message and append it to the stream.
+ *
+ * \param type MessageHeader union type of the header.
+ * \param header Offset of the header table.
+ */
+static void arrow_message(unsigned int type, size_t header)
+{
+	struct fb_builder *fb = &arrow.fb;
+	unsigned char *p;
+	size_t message;
+
+	fb_start(fb);
+	fb_add(fb, 3, arrow.body.len, 8); /* bodyLength */
+	fb_add_ref(fb, 2, header); /* header */
+	fb_add(fb, 0, 4, 2); /* version: V5 */
+	fb_add(fb, 1, type, 1); /* header_type */
+	message = fb_end(fb);
+
+	/* Finish, padding the metadata to 8 bytes */
+	fb_prealign(fb, 4, 8);
+	fb_ref(fb, message);
+	if (fb->error) {
+		return;
+	}
+
+	p = arrow_buf_grow(&arrow.out, 8 + fb->len + arrow.body.len);
+	if (!p) {
+		return;
+	}
+	put_le(p, 0xFFFFFFFF, 4); /* continuation */
+	put_le(p + 4, fb->len, 4);
+	memcpy(p + 8, fb->buf + fb->cap - fb->len, fb->len);
+	if (arrow.body.len) {
+		memcpy(p + 8 + fb->len, arrow.body.data, arrow.body.len);
+	}
+}
+
+static void arrow_reset(void)
+{
+	arrow.fb.len = 0;
+	arrow.fb.minalign = 1;
+	arrow.body.len = 0;
+	arrow.num_buffers = 0;
+	arrow.num_nodes = 0;
+}
+
+/*! \brief Build a RecordBatch table from the buffers and nodes written */
+static size_t arrow_record_batch(size_t length)
+{
+	struct fb_builder *fb = &arrow.fb;
+	size_t nodes;
+	size_t buffers;
+	unsigned int i;
+
+	fb_vector_start(fb, arrow.num_buffers, 16, 8);
+	for (i = arrow.num_buffers; i-- > 0;) {
+		fb_scalar(fb, arrow.buffers[i].length, 8);
+		fb_scalar(fb, arrow.buffers[i].offset, 8);
+	}
+	buffers = fb_vector_end(fb, arrow.num_buffers);
+
+	fb_vector_start(fb, arrow.num_nodes, 16, 8);
+	for (i = arrow.num_nodes; i-- > 0;) {
+		fb_scalar(fb, 0, 8); /* null_count */
+		fb_scalar(fb, arrow.nodes[i], 8);
+	}
+	nodes = fb_vector_end(fb, arrow.num_nodes);
+
+	fb_start(fb);
+	fb_add(fb, 0, length, 8);
+	fb_add_ref(fb, 1, nodes);
+	fb_add_ref(fb, 2, buffers);
+	return fb_end(fb);
+}
+
+static void arrow_schema(void)
+{
+	struct fb_builder *fb = &arrow.fb;
+	size_t fields[CEL_AMQP_ARROW_COLUMNS];
+	size_t name, type, index, dictionary, children, vector, timezone;
+	unsigned int type_type;
+	unsigned int dictionary_id = 0;
+	unsigned int i;
+
+	arrow_reset();
+
+	timezone = fb_string(fb, "UTC", 3);
+	for (i = 0; i < CEL_AMQP_ARROW_COLUMNS; ++i) {
+		name = fb_string(fb, arrow_columns[i].name, strlen(arrow_columns[i].name));
+		fb_vector_start(fb, 0, 4, 4);
+		children = fb_vector_end(fb, 0);
+
+		fb_start(fb);
+		if (arrow_columns[i].type == CEL_AMQP_ARROW_TIMESTAMP) {
+			fb_add_ref(fb, 1, timezone);
+			fb_add(fb, 0, 2, 2); /* unit: MICROSECOND */
+			type_type = 10; /* Timestamp */
+		} else {
+			type_type = 5; /* Utf8 */
+		}
+		type = fb_end(fb);
+
+		dictionary = 0;
+		if (arrow_columns[i].type == CEL_AMQP_ARROW_DICTIONARY) {
+			fb_start(fb);
+			fb_add(fb, 0, 32, 4); /* bitWidth */
+			fb_add(fb, 1, 1, 1); /* is_signed */
+			index = fb_end(fb);
+
+			fb_start(fb);
+			fb_add(fb, 0, dictionary_id++, 8); /* id */
+			fb_add_ref(fb, 1, index); /* indexType */
+			fb_add(fb, 2, 0, 1); /* isOrdered */
+			dictionary = fb_end(fb);
+		}
+
+		fb_start(fb);
+		fb_add_ref(fb, 0, name);
+		fb_add_ref(fb, 3, type);
+		if (dictionary) {
+			fb_add_ref(fb, 4, dictionary);
+		}
+		fb_add_ref(fb, 5, children);
+		fb_add(fb, 1, 0, 1); /* nullable */
+		fb_add(fb, 2, type_type, 1);
+		fields[i] = fb_end(fb);
+	}
+
+	fb_vector_start(fb, CEL_AMQP_ARROW_COLUMNS, 4, 4);
+	for (i = CEL_AMQP_ARROW_COLUMNS; i-- > 0;) {
+		fb_ref(fb, fields[i]);
+	}
+	vector = fb_vector_end(fb, CEL_AMQP_ARROW_COLUMNS);
+
+	fb_start(fb);
+	fb_add_ref(fb, 1, vector); /* fields */
+	fb_add(fb, 0, 0, 2); /* endianness: Little */
+	arrow_message(1, fb_end(fb)); /* Schema */
+}
+
+/*!
+ * \brief Dictionary encode a column, and write its DictionaryBatch.
+ *
+ * \param column Column to encode.
+ * \param id Dictionary id of the column.
+ * \param count Number of rows.
+ * \param[out] indexes Dictionary index of each row.
+ */
+static void arrow_dictionary(unsigned int column, unsigned int id,
+	size_t count, uint32_t *indexes)
+{
+	struct fb_builder *fb = &arrow.fb;
+	size_t mask = arrow.table_size - 1;
+	size_t values = 0;
+	const char *value;
+	const char *other;
+	size_t len;
+	size_t other_len;
+	size_t slot;
+	size_t i;
+	size_t batch;
+
+	memset(arrow.table, 0, arrow.table_size * sizeof(*arrow.table));
+	for (i = 0; i < count; ++i) {
+		value = row_value(arrow.rows[i], column, &len);
+		slot = xxh64(value, len, 0) & mask;
+		for (;;) {
+			if (!arrow.table[slot]) {
+				arrow.values[values] = i;
+				arrow.table[slot] = ++values;
+				break;
+			}
+			other = row_value(arrow.rows[arrow.values[arrow.table[slot] - 1]],
+				column, &other_len);
+			if (len == other_len && !memcmp(value, other, len)) {
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+		indexes[i] = arrow.table[slot] - 1;
+	}
+
+	arrow_reset();
+	arrow_utf8(column, arrow.values, values);
+	batch = arrow_record_batch(values);
+
+	fb_start(fb);
+	fb_add(fb, 0, id, 8); /* id */
+	fb_add_ref(fb, 1, batch); /* data */
+	fb_add(fb, 2, 0, 1); /* isDelta */
+	arrow_message(2, fb_end(fb)); /* DictionaryBatch */
+}
+
+/*!
+ * \brief Encode a batch of rows as an Arrow IPC stream, into arrow.out.
+ *
+ * The stream is complete on its own: the schema, a dictionary per
+ * dictionary encoded column, one record batch and the end of stream marker.
+ *
+ * \return 0 on success, -1 when out of memory.
+ */
+static int arrow_encode(struct cel_amqp_message_list *batch, size_t count)
+{
+	struct cel_amqp_message *msg;
+	unsigned char *p;
+	unsigned int dictionary_id = 0;
+	unsigned int i;
+	size_t j;
+
+	/* The per row arrays share one allocation, the times first for alignment */
+	if (count > arrow.rows_size) {
+		void *mem = ast_realloc(arrow.mem, count * (sizeof(*arrow.times)
+			+ sizeof(*arrow.rows)
+			+ (CEL_AMQP_ARROW_COLUMNS + 1) * sizeof(uint32_t)));
+
+		if (!mem) {
+			return -1;
+		}
+		arrow.mem = mem;
+		arrow.rows_size = count;
+	}
+	arrow.times = arrow.mem;
+	arrow.rows = (struct cel_amqp_row **) (arrow.times + count);
+	arrow.values = (uint32_t *) (arrow.rows + count);
+	arrow.indexes = arrow.values + count;
+	if (arrow.table_size < 2 * count) {
+		size_t size = 16;
+		void *table;
+
+		while (size < 2 * count) {
+			size *= 2;
+		}
+		table = ast_realloc(arrow.table, size * sizeof(*arrow.table));
+		if (!table) {
+			return -1;
+		}
+		arrow.table = table;
+		arrow.table_size = size;
+	}
+
+	j = 0;
+	AST_LIST_TRAVERSE(batch, msg, list) {
+		arrow.rows[j++] = msg->row;
+	}
+
+	arrow.out.len = 0;
+	arrow.out.error = 0;
+	arrow.body.error = 0;
+	arrow.fb.error = 0;
+
+	arrow_schema();
+	for (i = 0; i < CEL_AMQP_ARROW_COLUMNS; ++i) {
+		if (arrow_columns[i].type == CEL_AMQP_ARROW_DICTIONARY) {
+			arrow_dictionary(i, dictionary_id++, count,
+				arrow.indexes + i * count);
+		}
+	}
+
+	arrow_reset();
+	for (i = 0; i < CEL_AMQP_ARROW_COLUMNS; ++i) {
+		switch (arrow_columns[i].type) {
+		case CEL_AMQP_ARROW_UTF8:
+			arrow_utf8(i, NULL, count);
+			break;
+		case CEL_AMQP_ARROW_DICTIONARY:
+			arrow_ints(NULL, arrow.indexes + i * count, count, 4);
+			break;
+		case CEL_AMQP_ARROW_TIMESTAMP:
+			for (j = 0; j < count; ++j) {
+				arrow.times[j] = arrow.rows[j]->event_time;
+			}
+			arrow_ints(arrow.times, NULL, count, 8);
+			break;
+		}
+	}
+	arrow_message(3, arrow_record_batch(count)); /* RecordBatch */
+
+	/* End of stream */
+	p = arrow_buf_grow(&arrow.out, 8);
+	if (p) {
+		put_le(p, 0xFFFFFFFF, 4);
+		put_le(p + 4, 0, 4);
+	}
+
+	return arrow.out.error || arrow.body.error || arrow.fb.error ? -1 : 0;
+}
+
+static void arrow_free(void)
+{
+	ast_free(arrow.fb.buf);
+	ast_free(arrow.body.data);
+	ast_free(arrow.out.data);
+	ast_free(arrow.mem);
+	ast_free(arrow.table);
+	memset(&arrow, 0, sizeof(arrow));
+}
+
+static int publish_message(struct cel_amqp_profile *profile,
+	struct cel_amqp_message *msg)
+{
+	amqp_basic_properties_t props = {
+		._flags = AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_CONTENT_TYPE_FLAG,
+		.delivery_mode = 2, /* persistent delivery mode */
+		.content_type = amqp_cstring_bytes("application/json")
+	};
+	int res;
+
+	if (msg->headers.num_entries) {
+		props._flags |= AMQP_BASIC_HEADERS_FLAG;
+		props.headers = msg->headers;
+	}
+	if (msg->message_id[0]) {
+		props._flags |= AMQP_BASIC_MESSAGE_ID_FLAG;
+		props.message_id = amqp_cstring_bytes(msg->message_id);
+	}
+	if (msg->timestamp) {
+		props._flags |= AMQP_BASIC_TIMESTAMP_FLAG;
+		props.timestamp = msg->timestamp;
+	}
+	if (msg->publish_time) {
+		msg->header_entries[msg->headers.num_entries - 1].value.value.i64 =
+			tv_us(ast_tvnow());
+	}
+
+	CEL_AMQP_PROBE3(publish__start, profile->name, strlen(msg->body->json), 1);
+	res = ast_amqp_basic_publish(profile->amqp,
+		amqp_cstring_bytes(profile->exchange),
+		msg->routing_key.bytes ? msg->routing_key
+			: amqp_cstring_bytes(profile->queue),
+		0, /* mandatory; don't return unsendable messages */
+		0, /* immediate; allow messages to be queued */
+		&props,
+		amqp_cstring_bytes(msg->body->json));
+
+	CEL_AMQP_PROBE3(publish__end, profile->name, res, 1);
+
+	if (res != 0) {
+		ast_log(LOG_ERROR, "Error publishing CEL to AMQP\n");
+	} else {
+		lag_record(CEL_AMQP_LAG_PUBLISH, msg->body->event_time, tv_us(ast_tvnow()));
+	}
+
+	return res;
+}
+
+/*!
+ * \brief Publish a batch of messages as a single Arrow stream, freeing them.
+ *
+ * The whole batch is one AMQP message, so it is published or kept as a
+ * whole: when the breaker is open, or the publish fails while the breaker
+ * is enabled, every message stays in the batch to be requeued.
+ *
+ * \param conf Configuration the messages were accepted under.
+ * \param profile Destination of the messages.
+ * \param batch Messages to publish; those left unpublished remain.
+ * \param[out] failed Number of messages dropped after failing to publish.
+ *
+ * \return number of messages taken from the batch.
+ */
+static unsigned int publish_arrow(struct cel_amqp_conf *conf,
+	struct cel_amqp_profile *profile, struct cel_amqp_message_list *batch,
+	unsigned int *failed)
+{
+	amqp_basic_properties_t props = {
+		._flags = AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_CONTENT_TYPE_FLAG,
+		.delivery_mode = 2, /* persistent delivery mode */
+		.content_type = amqp_cstring_bytes("application/vnd.apache.arrow.stream")
+	};
+	amqp_table_entry_t publish_time;
+	struct cel_amqp_message *msg;
+	struct timeval start;
+	amqp_bytes_t body;
+	int64_t now_us;
+	unsigned int count = 0;
+	int res;
+	int slow;
+
+	if (profile->breaker == CEL_AMQP_BREAKER_OPEN) {
+		return 0;
+	}
+
+	AST_LIST_TRAVERSE(batch, msg, list) {
+		++count;
+	}
+
+	if (arrow_encode(batch, count) != 0) {
+		ast_log(LOG_ERROR, "Failed to encode %u CEL events as Arrow\n", count);
+		res = -1;
+	} else {
+		body.bytes = arrow.out.data;
+		body.len = arrow.out.len;
+		CEL_AMQP_PROBE2(serialized, body.len, count);
+
+		now_us = tv_us(ast_tvnow());
+		AST_LIST_TRAVERSE(batch, msg, list) {
+			lag_record(CEL_AMQP_LAG_SERIALIZE, msg->row->event_time, now_us);
+		}
+
+		if (!ast_strlen_zero(conf->global->publish_time_header)) {
+			publish_time.key = amqp_cstring_bytes(conf->global->publish_time_header);
+			publish_time.value.kind = AMQP_FIELD_KIND_I64;
+			publish_time.value.value.i64 = now_us;
+			props._flags |= AMQP_BASIC_HEADERS_FLAG;
+			props.headers.num_entries = 1;
+			props.headers.entries = &publish_time;
+		}
+
+		start = ast_tvnow();
+		CEL_AMQP_PROBE3(publish__start, profile->name, body.len, count);
+		res = ast_amqp_basic_publish(profile->amqp,
+			amqp_cstring_bytes(profile->exchange),
+			amqp_cstring_bytes(profile->queue),
+			0, /* mandatory; don't return unsendable messages */
+			0, /* immediate; allow messages to be queued */
+			&props,
+			body);
+		CEL_AMQP_PROBE3(publish__end, profile->name, res, count);
+		slow = ast_tvdiff_ms(ast_tvnow(), start) >= conf->global->breaker_slow_threshold;
+		ast_atomic_fetchadd_int(&publisher.progress, 1);
+
+		if (res != 0) {
+			ast_log(LOG_ERROR, "Error publishing CEL to AMQP\n");
+			if (conf->global->breaker_threshold) {
+				/* Keep them for when the broker recovers */
+				breaker_record(conf, profile, 0);
+				return 0;
+			}
+		}
+		breaker_record(conf, profile, res == 0 && !slow);
+	}
+
+	if (res != 0) {
+		*failed += count;
+		CEL_AMQP_PROBE2(dropped, "publish_failed", count);
+	} else {
+		now_us = tv_us(ast_tvnow());
+		AST_LIST_TRAVERSE(batch, msg, list) {
+			lag_record(CEL_AMQP_LAG_PUBLISH, msg->row->event_time, now_us);
+		}
+	}
+	while ((msg = AST_LIST_REMOVE_HEAD(batch, list))) {
+		message_free(msg);
+	}
+
+	return count;
+}
+
+/*!
+ * \brief Publish a batch of messages, freeing them.
+ *
+ * Stops early when the destination's circuit breaker opens. A message that
+ * fails to publish while the breaker is enabled also ends the batch: it is
+ * left in the batch, to be requeued with the rest, rather than dropped.
+ *
+ * \param conf Configuration the messages were accepted under.
+ * \param profile Destination of the messages.
+ * \param batch Messages to publish; those left unpublished remain.
+ * \param[out] failed Number of messages dropped after failing to publish.
+ *
+ * \return number of messages taken from the batch.
+ */
+static unsigned int publish_batch(struct cel_amqp_conf *conf,
+	struct cel_amqp_profile *profile, struct cel_amqp_message_list *batch,
+	unsigned int *failed)
+{
+	struct cel_amqp_message *msg;
+	unsigned int done = 0;
+
+	ast_assert(conf && conf->global && profile && profile->amqp);
+
+	if (profile->format == CEL_AMQP_FORMAT_ARROW) {
+		return publish_arrow(conf, profile, batch, failed);
+	}
+
+	while (profile->breaker != CEL_AMQP_BREAKER_OPEN
+		&& (msg = AST_LIST_REMOVE_HEAD(batch, list))) {
+		struct timeval start;
+		int res;
+		int slow;
+
+		start = ast_tvnow();
+		res = publish_message(profile, msg);
+		slow = ast_tvdiff_ms(ast_tvnow(), start) >= conf->global->breaker_slow_threshold;
+		ast_atomic_fetchadd_int(&publisher.progress, 1);
+
+		if (res != 0 && conf->global->breaker_threshold) {
+			/* Keep it, and the rest, for when the broker recovers */
+			AST_LIST_INSERT_HEAD(batch, msg, list);
+			breaker_record(conf, profile, 0);
+			break;
+		}
+
+		if (res != 0) {
+			++*failed;
+			CEL_AMQP_PROBE2(dropped, "publish_failed", 1);
+		}
+		breaker_record(conf, profile, res == 0 && !slow);
+		message_free(msg);
+		++done;
+	}
+
+	return done;
+}
+
+/*!
+ * \brief Adapt batch size and linger time after publishing a batch.
+ *
+ * AIMD: when lingering plus publishing exceeded the latency budget, the batch
+ * size is halved; when a batch came back full it grows by one. The linger
+ * time is then derived from the new batch size, as how long the current
+ * event rate takes to fill a batch, but only if that fits in the budget, so
+ * at low load events go out immediately.
+ *
+ * \note Must be called with publisher.lock held.
+ *
+ * \param conf Current configuration.
+ * \param count Number of messages in the batch.
+ * \param waited_us Time spent lingering for the batch.
+ * \param elapsed_us Time spent publishing the batch.
+ */
+static void publisher_adapt(struct cel_amqp_conf *conf, unsigned int count,
+	int64_t waited_us, int64_t elapsed_us)
+{
+	struct cel_amqp_global_conf *global = conf->global;
+	int64_t budget_us = (int64_t) global->max_added_latency * 1000;
+	struct timeval now = ast_tvnow();
+	int64_t sample_us = ast_tvdiff_us(now, publisher.rate_time);
+	unsigned long events = 0;
+	int i;
+
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX; ++i) {
+		events += publisher.enqueued[i] + publisher.dropped[i];
+	}
+
+	/* Exponentially weighted averages, 1/8 weight for the new sample */
+	if (count) {
+		unsigned int rtt = elapsed_us / count;
+
+		publisher.rtt_us = publisher.rtt_us ? publisher.rtt_us
+			- publisher.rtt_us / 8 + rtt / 8 : rtt;
+	}
+	if (sample_us >= 100000) {
+		unsigned int rate = (events - publisher.rate_events) * 1000000 / sample_us;
+
+		publisher.rate = publisher.rate - publisher.rate / 8 + rate / 8;
+		publisher.rate_events = events;
+		publisher.rate_time = now;
+	}
+
+	if (waited_us + elapsed_us > budget_us) {
+		publisher.batch_size /= 2;
+	} else if (count >= publisher.batch_size) {
+		++publisher.batch_size;
+	}
+
+	if (publisher.batch_size < global->min_batch_size) {
+		publisher.batch_size = global->min_batch_size;
+	}
+	if (publisher.batch_size > global->max_batch_size) {
+		publisher.batch_size = global->max_batch_size;
+	}
+	if (!publisher.batch_size) {
+		publisher.batch_size = 1;
+	}
+
+	if (publisher.rate) {
+		int64_t fill_us = (int64_t) publisher.batch_size * 1000000 / publisher.rate;
+		int64_t publish_us = (int64_t) publisher.batch_size * publisher.rtt_us;
+
+		if (fill_us + publish_us <= budget_us) {
+			publisher.linger_us = MIN(fill_us, (int64_t) global->max_linger * 1000);
+		} else {
+			publisher.linger_us = 0;
+		}
+	} else {
+		publisher.linger_us = 0;
+	}
+}
+
+/*!
+ * \brief Publisher thread; drains the priority queues to the broker.
+ *
+ * Messages are taken in batches, highest priority first; a batch holds the
+ * messages of a single ready destination, see publisher_next(), so each
+ * batch goes out in as few publishes as possible, and a destination that is
+ * down only holds up its own messages. Queued events are still
+ * published when asked to stop, so that an unload does not silently lose
+ * what was already accepted.
+ */
+static void *publisher_thread(void *data)
+{
+	ast_mutex_lock(&publisher.lock);
+	for (;;) {
+		struct cel_amqp_conf *conf = NULL;
+		struct cel_amqp_profile *profile = NULL;
+		struct cel_amqp_conf *current;
+		struct cel_amqp_message_list batch = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+		struct timeval start;
+		struct timeval next;
+		int64_t waited_us = 0;
+		int64_t elapsed_us;
+		unsigned int count = 0;
+		unsigned int limit;
+		unsigned int done;
+		unsigned int failed = 0;
+
+		if (!publisher_queued()) {
+			if (publisher.stop) {
+				break;
+			}
+			publisher.idle = 1;
+			ast_cond_wait(&publisher.cond, &publisher.lock);
+			publisher.idle = 0;
+			continue;
+		}
+
+		profile = publisher_next(&conf, &next);
+		if (!profile) {
+			if (publisher_queued()) {
+				/* Until one is ready, or an event for another one comes */
+				publisher.idle = 1;
+				publisher_wait_until(next);
+				publisher.idle = 0;
+			}
+			continue;
+		}
+		limit = profile->breaker == CEL_AMQP_BREAKER_HALF_OPEN
+			? 1 : publisher.batch_size;
 
-	global = ao2_alloc(sizeof(*global), conf_global_dtor);
-	if (!global) {
-		return NULL;
-	}
+		/* Give the batch a chance to fill up */
+		if (publisher.linger_us && !publisher.stop
+			&& profile->queued < limit) {
+			struct timeval wait = ast_tvadd(ast_tvnow(),
+				ast_samp2tv(publisher.linger_us, 1000000));
+			struct timespec ts = {
+				.tv_sec = wait.tv_sec,
+				.tv_nsec = wait.tv_usec * 1000,
+			};
 
-	if (ast_string_field_init(global, 64) != 0) {
-		return NULL;
-	}
+			start = ast_tvnow();
+			publisher.lingering = profile;
+			while (!publisher.stop && profile->queued < limit) {
+				if (ast_cond_timedwait(&publisher.cond, &publisher.lock, &ts) == ETIMEDOUT) {
+					break;
+				}
+			}
+			publisher.lingering = NULL;
+			waited_us = ast_tvdiff_us(ast_tvnow(), start);
+		}
 
-	aco_set_defaults(&global_option, "global", global);
+		count = publisher_dequeue_profile(profile, limit, &batch);
+		publisher.publishing = 1;
+		publisher.progress_seen = ast_atomic_fetchadd_int(&publisher.progress, 0);
+		publisher.progress_time = ast_tvnow();
+		ast_mutex_unlock(&publisher.lock);
 
-	return ao2_bump(global);
-}
+		start = ast_tvnow();
+		done = publish_batch(conf, profile, &batch, &failed);
+		elapsed_us = ast_tvdiff_us(ast_tvnow(), start);
 
-/*! \brief The conf file that's processed for the module. */
-static struct aco_file conf_file = {
-	/*! The config file name. */
-	.filename = CONF_FILENAME,
-	/*! The mapping object types to be processed. */
-	.types = ACO_TYPES(&global_option),
-};
+		/* Tuning always follows the current configuration */
+		current = conf_snapshot();
 
-static void conf_dtor(void *obj)
-{
-	struct cel_amqp_conf *conf = obj;
+		ast_mutex_lock(&publisher.lock);
+		publisher.publishing = 0;
+		publisher.published += done - failed;
+		publisher.failed += failed;
+		if (current) {
+			publisher_check_blocked(current);
+			publisher_adapt(current, count, waited_us, elapsed_us);
+		}
 
-	ao2_cleanup(conf->global);
+		/* Whatever the breaker stopped us from publishing goes back */
+		publisher_requeue_list(&batch);
+		if (done) {
+			publisher_done(conf, done);
+		}
+	}
+	ast_mutex_unlock(&publisher.lock);
+
+	return NULL;
 }
 
-static void *conf_alloc(void)
+static int publisher_start(void)
 {
-	RAII_VAR(struct cel_amqp_conf *, conf, NULL, ao2_cleanup);
+	ast_mutex_init(&publisher.lock);
+	ast_cond_init(&publisher.cond, NULL);
+	AST_LIST_HEAD_INIT_NOLOCK(&publisher.active);
+	publisher.stop = 0;
+	publisher.batch_size = 1;
+	publisher.linger_us = 0;
+	publisher.rate_time = ast_tvnow();
 
-	conf = ao2_alloc_options(sizeof(*conf), conf_dtor,
-		AO2_ALLOC_OPT_LOCK_NOLOCK);
-	if (!conf) {
-		return NULL;
+	if (ast_pthread_create_background(&publisher.thread, NULL,
+			publisher_thread, NULL)) {
+		ast_log(LOG_ERROR, "Failed to start CEL AMQP publisher thread\n");
+		publisher.thread = AST_PTHREADT_NULL;
+		ast_cond_destroy(&publisher.cond);
+		ast_mutex_destroy(&publisher.lock);
+		return -1;
 	}
 
-	conf->global = conf_global_create();
-	if (!conf->global) {
-		return NULL;
+	return 0;
+}
+
+static void publisher_stop(void)
+{
+	if (publisher.thread == AST_PTHREADT_NULL) {
+		return;
 	}
 
-	return ao2_bump(conf);
-}
+	ast_mutex_lock(&publisher.lock);
+	publisher.stop = 1;
+	ast_cond_signal(&publisher.cond);
+	ast_mutex_unlock(&publisher.lock);
 
-static int setup_amqp(void);
+	pthread_join(publisher.thread, NULL);
+	publisher.thread = AST_PTHREADT_NULL;
 
-CONFIG_INFO_STANDARD(cfg_info, confs, conf_alloc,
-	.files = ACO_FILES(&conf_file),
-	.pre_apply_config = setup_amqp,
-);
+	ast_cond_destroy(&publisher.cond);
+	ast_mutex_destroy(&publisher.lock);
 
-static int setup_amqp(void)
+	arrow_free();
+}
+
+/*!
+ * \brief Render an event time for the event_time field.
+ *
+ * Same output as ast_json_timeval(tv, NULL), but the calendar conversion
+ * and formatting of everything except the milliseconds is cached per
+ * thread for the current second, since bursts of events share it.
+ */
+static struct ast_json *event_time_json(struct cel_amqp_conf *conf,
+	const struct timeval *tv)
 {
-	struct cel_amqp_conf *conf = aco_pending_config(&cfg_info);
+	struct event_time_cache *cache;
+	char buf[64];
 
-	if (!conf) {
-		return 0;
+	if (conf->global->time_format == CEL_AMQP_TIME_EPOCH_US) {
+		return ast_json_integer_create((ast_json_int_t) tv->tv_sec * 1000000
+			+ tv->tv_usec);
 	}
 
-	if (!conf->global) {
-		ast_log(LOG_ERROR, "Invalid cdr_amqp.conf\n");
-		return -1;
+	cache = ast_threadstorage_get(&event_time_cache_buf, sizeof(*cache));
+	if (!cache) {
+		return ast_json_timeval(*tv, NULL);
 	}
 
-	/* Refresh the AMQP connection */
-	ao2_cleanup(conf->global->amqp);
-	conf->global->amqp = ast_amqp_get_connection(conf->global->connection);
+	if (cache->sec != tv->tv_sec || !cache->prefix[0]) {
+		struct ast_tm tm = {};
 
-	if (!conf->global->amqp) {
-		ast_log(LOG_ERROR, "Could not get AMQP connection %s\n",
-			conf->global->connection);
-		return -1;
+		ast_localtime(tv, &tm, NULL);
+		ast_strftime(cache->prefix, sizeof(cache->prefix), "%FT%T.", &tm);
+		ast_strftime(cache->zone, sizeof(cache->zone), "%z", &tm);
+		cache->sec = tv->tv_sec;
 	}
 
-	return 0;
+	snprintf(buf, sizeof(buf), "%s%03ld%s", cache->prefix,
+		(long) tv->tv_usec / 1000, cache->zone);
+
+	return ast_json_string_create(buf);
+}
+
+static void body_dtor(void *obj)
+{
+	struct cel_amqp_body *body = obj;
+
+	ast_json_free(body->json);
 }
 
 /*!
- * \brief CEL handler for AMQP.
+ * \brief Serialize an event to JSON.
  *
- * \param event CEL event.
+ * \param conf Current configuration.
+ * \param record Event to serialize.
+ * \param name Event name, as resolved for user defined events.
+ * \param ended For a CHAN_END, the channel's keyframe, see delta_end().
+ *
+ * \return the serialized event, or NULL on error.
  */
-static void amqp_cel_log(struct ast_event *event)
+static struct cel_amqp_body *event_body(struct cel_amqp_conf *conf,
+	const struct ast_cel_event_record *record, const char *name,
+	struct cel_amqp_channel *ended)
 {
-	RAII_VAR(struct cel_amqp_conf *, conf, NULL, ao2_cleanup);
 	RAII_VAR(struct ast_json *, json, NULL, ast_json_unref);
 	RAII_VAR(struct ast_json *, extra, NULL, ast_json_unref);
-	RAII_VAR(char *, str, NULL, ast_json_free);
-	const char *name;
-	int res;
-	struct ast_cel_event_record record = {
-		.version = AST_CEL_EVENT_RECORD_VERSION,
-	};
-	amqp_basic_properties_t props = {
-		._flags = AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_CONTENT_TYPE_FLAG,
-		.delivery_mode = 2, /* persistent delivery mode */
-		.content_type = amqp_cstring_bytes("application/json")
-	};
-
-	conf = ao2_global_obj_ref(confs);
-
-	ast_assert(conf && conf->global && conf->global->amqp);
-
-	/* Extract the data from the CEL */
-	if (ast_cel_fill_record(event, &record) != 0) {
-		return;
-	}
-
-	/* Handle user define events */
-	name = record.event_name;
-	if (record.event_type == AST_CEL_USER_DEFINED) {
-		name = record.user_defined_name;
-	}
+	struct cel_amqp_body *body;
 
 	/* Handle the optional extra field, although re-parsing JSON
 	 * makes me sad :-( */
-	if (strlen(record.extra) == 0) {
+	if (strlen(record->extra) == 0) {
 		extra = ast_json_null();
 	} else {
-		extra = ast_json_load_string(record.extra, NULL);
+		extra = ast_json_load_string(record->extra, NULL);
 		if (!extra) {
 			ast_log(LOG_ERROR, "Error parsing extra field\n");
-			extra = ast_json_string_create(record.extra);
+			extra = ast_json_string_create(record->extra);
 		}
 	}
 
@@ -254,62 +5860,453 @@ static void amqp_cel_log(struct ast_event *event)
 		"s: s, s: o, s: s, s: s, "
 		/* linked_id, uesr_field, peer, peer_account */
 		"s: s, s: s, s: s, s: s, "
-		/* extra */
-		"s: o"
+		/* extra, still released by RAII_VAR */
+		"s: O"
 		"}",
 		"event_name", name,
-		"account_code", record.account_code,
+		"account_code", record->account_code,
 
 		"caller_id",
-		"num", record.caller_id_num,
-		"name", record.caller_id_name,
-		"ani", record.caller_id_ani,
-		"rdnis", record.caller_id_rdnis,
-		"dnid", record.caller_id_dnid,
-
-		"extension", record.extension,
-		"context", record.context,
-		"channel", record.channel_name,
-		"application", record.application_name,
-
-		"app_data", record.application_data,
-		"event_time", ast_json_timeval(record.event_time, NULL),
-		"amaflags", ast_channel_amaflags2string(record.amaflag),
-		"unique_id", record.unique_id,
-
-		"linked_id", record.linked_id,
-		"user_field", record.user_field,
-		"peer", record.peer,
-		"peer_acount", record.peer_account,
+		"num", record->caller_id_num,
+		"name", record->caller_id_name,
+		"ani", record->caller_id_ani,
+		"rdnis", record->caller_id_rdnis,
+		"dnid", record->caller_id_dnid,
+
+		"extension", record->extension,
+		"context", record->context,
+		"channel", record->channel_name,
+		"application", record->application_name,
+
+		"app_data", record->application_data,
+		"event_time", event_time_json(conf, &record->event_time),
+		"amaflags", ast_channel_amaflags2string(record->amaflag),
+		"unique_id", record->unique_id,
+
+		"linked_id", record->linked_id,
+		"user_field", record->user_field,
+		"peer", record->peer,
+		"peer_acount", record->peer_account,
 		"extra", extra);
 	if (!json) {
-		return;
+		return NULL;
+	}
+
+	if (conf->global->delta) {
+		delta_encode(conf->global, record, ended, json);
+	}
+
+	body = ao2_alloc_options(sizeof(*body), body_dtor,
+		AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!body) {
+		return NULL;
 	}
+	body->event_time = tv_us(record->event_time);
 
 	/* Dump the JSON to a string for publication */
-	str = ast_json_dump_string(json);
-	if (!str) {
+	body->json = ast_json_dump_string(json);
+	if (!body->json) {
 		ast_log(LOG_ERROR, "Failed to build string from JSON\n");
+		ao2_ref(body, -1);
+		return NULL;
+	}
+	lag_record(CEL_AMQP_LAG_SERIALIZE, body->event_time, tv_us(ast_tvnow()));
+	CEL_AMQP_PROBE2(serialized, strlen(body->json), 1);
+
+	return body;
+}
+
+/*!
+ * \brief CEL handler for AMQP.
+ *
+ * \param event CEL event.
+ */
+static void amqp_cel_log(struct ast_event *event)
+{
+	struct cel_amqp_conf *conf;
+	struct cel_amqp_profile *outputs[CEL_AMQP_MAX_PROFILES + 1];
+	struct cel_amqp_profile *profile;
+	unsigned int count;
+	uint64_t call_hash = 0;
+	int call_hashed = 0;
+	int enqueued = 0;
+	struct cel_amqp_body *body = NULL;
+	struct cel_amqp_row *row = NULL;
+	struct cel_amqp_channel *ended = NULL;
+	struct cel_amqp_message *msg;
+	enum cel_amqp_priority priority;
+	const char *name;
+	int64_t call_sequence = 0;
+	int64_t seq = 0;
+	int64_t now = 0;
+	int64_t not_before = 0;
+	unsigned int i;
+	struct ast_cel_event_record record = {
+		.version = AST_CEL_EVENT_RECORD_VERSION,
+	};
+
+	CEL_AMQP_PROBE(event__received);
+
+	conf = conf_snapshot();
+
+	ast_assert(conf && conf->global);
+	if (!conf) {
 		return;
 	}
 
-	res = ast_amqp_basic_publish(conf->global->amqp,
-		amqp_cstring_bytes(conf->global->exchange),
-		amqp_cstring_bytes(conf->global->queue),
-		0, /* mandatory; don't return unsendable messages */
-		0, /* immediate; allow messages to be queued */
-		&props,
-		amqp_cstring_bytes(str));
+	/* Extract the data from the CEL */
+	if (ast_cel_fill_record(event, &record) != 0) {
+		return;
+	}
+	CEL_AMQP_PROBE3(record__filled, record.event_type, record.linked_id,
+		record.unique_id);
 
-	if (res != 0) {
-		ast_log(LOG_ERROR, "Error publishing CEL to AMQP\n");
+	if (record.event_type < 0
+		|| record.event_type >= CEL_AMQP_MAX_EVENT_TYPES) {
+		return;
+	}
+
+	/* Number events before anything can drop them, so drops show as gaps */
+	if (conf->global->sequence) {
+		seq = sequence_next(&record, &call_sequence);
+	}
+	if (record.event_type == AST_CEL_LINKEDID_END) {
+		sequence_end(&record);
+	}
+	if (conf->global->delta && record.event_type == AST_CEL_CHANNEL_END) {
+		ended = delta_end(&record);
+	}
+
+	/* Shed over the rate limit before paying for serialization */
+	if (rate_limit_shed(&conf->global->bucket)) {
+		ast_atomic_fetchadd_int(&publisher.rate_shed, 1);
+		CEL_AMQP_PROBE2(dropped, "rate_limit", 1);
+		ao2_cleanup(ended);
+		return;
+	}
+	/* Or hold each of its messages until it conforms */
+	if (conf->global->bucket.interval) {
+		now = bucket_now();
+		not_before = rate_limit_hold(&conf->global->bucket, now);
+	}
+
+	/* Handle user define events */
+	name = record.event_name;
+	if (record.event_type == AST_CEL_USER_DEFINED) {
+		name = record.user_defined_name;
+	}
+
+	priority = conf->global->event_priority[record.event_type];
+
+	/* Events of a tenant also go to its own destination */
+	count = conf->dispatch[record.event_type].count;
+	memcpy(outputs, conf->dispatch[record.event_type].outputs,
+		count * sizeof(*outputs));
+	profile = tenant_lookup(conf, &record);
+	if (profile && (profile->events & ((uint64_t) 1 << record.event_type))) {
+		outputs[count++] = profile;
+	}
+
+	/* Destinations sharing a format share the serialized event */
+	for (i = 0; i < count; ++i) {
+		profile = outputs[i];
+
+		/* Sampled per call, so a call is published whole or not at all */
+		if (profile->sample_threshold != UINT64_MAX) {
+			if (!call_hashed) {
+				call_hash = xxh64(record.linked_id, strlen(record.linked_id),
+					CEL_AMQP_SAMPLE_SEED);
+				call_hashed = 1;
+			}
+			if (call_hash >= profile->sample_threshold) {
+				ast_atomic_fetchadd_int(&publisher.sampled_out, 1);
+				CEL_AMQP_PROBE2(dropped, "sampled", 1);
+				continue;
+			}
+		}
+
+		if (profile->ratelimit && rate_limit_shed(&profile->ratelimit->bucket)) {
+			ast_atomic_fetchadd_int(&publisher.rate_shed, 1);
+			CEL_AMQP_PROBE2(dropped, "rate_limit", 1);
+			continue;
+		}
+
+		if (profile->local) {
+			if (body || (body = event_body(conf, &record, name, ended))) {
+				sink_enqueue(profile->local, body);
+				enqueued = 1;
+			}
+			continue;
+		}
+
+		if (profile->format == CEL_AMQP_FORMAT_ARROW) {
+			/* Encoded a batch at a time by the publisher thread */
+			if (!row && !(row = row_alloc(&record, name))) {
+				continue;
+			}
+			msg = ast_calloc(1, sizeof(*msg));
+			if (!msg) {
+				continue;
+			}
+			msg->row = ao2_bump(row);
+		} else {
+			if (!body && !(body = event_body(conf, &record, name, ended))) {
+				continue;
+			}
+			msg = message_alloc(conf->global, &record, name);
+			if (!msg) {
+				continue;
+			}
+			if (conf->global->message_id) {
+				message_id_set(&record, name, msg->message_id);
+			}
+			if (conf->global->timestamp) {
+				msg->timestamp = record.event_time.tv_sec;
+			}
+			if (conf->global->sequence) {
+				message_sequence_set(conf->global, msg, call_sequence, seq);
+			}
+			msg->body = ao2_bump(body);
+		}
+
+		msg->profile = profile;
+		msg->not_before = not_before;
+		if (profile->ratelimit && profile->ratelimit->bucket.interval) {
+			if (!now) {
+				now = bucket_now();
+			}
+			msg->not_before = MAX(not_before,
+				rate_limit_hold(&profile->ratelimit->bucket, now));
+		}
+		publisher_enqueue(conf, priority, msg);
+		enqueued = 1;
+	}
+
+	if (enqueued) {
+		lag_record(CEL_AMQP_LAG_ENQUEUE, tv_us(record.event_time), tv_us(ast_tvnow()));
+	}
+
+	ao2_cleanup(body);
+	ao2_cleanup(row);
+	ao2_cleanup(ended);
+}
+
+static char *handle_cli_status(struct ast_cli_entry *e, int cmd,
+	struct ast_cli_args *a)
+{
+	RAII_VAR(struct cel_amqp_conf *, conf, NULL, ao2_cleanup);
+	unsigned int j;
+	int i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "cel amqp show status";
+		e->usage =
+			"Usage: cel amqp show status\n"
+			"       Shows the CEL AMQP publisher queues and statistics\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	conf = ao2_global_obj_ref(confs);
+
+	ast_mutex_lock(&publisher.lock);
+	ast_cli(a->fd, "%-10s %10s %12s %12s\n",
+		"Priority", "Queued", "Enqueued", "Dropped");
+	for (i = 0; i < CEL_AMQP_PRIORITY_MAX; ++i) {
+		ast_cli(a->fd, "%-10s %10u %12lu %12lu\n", priority_names[i],
+			publisher.queued[i], publisher.enqueued[i], publisher.dropped[i]);
+	}
+	ast_cli(a->fd, "\nPublished: %lu\nFailed:    %lu\n",
+		publisher.published, publisher.failed);
+	ast_cli(a->fd, "\nBatch size:  %u\nLinger:      %u us\n"
+		"Publish RTT: %u us\nEvent rate:  %u/s\n",
+		publisher.batch_size, publisher.linger_us,
+		publisher.rtt_us, publisher.rate);
+	ast_cli(a->fd, "\n%-16s %-16s %s\n", "Destination", "Connection", "State");
+	for (j = 0; conf && j < conf->num_outputs; ++j) {
+		struct cel_amqp_profile *profile = conf->outputs[j];
+
+		if (profile->local) {
+			ast_cli(a->fd, "%-16s %-16s local\n", profile->name, "-");
+			continue;
+		}
+		ast_cli(a->fd, "%-16s %-16s ", profile->name, profile->connection);
+		if (!profile->connect_failures) {
+			ast_cli(a->fd, "%s (%lu connects)",
+				profile->amqp ? "connected" : "idle", profile->connects);
+		} else {
+			ast_cli(a->fd, "connecting (%u failed attempts, next in %" PRId64 " ms)",
+				profile->connect_failures,
+				MAX(ast_tvdiff_ms(profile->connect_next, ast_tvnow()), 0));
+		}
+		ast_cli(a->fd, ", breaker %s", breaker_names[profile->breaker]);
+		if (profile->breaker == CEL_AMQP_BREAKER_OPEN) {
+			ast_cli(a->fd, " for %" PRId64 " ms",
+				ast_tvdiff_ms(ast_tvnow(), profile->breaker_opened));
+		}
+		ast_cli(a->fd, ", %u queued\n", profile->queued);
+	}
+	if (conf && conf->num_tenants) {
+		ast_cli(a->fd, "Tenants:     %u mappings, %u context prefix lengths\n",
+			conf->num_tenants, conf->num_tenant_prefix_lens);
+	}
+	ast_cli(a->fd, "\nFlow:        %s",
+		publisher.blocked ? "blocked" : "flowing");
+	if (publisher.blocked) {
+		ast_cli(a->fd, " for %" PRId64 " ms",
+			ast_tvdiff_ms(ast_tvnow(), publisher.blocked_since));
+	}
+	ast_cli(a->fd, "\nBlocked:     %lu times, %" PRId64 " ms total\n"
+		"Spilled:     %lu events\n",
+		publisher.blocked_count, publisher.blocked_ms, publisher.spilled);
+	ast_cli(a->fd, "\nBreakers:    %lu opened, %lu probes, %lu closed\n",
+		publisher.breaker_trips, publisher.breaker_probes,
+		publisher.breaker_recoveries);
+	ast_cli(a->fd, "\nRate limited: %d shed, %" PRId64 " ms held\n",
+		ast_atomic_fetchadd_int(&publisher.rate_shed, 0),
+		publisher.rate_waited_us / 1000);
+	ast_cli(a->fd, "Sampled out:  %d\n",
+		ast_atomic_fetchadd_int(&publisher.sampled_out, 0));
+	ast_mutex_unlock(&publisher.lock);
+
+	ast_cli(a->fd, "\nSequence:    %" PRId64 " events, %d calls tracked\n",
+		ast_atomic_fetch_add(&sequence, 0, __ATOMIC_RELAXED),
+		ao2_container_count(calls));
+	ast_cli(a->fd, "Delta:       %d channels cached\n",
+		ao2_container_count(channels));
+
+	if (ao2_container_count(sinks)) {
+		struct ao2_iterator it = ao2_iterator_init(sinks, 0);
+		struct cel_amqp_sink *sink;
+
+		ast_cli(a->fd, "\n%-32s %10s %12s %12s %12s\n",
+			"Sink", "Queued", "Written", "Dropped", "Errors");
+		while ((sink = ao2_iterator_next(&it))) {
+			ast_mutex_lock(&sink->lock);
+			ast_cli(a->fd, "%-32s %10u %12d %12d %12d\n", sink->name,
+				sink->queued, ast_atomic_fetchadd_int(&sink->written, 0),
+				ast_atomic_fetchadd_int(&sink->dropped, 0),
+				ast_atomic_fetchadd_int(&sink->errors, 0));
+			ast_mutex_unlock(&sink->lock);
+			ao2_ref(sink, -1);
+		}
+		ao2_iterator_destroy(&it);
+	}
+
+	return CLI_SUCCESS;
+}
+
+/*! \brief Upper bound of the bucket holding the given fraction of the lags */
+static int64_t lag_percentile(enum cel_amqp_lag_stage stage, int64_t total,
+	double fraction)
+{
+	int64_t seen = 0;
+	int i;
+
+	for (i = 0; i < CEL_AMQP_LAG_BUCKETS; ++i) {
+		seen += __atomic_load_n(&lag.buckets[stage][i], __ATOMIC_RELAXED);
+		if (seen >= total * fraction) {
+			break;
+		}
+	}
+
+	return i ? (int64_t) 1 << MIN(i, CEL_AMQP_LAG_BUCKETS - 1) : 0;
+}
+
+static char *handle_cli_lag(struct ast_cli_entry *e, int cmd,
+	struct ast_cli_args *a)
+{
+	int64_t totals[CEL_AMQP_LAG_MAX] = { 0, };
+	int64_t count;
+	int stage;
+	int i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "cel amqp show lag";
+		e->usage =
+			"Usage: cel amqp show lag\n"
+			"       Shows how long after their event time CEL events are\n"
+			"       enqueued, serialized and published, in microseconds.\n"
+			"       Percentiles are bucket upper bounds.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4) {
+		return CLI_SHOWUSAGE;
+	}
+
+	for (stage = 0; stage < CEL_AMQP_LAG_MAX; ++stage) {
+		for (i = 0; i < CEL_AMQP_LAG_BUCKETS; ++i) {
+			totals[stage] += __atomic_load_n(&lag.buckets[stage][i], __ATOMIC_RELAXED);
+		}
+	}
+
+	ast_cli(a->fd, "%-10s %12s %12s %12s %12s %12s %12s\n",
+		"Stage", "Events", "Mean", "p50", "p90", "p99", "Max");
+	for (stage = 0; stage < CEL_AMQP_LAG_MAX; ++stage) {
+		count = totals[stage];
+		ast_cli(a->fd, "%-10s %12" PRId64 " %12" PRId64 " %12" PRId64 " %12" PRId64
+			" %12" PRId64 " %12" PRId64 "\n",
+			lag_stage_names[stage], count,
+			count ? __atomic_load_n(&lag.sum_us[stage], __ATOMIC_RELAXED) / count : 0,
+			lag_percentile(stage, count, 0.5),
+			lag_percentile(stage, count, 0.9),
+			lag_percentile(stage, count, 0.99),
+			__atomic_load_n(&lag.max_us[stage], __ATOMIC_RELAXED));
+	}
+
+	ast_cli(a->fd, "\n%-12s %12s %12s %12s\n", "Below (us)",
+		lag_stage_names[CEL_AMQP_LAG_ENQUEUE],
+		lag_stage_names[CEL_AMQP_LAG_SERIALIZE],
+		lag_stage_names[CEL_AMQP_LAG_PUBLISH]);
+	for (i = 0; i < CEL_AMQP_LAG_BUCKETS; ++i) {
+		int64_t counts[CEL_AMQP_LAG_MAX];
+		int any = 0;
+
+		for (stage = 0; stage < CEL_AMQP_LAG_MAX; ++stage) {
+			counts[stage] = __atomic_load_n(&lag.buckets[stage][i], __ATOMIC_RELAXED);
+			any |= counts[stage] != 0;
+		}
+		if (!any) {
+			continue;
+		}
+		if (i == CEL_AMQP_LAG_BUCKETS - 1) {
+			ast_cli(a->fd, "%-12s", "more");
+		} else {
+			ast_cli(a->fd, "%-12" PRId64, i ? (int64_t) 1 << i : 1);
+		}
+		ast_cli(a->fd, " %12" PRId64 " %12" PRId64 " %12" PRId64 "\n",
+			counts[CEL_AMQP_LAG_ENQUEUE], counts[CEL_AMQP_LAG_SERIALIZE],
+			counts[CEL_AMQP_LAG_PUBLISH]);
 	}
+
+	return CLI_SUCCESS;
 }
 
+static struct ast_cli_entry cli_commands[] = {
+	AST_CLI_DEFINE(handle_cli_status, "Show CEL AMQP status"),
+	AST_CLI_DEFINE(handle_cli_lag, "Show CEL AMQP lag histograms"),
+};
+
+/*!
+ * \brief Load or reload the configuration.
+ *
+ * The connection for a new configuration is set up by setup_amqp() before
+ * it is swapped in, so events keep flowing on the current one throughout a
+ * reload; see publisher_enqueue() for how the old one is retired.
+ */
 static int load_config(int reload)
 {
 	RAII_VAR(struct cel_amqp_conf *, conf, NULL, ao2_cleanup);
-	RAII_VAR(struct ast_amqp_connection *, amqp, NULL, ao2_cleanup);
 
 	switch (aco_process_config(&cfg_info, reload)) {
 	case ACO_PROCESS_ERROR:
@@ -325,24 +6322,30 @@ static int load_config(int reload)
 		return -1;
 	}
 
-	/* Refresh the AMQP connection */
-	ao2_cleanup(conf->global->amqp);
-	conf->global->amqp = ast_amqp_get_connection(conf->global->connection);
-
-	if (!conf->global->amqp) {
-		ast_log(LOG_ERROR, "Could not get AMQP connection %s\n",
-			conf->global->connection);
-		return -1;
-	}
-
 	return 0;
 }
 
 static int load_module(void)
 {
+	calls = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, 4099,
+		cel_amqp_call_hash_fn, NULL, cel_amqp_call_cmp_fn);
+	channels = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, 4099,
+		cel_amqp_channel_hash_fn, NULL, cel_amqp_channel_cmp_fn);
+	sinks = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, 7,
+		cel_amqp_sink_hash_fn, NULL, cel_amqp_sink_cmp_fn);
+	if (!calls || !channels || !sinks) {
+		ao2_cleanup(calls);
+		ao2_cleanup(channels);
+		ao2_cleanup(sinks);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
 	if (aco_info_init(&cfg_info) != 0) {
 		ast_log(LOG_ERROR, "Failed to initialize config");
 		aco_info_destroy(&cfg_info);
+		ao2_cleanup(calls);
+		ao2_cleanup(channels);
+		ao2_cleanup(sinks);
 		return -1;
 	}
 
@@ -355,29 +6358,230 @@ static int load_module(void)
 	aco_option_register(&cfg_info, "exchange", ACO_EXACT,
 		global_options, "", OPT_STRINGFIELD_T, 0,
 		STRFLDSET(struct cel_amqp_global_conf, exchange));
+	aco_option_register(&cfg_info, "sink", ACO_EXACT,
+		global_options, "amqp", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_global_conf, sink));
+	aco_option_register(&cfg_info, "sink_queue_size", ACO_EXACT,
+		global_options, "10000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, sink_conf.queue_size));
+	aco_option_register(&cfg_info, "file_max_size", ACO_EXACT,
+		global_options, "100", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, sink_conf.file_max_size));
+	aco_option_register(&cfg_info, "file_rotate_interval", ACO_EXACT,
+		global_options, "3600", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, sink_conf.file_rotate_interval));
+	aco_option_register(&cfg_info, "file_fsync_interval", ACO_EXACT,
+		global_options, "1000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, sink_conf.file_fsync_interval));
+	aco_option_register(&cfg_info, "shm_size", ACO_EXACT,
+		global_options, "16", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, sink_conf.shm_size));
+	aco_option_register(&cfg_info, "sample_rate", ACO_EXACT,
+		global_options, "1.0", OPT_DOUBLE_T, 0,
+		FLDSET(struct cel_amqp_global_conf, sample_rate));
+	aco_option_register_custom(&cfg_info, "time_format", ACO_EXACT,
+		global_options, "iso8601", time_format_handler, 0);
+	aco_option_register_custom(&cfg_info, "format", ACO_EXACT,
+		global_options, "json", global_format_handler, 0);
+	aco_option_register_custom(&cfg_info, "headers", ACO_EXACT,
+		global_options, "", headers_handler, 0);
+	aco_option_register_custom(&cfg_info, "partition", ACO_EXACT,
+		global_options, "none", partition_handler, 0);
+	aco_option_register(&cfg_info, "partition_header", ACO_EXACT,
+		global_options, "partition_key", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_global_conf, partition_header));
+	aco_option_register(&cfg_info, "publish_time_header", ACO_EXACT,
+		global_options, "", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_global_conf, publish_time_header));
+	aco_option_register(&cfg_info, "sequence", ACO_EXACT,
+		global_options, "no", OPT_BOOL_T, 1,
+		FLDSET(struct cel_amqp_global_conf, sequence));
+	aco_option_register(&cfg_info, "delta", ACO_EXACT,
+		global_options, "no", OPT_BOOL_T, 1,
+		FLDSET(struct cel_amqp_global_conf, delta));
+	aco_option_register(&cfg_info, "delta_keyframe_interval", ACO_EXACT,
+		global_options, "16", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, delta_keyframe_interval));
+	aco_option_register(&cfg_info, "delta_channels", ACO_EXACT,
+		global_options, "10000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, delta_channels));
+	aco_option_register(&cfg_info, "message_id", ACO_EXACT,
+		global_options, "no", OPT_BOOL_T, 1,
+		FLDSET(struct cel_amqp_global_conf, message_id));
+	aco_option_register(&cfg_info, "timestamp", ACO_EXACT,
+		global_options, "no", OPT_BOOL_T, 1,
+		FLDSET(struct cel_amqp_global_conf, timestamp));
+	aco_option_register_custom(&cfg_info, "critical_events", ACO_EXACT,
+		global_options, "CHAN_START,HANGUP,LINKEDID_END",
+		critical_events_handler, 0);
+	aco_option_register_custom(&cfg_info, "low_priority_events", ACO_EXACT,
+		global_options, "", low_priority_events_handler, 0);
+	aco_option_register(&cfg_info, "critical_queue_size", ACO_EXACT,
+		global_options, "10000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, queue_size[CEL_AMQP_PRIORITY_CRITICAL]));
+	aco_option_register(&cfg_info, "normal_queue_size", ACO_EXACT,
+		global_options, "5000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, queue_size[CEL_AMQP_PRIORITY_NORMAL]));
+	aco_option_register(&cfg_info, "low_queue_size", ACO_EXACT,
+		global_options, "1000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, queue_size[CEL_AMQP_PRIORITY_LOW]));
+	aco_option_register(&cfg_info, "min_batch_size", ACO_EXACT,
+		global_options, "1", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, min_batch_size));
+	aco_option_register(&cfg_info, "max_batch_size", ACO_EXACT,
+		global_options, "256", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, max_batch_size));
+	aco_option_register(&cfg_info, "max_linger", ACO_EXACT,
+		global_options, "20", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, max_linger));
+	aco_option_register(&cfg_info, "max_added_latency", ACO_EXACT,
+		global_options, "50", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, max_added_latency));
+	aco_option_register(&cfg_info, "blocked_threshold", ACO_EXACT,
+		global_options, "1000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, blocked_threshold));
+	aco_option_register(&cfg_info, "blocked_buffer_size", ACO_EXACT,
+		global_options, "50000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, blocked_buffer_size));
+	aco_option_register(&cfg_info, "connect_backoff_min", ACO_EXACT,
+		global_options, "500", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, connect_backoff_min));
+	aco_option_register(&cfg_info, "connect_backoff_max", ACO_EXACT,
+		global_options, "30000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, connect_backoff_max));
+	aco_option_register(&cfg_info, "breaker_threshold", ACO_EXACT,
+		global_options, "5", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, breaker_threshold));
+	aco_option_register(&cfg_info, "breaker_slow_threshold", ACO_EXACT,
+		global_options, "1000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, breaker_slow_threshold));
+	aco_option_register(&cfg_info, "breaker_reset_timeout", ACO_EXACT,
+		global_options, "5000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, breaker_reset_timeout));
+	aco_option_register(&cfg_info, "rate_limit", ACO_EXACT,
+		global_options, "0", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, rate_limit));
+	aco_option_register(&cfg_info, "rate_burst", ACO_EXACT,
+		global_options, "0", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_global_conf, rate_burst));
+	aco_option_register_custom(&cfg_info, "rate_limit_policy", ACO_EXACT,
+		global_options, "buffer", global_rate_policy_handler, 0);
+
+	aco_option_register(&cfg_info, "type", ACO_EXACT,
+		ratelimit_options, NULL, OPT_NOOP_T, 0, 0);
+	aco_option_register(&cfg_info, "exchange", ACO_EXACT,
+		ratelimit_options, "", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_ratelimit_conf, exchange));
+	aco_option_register(&cfg_info, "routing_key", ACO_EXACT,
+		ratelimit_options, "", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_ratelimit_conf, routing_key));
+	aco_option_register(&cfg_info, "rate", ACO_EXACT,
+		ratelimit_options, "0", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_ratelimit_conf, rate));
+	aco_option_register(&cfg_info, "burst", ACO_EXACT,
+		ratelimit_options, "0", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_ratelimit_conf, burst));
+	aco_option_register_custom(&cfg_info, "policy", ACO_EXACT,
+		ratelimit_options, "buffer", ratelimit_policy_handler, 0);
+
+	aco_option_register(&cfg_info, "type", ACO_EXACT,
+		profile_options, NULL, OPT_NOOP_T, 0, 0);
+	aco_option_register(&cfg_info, "connection", ACO_EXACT,
+		profile_options, "", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_profile, connection));
+	aco_option_register(&cfg_info, "queue", ACO_EXACT,
+		profile_options, "asterisk_cel", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_profile, queue));
+	aco_option_register(&cfg_info, "exchange", ACO_EXACT,
+		profile_options, "", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_profile, exchange));
+	aco_option_register_custom(&cfg_info, "format", ACO_EXACT,
+		profile_options, "json", profile_format_handler, 0);
+	aco_option_register_custom(&cfg_info, "events", ACO_EXACT,
+		profile_options, "", profile_events_handler, 0);
+	aco_option_register(&cfg_info, "sink", ACO_EXACT,
+		profile_options, "amqp", OPT_STRINGFIELD_T, 0,
+		STRFLDSET(struct cel_amqp_profile, sink));
+	aco_option_register(&cfg_info, "sink_queue_size", ACO_EXACT,
+		profile_options, "10000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_profile, sink_conf.queue_size));
+	aco_option_register(&cfg_info, "file_max_size", ACO_EXACT,
+		profile_options, "100", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_profile, sink_conf.file_max_size));
+	aco_option_register(&cfg_info, "file_rotate_interval", ACO_EXACT,
+		profile_options, "3600", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_profile, sink_conf.file_rotate_interval));
+	aco_option_register(&cfg_info, "file_fsync_interval", ACO_EXACT,
+		profile_options, "1000", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_profile, sink_conf.file_fsync_interval));
+	aco_option_register(&cfg_info, "shm_size", ACO_EXACT,
+		profile_options, "16", OPT_UINT_T, 0,
+		FLDSET(struct cel_amqp_profile, sink_conf.shm_size));
+	aco_option_register(&cfg_info, "sample_rate", ACO_EXACT,
+		profile_options, "1.0", OPT_DOUBLE_T, 0,
+		FLDSET(struct cel_amqp_profile, sample_rate));
+
+	aco_option_register_custom(&cfg_info, "^.+$", ACO_REGEX,
+		tenants_options, NULL, tenants_handler, 0);
 
 	if (load_config(0) != 0) {
 		ast_log(LOG_WARNING, "Configuration failed to load\n");
+		aco_info_destroy(&cfg_info);
+		ao2_global_obj_release(confs);
+		sinks_sweep();
+		ao2_cleanup(calls);
+		ao2_cleanup(channels);
+		ao2_cleanup(sinks);
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	if (publisher_start() != 0) {
+		aco_info_destroy(&cfg_info);
+		ao2_global_obj_release(confs);
+		sinks_sweep();
+		ao2_cleanup(calls);
+		ao2_cleanup(channels);
+		ao2_cleanup(sinks);
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
 	if (ast_cel_backend_register(CEL_NAME, amqp_cel_log) != 0) {
 		ast_log(LOG_ERROR, "Could not register CEL backend\n");
+		publisher_stop();
+		aco_info_destroy(&cfg_info);
+		ao2_global_obj_release(confs);
+		sinks_sweep();
+		ao2_cleanup(calls);
+		ao2_cleanup(channels);
+		ao2_cleanup(sinks);
 		return AST_MODULE_LOAD_FAILURE;
 	}
 
+	ast_cli_register_multiple(cli_commands, ARRAY_LEN(cli_commands));
+
 	ast_log(LOG_NOTICE, "CEL AMQP logging enabled\n");
 	return AST_MODULE_LOAD_SUCCESS;
 }
 
 static int unload_module(void)
 {
-	aco_info_destroy(&cfg_info);
-	ao2_global_obj_release(confs);
 	if (ast_cel_backend_unregister(CEL_NAME) != 0) {
 		return -1;
 	}
 
+	ast_cli_unregister_multiple(cli_commands, ARRAY_LEN(cli_commands));
+	publisher_stop();
+	conf_caches_release();
+	aco_info_destroy(&cfg_info);
+	ao2_global_obj_release(confs);
+	sinks_sweep();
+	ao2_cleanup(sinks);
+	sinks = NULL;
+	ao2_cleanup(calls);
+	calls = NULL;
+	ao2_cleanup(channels);
+	channels = NULL;
+
 	return 0;
 }
 